@@ -140,12 +140,14 @@ struct all_attrs_item {
 /*
  * Reallocate and reinitialize the array of all attributes (which is used in
  * the attribute collection process) in 'check' based on the global dictionary
- * of attributes.
+ * of attributes. Returns 1 if the array had to be reallocated, in which case
+ * the macros have to be determined again.
  */
-static void all_attrs_init(struct attr_hashmap *map, struct attr_check *check)
+static int all_attrs_init(struct attr_hashmap *map, struct attr_check *check)
 {
 	int i;
 	unsigned int size;
+	int reallocated = 0;
 
 	hashmap_lock(map);
 
@@ -165,6 +167,7 @@ static void all_attrs_init(struct attr_hashmap *map, struct attr_check *check)
 
 		REALLOC_ARRAY(check->all_attrs, size);
 		check->all_attrs_nr = size;
+		reallocated = 1;
 
 		hashmap_for_each_entry(&map->map, &iter, e,
 					ent /* member name */) {
@@ -180,10 +183,10 @@ static void all_attrs_init(struct attr_hashmap *map, struct attr_check *check)
 	 * This re-initialization can live outside of the locked region since
 	 * the attribute dictionary is no longer being accessed.
 	 */
-	for (i = 0; i < check->all_attrs_nr; i++) {
+	for (i = 0; i < check->all_attrs_nr; i++)
 		check->all_attrs[i].value = ATTR__UNKNOWN;
-		check->all_attrs[i].macro = NULL;
-	}
+
+	return reallocated;
 }
 
 /*
@@ -504,6 +507,37 @@ static void drop_attr_stack(struct attr_stack **stack)
 	}
 }
 
+/*
+ * The rules that can possibly match a path in the directory "dir" (which
+ * has a trailing slash unless it is the top-level one), in the order
+ * fill() has to try them. A rule whose pattern contains a slash can
+ * only match if the literal part of the pattern agrees with the
+ * directory part of the path, so most of those are weeded out once per
+ * directory instead of being tried again for every path in it.
+ */
+struct attr_candidate {
+	const struct match_attr *a;
+	const char *base;
+	int baselen;
+};
+
+struct attr_candidates {
+	struct strbuf dir;
+	size_t nr, alloc;
+	struct attr_candidate *items;
+};
+
+static void drop_attr_candidates(struct attr_candidates **candidates)
+{
+	struct attr_candidates *c = *candidates;
+
+	if (!c)
+		return;
+	strbuf_release(&c->dir);
+	free(c->items);
+	FREE_AND_NULL(*candidates);
+}
+
 /* List of all attr_check structs; access should be surrounded by mutex */
 static struct check_vector {
 	size_t nr;
@@ -566,6 +600,7 @@ static void drop_all_attr_stacks(void)
 
 	for (i = 0; i < check_vector.nr; i++) {
 		drop_attr_stack(&check_vector.checks[i]->stack);
+		drop_attr_candidates(&check_vector.checks[i]->candidates);
 	}
 
 	vector_unlock();
@@ -657,6 +692,7 @@ void attr_check_clear(struct attr_check *check)
 	check->all_attrs_nr = 0;
 
 	drop_attr_stack(&check->stack);
+	drop_attr_candidates(&check->candidates);
 }
 
 void attr_check_free(struct attr_check *check)
@@ -981,13 +1017,18 @@ static void bootstrap_attr_stack(struct index_state *istate,
 	push_stack(stack, e, NULL, 0);
 }
 
-static void prepare_attr_stack(struct index_state *istate,
-			       const struct object_id *tree_oid,
-			       const char *path, int dirlen,
-			       struct attr_stack **stack)
+/*
+ * Returns 1 if any frame had to be read or dropped, i.e. when the stack
+ * may differ from the one used for the previous path.
+ */
+static int prepare_attr_stack(struct index_state *istate,
+			      const struct object_id *tree_oid,
+			      const char *path, int dirlen,
+			      struct attr_stack **stack)
 {
 	struct attr_stack *info;
 	struct strbuf pathbuf = STRBUF_INIT;
+	int changed = !*stack;
 
 	/*
 	 * At the bottom of the attribute stack is the built-in
@@ -1030,6 +1071,7 @@ static void prepare_attr_stack(struct index_state *istate,
 
 		*stack = elem->prev;
 		attr_stack_free(elem);
+		changed = 1;
 	}
 
 	/*
@@ -1066,6 +1108,7 @@ static void prepare_attr_stack(struct index_state *istate,
 
 		origin = xstrdup(pathbuf.buf);
 		push_stack(stack, next, origin, len);
+		changed = 1;
 	}
 
 	/*
@@ -1074,6 +1117,7 @@ static void prepare_attr_stack(struct index_state *istate,
 	push_stack(stack, info, NULL, 0);
 
 	strbuf_release(&pathbuf);
+	return changed;
 }
 
 static int path_matches(const char *pathname, int pathlen,
@@ -1099,6 +1143,80 @@ static int path_matches(const char *pathname, int pathlen,
 			      pattern, prefix, pat->patternlen);
 }
 
+/*
+ * Can "pat", read from the attributes file in "base", match any path
+ * directly inside "dir"? Mirrors the literal-prefix checks done by
+ * match_pathname(); "base" is known to be a leading directory of "dir".
+ */
+static int pattern_may_match_dir(const struct pattern *pat,
+				 const char *base, int baselen,
+				 const char *dir, int dirlen)
+{
+	const char *pattern = pat->pattern;
+	int prefix = pat->nowildcardlen;
+	const char *rel = baselen ? dir + baselen + 1 : dir;
+	int rellen = dirlen - (rel - dir);
+
+	if (pat->flags & PATTERN_FLAG_NODIR)
+		return 1;
+
+	if (*pattern == '/') {
+		pattern++;
+		prefix--;
+	}
+
+	if (prefix <= rellen)
+		return !fspathncmp(pattern, rel, prefix);
+	if (fspathncmp(pattern, rel, rellen))
+		return 0;
+	/* the rest of the literal part would have to match the basename */
+	return !memchr(pattern + rellen, '/', prefix - rellen);
+}
+
+static void prepare_attr_candidates(struct attr_check *check,
+				    const char *path, int dirlen,
+				    int stack_changed)
+{
+	struct attr_candidates *c = check->candidates;
+	const struct attr_stack *stack;
+
+	/* include the slash after the directory, if there is one */
+	if (dirlen)
+		dirlen++;
+
+	if (!c) {
+		CALLOC_ARRAY(c, 1);
+		strbuf_init(&c->dir, 0);
+		check->candidates = c;
+	} else if (!stack_changed && c->dir.len == dirlen &&
+		   !memcmp(c->dir.buf, path, dirlen)) {
+		return;
+	}
+
+	strbuf_reset(&c->dir);
+	strbuf_add(&c->dir, path, dirlen);
+	c->nr = 0;
+
+	for (stack = check->stack; stack; stack = stack->prev) {
+		const char *base = stack->origin ? stack->origin : "";
+		unsigned i;
+
+		for (i = stack->num_matches; i > 0; i--) {
+			const struct match_attr *a = stack->attrs[i - 1];
+
+			if (a->is_macro ||
+			    !pattern_may_match_dir(&a->u.pat, base, stack->originlen,
+						   c->dir.buf, c->dir.len))
+				continue;
+			ALLOC_GROW(c->items, c->nr + 1, c->alloc);
+			c->items[c->nr].a = a;
+			c->items[c->nr].base = base;
+			c->items[c->nr].baselen = stack->originlen;
+			c->nr++;
+		}
+	}
+}
+
 static int macroexpand_one(struct all_attrs_item *all_attrs, int nr, int rem);
 
 static int fill_one(struct all_attrs_item *all_attrs,
@@ -1121,21 +1239,17 @@ static int fill_one(struct all_attrs_item *all_attrs,
 }
 
 static int fill(const char *path, int pathlen, int basename_offset,
-		const struct attr_stack *stack,
+		const struct attr_candidates *c,
 		struct all_attrs_item *all_attrs, int rem)
 {
-	for (; rem > 0 && stack; stack = stack->prev) {
-		unsigned i;
-		const char *base = stack->origin ? stack->origin : "";
+	size_t i;
 
-		for (i = stack->num_matches; 0 < rem && 0 < i; i--) {
-			const struct match_attr *a = stack->attrs[i - 1];
-			if (a->is_macro)
-				continue;
-			if (path_matches(path, pathlen, basename_offset,
-					 &a->u.pat, base, stack->originlen))
-				rem = fill_one(all_attrs, a, rem);
-		}
+	for (i = 0; rem > 0 && i < c->nr; i++) {
+		const struct attr_candidate *item = &c->items[i];
+
+		if (path_matches(path, pathlen, basename_offset,
+				 &item->a->u.pat, item->base, item->baselen))
+			rem = fill_one(all_attrs, item->a, rem);
 	}
 
 	return rem;
@@ -1156,9 +1270,14 @@ static int macroexpand_one(struct all_attrs_item *all_attrs, int nr, int rem)
  * This prevents having to search through the attribute stack each time
  * a macro needs to be expanded during the fill stage.
  */
-static void determine_macros(struct all_attrs_item *all_attrs,
+static void determine_macros(struct all_attrs_item *all_attrs, int nr,
 			     const struct attr_stack *stack)
 {
+	int j;
+
+	for (j = 0; j < nr; j++)
+		all_attrs[j].macro = NULL;
+
 	for (; stack; stack = stack->prev) {
 		unsigned i;
 		for (i = stack->num_matches; i > 0; i--) {
@@ -1185,6 +1304,7 @@ static void collect_some_attrs(struct index_state *istate,
 	int pathlen, rem, dirlen;
 	const char *cp, *last_slash = NULL;
 	int basename_offset;
+	int changed;
 
 	for (cp = path; *cp; cp++) {
 		if (*cp == '/' && cp[1])
@@ -1199,12 +1319,20 @@ static void collect_some_attrs(struct index_state *istate,
 		dirlen = 0;
 	}
 
-	prepare_attr_stack(istate, tree_oid, path, dirlen, &check->stack);
-	all_attrs_init(&g_attr_hashmap, check);
-	determine_macros(check->all_attrs, check->stack);
+	/*
+	 * Consecutive paths are usually in the same directory; the macros
+	 * and the rules that may apply only need to be worked out again
+	 * when the stack or the directory changes.
+	 */
+	changed = prepare_attr_stack(istate, tree_oid, path, dirlen, &check->stack);
+	changed |= all_attrs_init(&g_attr_hashmap, check);
+	if (changed)
+		determine_macros(check->all_attrs, check->all_attrs_nr,
+				 check->stack);
+	prepare_attr_candidates(check, path, dirlen, changed);
 
 	rem = check->all_attrs_nr;
-	fill(path, pathlen, basename_offset, check->stack, check->all_attrs, rem);
+	fill(path, pathlen, basename_offset, check->candidates, check->all_attrs, rem);
 }
 
 static const char *default_attr_source_tree_object_name;
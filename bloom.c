@@ -10,6 +10,7 @@
 #include "tree-walk.h"
 #include "config.h"
 #include "repository.h"
+#include "hex.h"
 
 define_commit_slab(bloom_filter_slab, struct bloom_filter);
 
@@ -384,6 +385,147 @@ struct bloom_filter *get_bloom_filter(struct repository *r, struct commit *c)
 	return filter;
 }
 
+/*
+ * Collects the paths a tree diff reports, along with their leading
+ * directories, without going through the global diff queue so that
+ * several threads can compute filters at once.
+ */
+struct changed_paths {
+	struct hashmap pathmap;
+	int nr;		/* paths reported by the diff */
+	int max;
+};
+
+static void add_changed_path(struct diff_options *opt, const char *fullpath)
+{
+	struct changed_paths *cp = opt->change_fn_data;
+	struct pathmap_hash_entry *e;
+	char *path;
+
+	if (++cp->nr > cp->max) {
+		/* too many to bother; make the tree diff stop early */
+		opt->flags.quick = 1;
+		opt->flags.has_changes = 1;
+		return;
+	}
+
+	/*
+	 * Add each leading directory of the changed file, i.e. for
+	 * 'dir/subdir/file' add 'dir' and 'dir/subdir' as well, so
+	 * the Bloom filter could be used to speed up commands like
+	 * 'git log dir/subdir', too.
+	 *
+	 * Note that directories are added without the trailing '/'.
+	 */
+	path = xstrdup(fullpath);
+	do {
+		char *last_slash = strrchr(path, '/');
+
+		FLEX_ALLOC_STR(e, path, path);
+		hashmap_entry_init(&e->entry, strhash(path));
+
+		if (!hashmap_get(&cp->pathmap, &e->entry, NULL))
+			hashmap_add(&cp->pathmap, &e->entry);
+		else
+			free(e);
+
+		if (!last_slash)
+			last_slash = path;
+		*last_slash = '\0';
+
+	} while (*path);
+	free(path);
+}
+
+static void changed_path_add_remove(struct diff_options *opt,
+				    int addremove UNUSED, unsigned mode UNUSED,
+				    const struct object_id *oid UNUSED,
+				    int oid_valid UNUSED,
+				    const char *fullpath,
+				    unsigned dirty_submodule UNUSED)
+{
+	add_changed_path(opt, fullpath);
+}
+
+static void changed_path_change(struct diff_options *opt,
+				unsigned old_mode UNUSED, unsigned new_mode UNUSED,
+				const struct object_id *old_oid UNUSED,
+				const struct object_id *new_oid UNUSED,
+				int old_oid_valid UNUSED, int new_oid_valid UNUSED,
+				const char *fullpath,
+				unsigned old_dirty_submodule UNUSED,
+				unsigned new_dirty_submodule UNUSED)
+{
+	add_changed_path(opt, fullpath);
+}
+
+enum bloom_filter_computed compute_bloom_filter(struct repository *r,
+						struct commit *c,
+						struct bloom_filter *filter,
+						const struct bloom_filter_settings *settings)
+{
+	struct changed_paths cp = {
+		.pathmap = HASHMAP_INIT(pathmap_cmp, NULL),
+		.max = settings->max_changed_paths,
+	};
+	struct pathmap_hash_entry *e;
+	struct hashmap_iter iter;
+	struct diff_options diffopt;
+	enum bloom_filter_computed computed = BLOOM_COMPUTED;
+
+	repo_diff_setup(r, &diffopt);
+	diffopt.flags.recursive = 1;
+	diffopt.detect_rename = 0;
+	diffopt.add_remove = changed_path_add_remove;
+	diffopt.change = changed_path_change;
+	diffopt.change_fn_data = &cp;
+	diff_setup_done(&diffopt);
+
+	if (c->parents)
+		diff_tree_oid(&c->parents->item->object.oid, &c->object.oid, "", &diffopt);
+	else
+		diff_tree_oid(NULL, &c->object.oid, "", &diffopt);
+
+	if (cp.nr > settings->max_changed_paths ||
+	    hashmap_get_size(&cp.pathmap) > settings->max_changed_paths) {
+		init_truncated_large_filter(filter, settings->hash_version);
+		computed |= BLOOM_TRUNC_LARGE;
+		goto cleanup;
+	}
+
+	filter->len = (hashmap_get_size(&cp.pathmap) * settings->bits_per_entry + BITS_PER_WORD - 1) / BITS_PER_WORD;
+	filter->version = settings->hash_version;
+	if (!filter->len) {
+		computed |= BLOOM_TRUNC_EMPTY;
+		filter->len = 1;
+	}
+	CALLOC_ARRAY(filter->data, filter->len);
+	filter->to_free = filter->data;
+
+	hashmap_for_each_entry(&cp.pathmap, &iter, e, entry) {
+		struct bloom_key key;
+		fill_bloom_key(e->path, strlen(e->path), &key, settings);
+		add_key_to_filter(&key, filter, settings);
+		clear_bloom_key(&key);
+	}
+
+cleanup:
+	hashmap_clear_and_free(&cp.pathmap, struct pathmap_hash_entry, entry);
+	return computed;
+}
+
+struct bloom_filter *set_bloom_filter(struct commit *c,
+				      const struct bloom_filter *computed)
+{
+	struct bloom_filter *filter = bloom_filter_slab_at(&bloom_filters, c);
+
+	if (filter->data)
+		BUG("commit %s already has a Bloom filter",
+		    oid_to_hex(&c->object.oid));
+	*filter = *computed;
+	return filter;
+}
+
 struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 						 struct commit *c,
 						 int compute_if_not_present,
@@ -391,8 +533,7 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 						 enum bloom_filter_computed *computed)
 {
 	struct bloom_filter *filter;
-	int i;
-	struct diff_options diffopt;
+	enum bloom_filter_computed ret;
 
 	if (computed)
 		*computed = BLOOM_NOT_COMPUTED;
@@ -429,98 +570,12 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 	if (!compute_if_not_present)
 		return NULL;
 
-	repo_diff_setup(r, &diffopt);
-	diffopt.flags.recursive = 1;
-	diffopt.detect_rename = 0;
-	diffopt.max_changes = settings->max_changed_paths;
-	diff_setup_done(&diffopt);
-
 	/* ensure commit is parsed so we have parent information */
 	repo_parse_commit(r, c);
 
-	if (c->parents)
-		diff_tree_oid(&c->parents->item->object.oid, &c->object.oid, "", &diffopt);
-	else
-		diff_tree_oid(NULL, &c->object.oid, "", &diffopt);
-	diffcore_std(&diffopt);
-
-	if (diff_queued_diff.nr <= settings->max_changed_paths) {
-		struct hashmap pathmap = HASHMAP_INIT(pathmap_cmp, NULL);
-		struct pathmap_hash_entry *e;
-		struct hashmap_iter iter;
-
-		for (i = 0; i < diff_queued_diff.nr; i++) {
-			const char *path = diff_queued_diff.queue[i]->two->path;
-
-			/*
-			 * Add each leading directory of the changed file, i.e. for
-			 * 'dir/subdir/file' add 'dir' and 'dir/subdir' as well, so
-			 * the Bloom filter could be used to speed up commands like
-			 * 'git log dir/subdir', too.
-			 *
-			 * Note that directories are added without the trailing '/'.
-			 */
-			do {
-				char *last_slash = strrchr(path, '/');
-
-				FLEX_ALLOC_STR(e, path, path);
-				hashmap_entry_init(&e->entry, strhash(path));
-
-				if (!hashmap_get(&pathmap, &e->entry, NULL))
-					hashmap_add(&pathmap, &e->entry);
-				else
-					free(e);
-
-				if (!last_slash)
-					last_slash = (char*)path;
-				*last_slash = '\0';
-
-			} while (*path);
-
-			diff_free_filepair(diff_queued_diff.queue[i]);
-		}
-
-		if (hashmap_get_size(&pathmap) > settings->max_changed_paths) {
-			init_truncated_large_filter(filter,
-						    settings->hash_version);
-			if (computed)
-				*computed |= BLOOM_TRUNC_LARGE;
-			goto cleanup;
-		}
-
-		filter->len = (hashmap_get_size(&pathmap) * settings->bits_per_entry + BITS_PER_WORD - 1) / BITS_PER_WORD;
-		filter->version = settings->hash_version;
-		if (!filter->len) {
-			if (computed)
-				*computed |= BLOOM_TRUNC_EMPTY;
-			filter->len = 1;
-		}
-		CALLOC_ARRAY(filter->data, filter->len);
-		filter->to_free = filter->data;
-
-		hashmap_for_each_entry(&pathmap, &iter, e, entry) {
-			struct bloom_key key;
-			fill_bloom_key(e->path, strlen(e->path), &key, settings);
-			add_key_to_filter(&key, filter, settings);
-			clear_bloom_key(&key);
-		}
-
-	cleanup:
-		hashmap_clear_and_free(&pathmap, struct pathmap_hash_entry, entry);
-	} else {
-		for (i = 0; i < diff_queued_diff.nr; i++)
-			diff_free_filepair(diff_queued_diff.queue[i]);
-		init_truncated_large_filter(filter, settings->hash_version);
-
-		if (computed)
-			*computed |= BLOOM_TRUNC_LARGE;
-	}
-
+	ret = compute_bloom_filter(r, c, filter, settings);
 	if (computed)
-		*computed |= BLOOM_COMPUTED;
-
-	free(diff_queued_diff.queue);
-	DIFF_QUEUE_CLEAR(&diff_queued_diff);
+		*computed = ret;
 
 	return filter;
 }
@@ -114,6 +114,28 @@ struct bloom_filter *get_or_compute_bloom_filter(struct repository *r,
 						 const struct bloom_filter_settings *settings,
 						 enum bloom_filter_computed *computed);
 
+/*
+ * Compute the Bloom filter for the changes "c" introduces over its
+ * first parent into "filter", without looking at or storing into the
+ * per-commit filter cache. The parents of "c" must already be parsed.
+ *
+ * Unlike get_or_compute_bloom_filter(), this does not touch any global
+ * diff state and may be called from several threads at once, as long
+ * as object reading is protected with enable_obj_read_lock().
+ */
+enum bloom_filter_computed compute_bloom_filter(struct repository *r,
+						struct commit *c,
+						struct bloom_filter *filter,
+						const struct bloom_filter_settings *settings);
+
+/*
+ * Store a filter computed by compute_bloom_filter() as the Bloom
+ * filter of "c"; the cache takes ownership of its data. It is a bug
+ * to call this for a commit that already has a filter.
+ */
+struct bloom_filter *set_bloom_filter(struct commit *c,
+				      const struct bloom_filter *computed);
+
 /*
  * Find the Bloom filter associated with the given commit "c".
  *
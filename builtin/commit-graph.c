@@ -20,8 +20,8 @@
 #define BUILTIN_COMMIT_GRAPH_WRITE_USAGE \
 	N_("git commit-graph write [--object-dir <dir>] [--append]\n" \
 	   "                       [--split[=<strategy>]] [--reachable | --stdin-packs | --stdin-commits]\n" \
-	   "                       [--changed-paths] [--[no-]max-new-filters <n>] [--[no-]progress]\n" \
-	   "                       <split-options>")
+	   "                       [--changed-paths] [--[no-]max-new-filters <n>] [--threads=<n>]\n" \
+	   "                       [--[no-]progress] <split-options>")
 
 static const char * builtin_commit_graph_verify_usage[] = {
 	BUILTIN_COMMIT_GRAPH_VERIFY_USAGE,
@@ -208,6 +208,8 @@ static int git_commit_graph_write_config(const char *var, const char *value,
 {
 	if (!strcmp(var, "commitgraph.maxnewfilters"))
 		write_opts.max_new_filters = git_config_int(var, value, ctx->kvi);
+	else if (!strcmp(var, "commitgraph.threads"))
+		write_opts.threads = git_config_int(var, value, ctx->kvi);
 	/*
 	 * No need to fall-back to 'git_default_config', since this was already
 	 * called in 'cmd_commit_graph()'.
@@ -249,6 +251,8 @@ static int graph_write(int argc, const char **argv, const char *prefix)
 		OPT_CALLBACK_F(0, "max-new-filters", &write_opts.max_new_filters,
 			NULL, N_("maximum number of changed-path Bloom filters to compute"),
 			0, write_option_max_new_filters),
+		OPT_INTEGER(0, "threads", &write_opts.threads,
+			N_("use threads when computing Bloom filters")),
 		OPT_BOOL(0, "progress", &opts.progress,
 			 N_("force progress reporting")),
 		OPT_END(),
@@ -261,6 +265,7 @@ static int graph_write(int argc, const char **argv, const char *prefix)
 	write_opts.max_commits = 0;
 	write_opts.expire_time = 0;
 	write_opts.max_new_filters = -1;
+	write_opts.threads = 0;
 
 	trace2_cmd_mode("write");
 
@@ -27,6 +27,7 @@
 #include "worktree.h"
 #include "pack-revindex.h"
 #include "pack-bitmap.h"
+#include "thread-utils.h"
 
 #define REACHABLE 0x0001
 #define SEEN      0x0002
@@ -50,6 +51,7 @@ static int verbose;
 static int show_progress = -1;
 static int show_dangling = 1;
 static int name_objects;
+static int fsck_threads = -1;
 #define ERROR_OBJECT 01
 #define ERROR_REACHABLE 02
 #define ERROR_PACK 04
@@ -606,72 +608,220 @@ static void get_default_heads(void)
 	}
 }
 
-struct for_each_loose_cb
-{
-	struct progress *progress;
+/*
+ * A loose object being checked.  Reading it (inflating and hashing) may
+ * happen in a worker thread; the rest of the check, which touches the
+ * object hash, always happens on the main thread, in directory order.
+ */
+struct loose_check {
+	struct object_id oid;
+	char *path;
+	struct object_id real_oid;
+	void *contents;
+	unsigned long size;
+	enum object_type type;
 	struct strbuf obj_type;
+	int ret;
+	struct strbuf reports;	/* deferred messages of the worker */
+	unsigned done:1;
 };
 
-static int fsck_loose(const struct object_id *oid, const char *path, void *data)
+static void read_loose_check(struct loose_check *lc)
 {
-	struct for_each_loose_cb *cb_data = data;
+	struct object_info oi = OBJECT_INFO_INIT;
+
+	lc->type = OBJ_NONE;
+	lc->contents = NULL;
+	oidcpy(&lc->real_oid, null_oid());
+	strbuf_reset(&lc->obj_type);
+	oi.type_name = &lc->obj_type;
+	oi.sizep = &lc->size;
+	oi.typep = &lc->type;
+
+	lc->ret = read_loose_object(lc->path, &lc->oid, &lc->real_oid,
+				    &lc->contents, &oi);
+}
+
+static void check_loose(struct loose_check *lc)
+{
+	const struct object_id *oid = &lc->oid;
+	const char *path = lc->path;
 	struct object *obj;
-	enum object_type type = OBJ_NONE;
-	unsigned long size;
-	void *contents = NULL;
 	int eaten;
-	struct object_info oi = OBJECT_INFO_INIT;
-	struct object_id real_oid = *null_oid();
 	int err = 0;
 
-	strbuf_reset(&cb_data->obj_type);
-	oi.type_name = &cb_data->obj_type;
-	oi.sizep = &size;
-	oi.typep = &type;
+	if (lc->reports.len) {
+		fflush(stderr);
+		write_in_full(2, lc->reports.buf, lc->reports.len);
+		strbuf_reset(&lc->reports);
+	}
 
-	if (read_loose_object(path, oid, &real_oid, &contents, &oi) < 0) {
-		if (contents && !oideq(&real_oid, oid))
+	if (lc->ret < 0) {
+		if (lc->contents && !oideq(&lc->real_oid, oid))
 			err = error(_("%s: hash-path mismatch, found at: %s"),
-				    oid_to_hex(&real_oid), path);
+				    oid_to_hex(&lc->real_oid), path);
 		else
 			err = error(_("%s: object corrupt or missing: %s"),
 				    oid_to_hex(oid), path);
 	}
-	if (type != OBJ_NONE && type < 0)
+	if (lc->type != OBJ_NONE && lc->type < 0)
 		err = error(_("%s: object is of unknown type '%s': %s"),
-			    oid_to_hex(&real_oid), cb_data->obj_type.buf,
+			    oid_to_hex(&lc->real_oid), lc->obj_type.buf,
 			    path);
 	if (err < 0) {
 		errors_found |= ERROR_OBJECT;
-		free(contents);
-		return 0; /* keep checking other objects */
+		FREE_AND_NULL(lc->contents);
+		return; /* keep checking other objects */
 	}
 
-	if (!contents && type != OBJ_BLOB)
+	if (!lc->contents && lc->type != OBJ_BLOB)
 		BUG("read_loose_object streamed a non-blob");
 
-	obj = parse_object_buffer(the_repository, oid, type, size,
-				  contents, &eaten);
+	obj = parse_object_buffer(the_repository, oid, lc->type, lc->size,
+				  lc->contents, &eaten);
 
 	if (!obj) {
 		errors_found |= ERROR_OBJECT;
 		error(_("%s: object could not be parsed: %s"),
 		      oid_to_hex(oid), path);
 		if (!eaten)
-			free(contents);
-		return 0; /* keep checking other objects */
+			free(lc->contents);
+		lc->contents = NULL;
+		return; /* keep checking other objects */
 	}
 
 	obj->flags &= ~(REACHABLE | SEEN);
 	obj->flags |= HAS_OBJ;
-	if (fsck_obj(obj, contents, size))
+	if (fsck_obj(obj, lc->contents, lc->size))
 		errors_found |= ERROR_OBJECT;
 
 	if (!eaten)
-		free(contents);
+		free(lc->contents);
+	lc->contents = NULL;
+}
+
+/*
+ * With more than one thread, the loose objects of each subdirectory are
+ * collected first and then read by worker threads, which stay at most
+ * "window" objects ahead of the main thread checking them in order.
+ */
+struct loose_batch {
+	struct loose_check *entries;
+	size_t nr, alloc;
+	size_t next, checked, window;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+struct for_each_loose_cb
+{
+	struct progress *progress;
+	struct loose_check one;
+	struct loose_batch batch;
+};
+
+static int fsck_loose(const struct object_id *oid, const char *path, void *data)
+{
+	struct for_each_loose_cb *cb_data = data;
+	struct loose_check *lc = &cb_data->one;
+
+	if (fsck_threads > 1) {
+		struct loose_batch *b = &cb_data->batch;
+
+		ALLOC_GROW(b->entries, b->nr + 1, b->alloc);
+		lc = &b->entries[b->nr++];
+		memset(lc, 0, sizeof(*lc));
+		oidcpy(&lc->oid, oid);
+		lc->path = xstrdup(path);
+		strbuf_init(&lc->obj_type, 0);
+		strbuf_init(&lc->reports, 0);
+		return 0;
+	}
+
+	oidcpy(&lc->oid, oid);
+	lc->path = (char *)path;
+	read_loose_check(lc);
+	check_loose(lc);
+	lc->path = NULL;
 	return 0; /* keep checking other objects, even if we saw an error */
 }
 
+static void *loose_check_thread(void *data)
+{
+	struct loose_batch *b = data;
+
+	pthread_mutex_lock(&b->mutex);
+	while (b->next < b->nr) {
+		struct loose_check *lc;
+
+		if (b->next >= b->checked + b->window) {
+			pthread_cond_wait(&b->cond, &b->mutex);
+			continue;
+		}
+		lc = &b->entries[b->next++];
+		pthread_mutex_unlock(&b->mutex);
+
+		defer_thread_reports(&lc->reports);
+		read_loose_check(lc);
+		defer_thread_reports(NULL);
+
+		pthread_mutex_lock(&b->mutex);
+		lc->done = 1;
+		pthread_cond_broadcast(&b->cond);
+	}
+	pthread_mutex_unlock(&b->mutex);
+	return NULL;
+}
+
+static void fsck_loose_batch(struct loose_batch *b)
+{
+	pthread_t *threads;
+	int nr_threads = fsck_threads;
+	size_t i;
+	int t, ret;
+
+	if (!b->nr)
+		return;
+	if (nr_threads > b->nr)
+		nr_threads = b->nr;
+
+	b->next = b->checked = 0;
+	b->window = 4 * nr_threads;
+	CALLOC_ARRAY(threads, nr_threads);
+	for (t = 0; t < nr_threads; t++) {
+		ret = pthread_create(&threads[t], NULL, loose_check_thread, b);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+
+	for (i = 0; i < b->nr; i++) {
+		struct loose_check *lc = &b->entries[i];
+
+		pthread_mutex_lock(&b->mutex);
+		while (!lc->done)
+			pthread_cond_wait(&b->cond, &b->mutex);
+		pthread_mutex_unlock(&b->mutex);
+
+		check_loose(lc);
+
+		pthread_mutex_lock(&b->mutex);
+		b->checked = i + 1;
+		pthread_cond_broadcast(&b->cond);
+		pthread_mutex_unlock(&b->mutex);
+	}
+
+	for (t = 0; t < nr_threads; t++)
+		pthread_join(threads[t], NULL);
+	free(threads);
+
+	for (i = 0; i < b->nr; i++) {
+		free(b->entries[i].path);
+		strbuf_release(&b->entries[i].obj_type);
+		strbuf_release(&b->entries[i].reports);
+	}
+	b->nr = 0;
+}
+
 static int fsck_cruft(const char *basename, const char *path,
 		      void *data UNUSED)
 {
@@ -684,6 +834,8 @@ static int fsck_subdir(unsigned int nr, const char *path UNUSED, void *data)
 {
 	struct for_each_loose_cb *cb_data = data;
 	struct progress *progress = cb_data->progress;
+
+	fsck_loose_batch(&cb_data->batch);
 	display_progress(progress, nr + 1);
 	return 0;
 }
@@ -692,8 +844,9 @@ static void fsck_object_dir(const char *path)
 {
 	struct progress *progress = NULL;
 	struct for_each_loose_cb cb_data = {
-		.obj_type = STRBUF_INIT,
 		.progress = progress,
+		.one.obj_type = STRBUF_INIT,
+		.one.reports = STRBUF_INIT,
 	};
 
 	if (verbose)
@@ -702,11 +855,24 @@ static void fsck_object_dir(const char *path)
 	if (show_progress)
 		progress = start_progress(_("Checking object directories"), 256);
 
+	if (fsck_threads > 1) {
+		pthread_mutex_init(&cb_data.batch.mutex, NULL);
+		pthread_cond_init(&cb_data.batch.cond, NULL);
+		start_deferred_reports();
+	}
 	for_each_loose_file_in_objdir(path, fsck_loose, fsck_cruft, fsck_subdir,
 				      &cb_data);
+	if (fsck_threads > 1) {
+		fsck_loose_batch(&cb_data.batch);
+		stop_deferred_reports();
+		pthread_cond_destroy(&cb_data.batch.cond);
+		pthread_mutex_destroy(&cb_data.batch.mutex);
+		free(cb_data.batch.entries);
+	}
 	display_progress(progress, 256);
 	stop_progress(&progress);
-	strbuf_release(&cb_data.obj_type);
+	strbuf_release(&cb_data.one.obj_type);
+	strbuf_release(&cb_data.one.reports);
 }
 
 static int fsck_head_link(const char *head_ref_name,
@@ -899,11 +1065,41 @@ static int check_pack_rev_indexes(struct repository *r, int show_progress)
 	return res;
 }
 
+/* A negative number would be taken for "not given" below. */
+static int parse_threads_opt(const struct option *opt, const char *arg,
+			     int unset)
+{
+	int *threads = opt->value;
+
+	BUG_ON_OPT_NEG(unset);
+	if (strtol_i(arg, 10, threads) || *threads < 0)
+		return error(_("invalid number of threads specified (%s)"), arg);
+	return 0;
+}
+
+static int fsck_config(const char *var, const char *value,
+		       const struct config_context *ctx, void *cb)
+{
+	if (!strcmp(var, "fsck.threads")) {
+		int threads = git_config_int(var, value, ctx->kvi);
+
+		if (threads < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    threads, var);
+		/* --threads given on the command line takes precedence */
+		if (fsck_threads < 0)
+			fsck_threads = threads;
+		return 0;
+	}
+
+	return git_fsck_config(var, value, ctx, cb);
+}
+
 static char const * const fsck_usage[] = {
 	N_("git fsck [--tags] [--root] [--unreachable] [--cache] [--no-reflogs]\n"
 	   "         [--[no-]full] [--strict] [--verbose] [--lost-found]\n"
 	   "         [--[no-]dangling] [--[no-]progress] [--connectivity-only]\n"
-	   "         [--[no-]name-objects] [<object>...]"),
+	   "         [--[no-]name-objects] [--threads=<n>] [<object>...]"),
 	NULL
 };
 
@@ -922,6 +1118,9 @@ static struct option fsck_opts[] = {
 				N_("write dangling objects in .git/lost-found")),
 	OPT_BOOL(0, "progress", &show_progress, N_("show progress")),
 	OPT_BOOL(0, "name-objects", &name_objects, N_("show verbose names for reachable objects")),
+	OPT_CALLBACK_F(0, "threads", &fsck_threads, N_("n"),
+		       N_("use <n> threads to check objects"),
+		       PARSE_OPT_NONEG, parse_threads_opt),
 	OPT_END(),
 };
 
@@ -958,9 +1157,18 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 	if (name_objects)
 		fsck_enable_object_names(&fsck_walk_options);
 
-	git_config(git_fsck_config, &fsck_obj_options);
+	git_config(fsck_config, &fsck_obj_options);
 	prepare_repo_settings(the_repository);
 
+	if (fsck_threads < 0)
+		fsck_threads = 0;
+	if (!fsck_threads)
+		fsck_threads = online_cpus();
+	if (!HAVE_THREADS && fsck_threads > 1) {
+		warning(_("no threads support, ignoring --threads"));
+		fsck_threads = 1;
+	}
+
 	if (connectivity_only) {
 		for_each_loose_object(mark_loose_for_connectivity, NULL, 0);
 		for_each_packed_object(mark_packed_for_connectivity, NULL, 0);
@@ -989,7 +1197,7 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 				/* verify gives error messages itself */
 				if (verify_pack(the_repository,
 						p, fsck_obj_buffer,
-						progress, count))
+						progress, count, fsck_threads))
 					errors_found |= ERROR_PACK;
 				count += p->num_objects;
 			}
@@ -19,6 +19,7 @@
 #include "commit.h"
 #include "diff.h"
 #include "diff-merges.h"
+#include "diff-prefetch.h"
 #include "revision.h"
 #include "log-tree.h"
 #include "builtin.h"
@@ -36,10 +37,12 @@
 #include "version.h"
 #include "mailmap.h"
 #include "progress.h"
+#include "promisor-remote.h"
 #include "commit-slab.h"
 #include "repository.h"
 #include "commit-reach.h"
 #include "range-diff.h"
+#include "thread-utils.h"
 #include "tmp-objdir.h"
 #include "tree.h"
 #include "write-or-die.h"
@@ -499,9 +502,103 @@ static void finish_early_output(struct rev_info *rev)
 	show_early_header(rev, "done", n);
 }
 
+/*
+ * With log.diffThreads, worker threads prepare the diffs of the commits
+ * that are going to be shown next while we are busy showing the current
+ * one.  For that we take a few commits from the walk ahead of time, which
+ * only works when showing a commit does not depend on the state the walk
+ * is in, and does not affect what it returns next.
+ */
+struct log_lookahead {
+	struct diff_prefetch *prefetch;
+	struct commit_list *commits, **tail;
+	int walk_done;
+	/* the walk stopped at max_count, and goes on if we raise it */
+	int max_count_reached;
+};
+
+static struct diff_prefetch *log_diff_prefetch(struct rev_info *rev)
+{
+	int nr_threads = 1;
+
+	repo_config_get_int(the_repository, "log.diffthreads", &nr_threads);
+	if (nr_threads < 1)
+		nr_threads = online_cpus();
+	if (nr_threads < 2 || !HAVE_THREADS)
+		return NULL;
+
+	if (!rev->diff ||
+	    !(rev->diffopt.output_format & (DIFF_FORMAT_PATCH |
+					    DIFF_FORMAT_DIFFSTAT |
+					    DIFF_FORMAT_NUMSTAT |
+					    DIFF_FORMAT_SHORTSTAT)))
+		return NULL;
+	if (rev->graph || rev->reflog_info || rev->line_level_traverse ||
+	    rev->early_output || rev->boundary ||
+	    rev->diffopt.flags.follow_renames)
+		return NULL;
+	/*
+	 * get_revision() sets rev->linear for the commit it returns last,
+	 * and frees the parents saved for --full-diff when the walk ends,
+	 * both of which log_tree_commit() reads for the commit it shows.
+	 */
+	if (rev->track_linear ||
+	    (rev->full_diff && (rev->rewrite_parents || rev->children.name)))
+		return NULL;
+	/* missing objects are better fetched in batches, as diffcore does */
+	if (repo_has_promisor_remote(the_repository))
+		return NULL;
+
+	return diff_prefetch_start(&rev->diffopt, nr_threads);
+}
+
+static void prefetch_commit_diff(struct rev_info *rev,
+				 struct diff_prefetch *prefetch,
+				 struct commit *commit)
+{
+	struct commit_list *parents = get_saved_parents(rev, commit);
+	const struct object_id *old_tree = NULL, *new_tree = NULL;
+
+	/* merges are left alone, as are root commits log_tree_diff() skips */
+	if (parents && !parents->next) {
+		if (!repo_parse_commit(the_repository, commit) &&
+		    !repo_parse_commit(the_repository, parents->item)) {
+			old_tree = get_commit_tree_oid(parents->item);
+			new_tree = get_commit_tree_oid(commit);
+		}
+	} else if (!parents && rev->show_root_diff) {
+		if (!repo_parse_commit(the_repository, commit))
+			new_tree = get_commit_tree_oid(commit);
+	}
+	diff_prefetch_add(prefetch, old_tree, new_tree);
+}
+
+static struct commit *get_revision_ahead(struct rev_info *rev,
+					 struct log_lookahead *ahead)
+{
+	struct commit *commit;
+
+	while (!ahead->walk_done && !diff_prefetch_full(ahead->prefetch)) {
+		commit = get_revision(rev);
+		if (!commit) {
+			ahead->walk_done = 1;
+			ahead->max_count_reached = !rev->max_count;
+			break;
+		}
+		ahead->tail = commit_list_append(commit, ahead->tail);
+		prefetch_commit_diff(rev, ahead->prefetch, commit);
+	}
+
+	commit = pop_commit(&ahead->commits);
+	if (!ahead->commits)
+		ahead->tail = &ahead->commits;
+	return commit;
+}
+
 static int cmd_log_walk_no_free(struct rev_info *rev)
 {
 	struct commit *commit;
+	struct log_lookahead ahead = { 0 };
 	int saved_nrl = 0;
 	int saved_dcctc = 0;
 
@@ -526,13 +623,26 @@ static int cmd_log_walk_no_free(struct rev_info *rev)
 	 * and HAS_CHANGES being accumulated in rev->diffopt, so be careful to
 	 * retain that state information if replacing rev->diffopt in this loop
 	 */
-	while ((commit = get_revision(rev)) != NULL) {
-		if (!log_tree_commit(rev, commit) && rev->max_count >= 0)
+	ahead.prefetch = log_diff_prefetch(rev);
+	ahead.tail = &ahead.commits;
+	while ((commit = ahead.prefetch ? get_revision_ahead(rev, &ahead) :
+					  get_revision(rev)) != NULL) {
+		int shown;
+
+		if (ahead.prefetch)
+			diff_prefetch_begin(ahead.prefetch);
+		shown = log_tree_commit(rev, commit);
+		if (ahead.prefetch)
+			diff_prefetch_end(ahead.prefetch);
+		if (!shown && rev->max_count >= 0) {
 			/*
 			 * We decremented max_count in get_revision,
 			 * but we didn't actually show the commit.
 			 */
 			rev->max_count++;
+			if (ahead.max_count_reached)
+				ahead.walk_done = 0;
+		}
 		if (!rev->reflog_info) {
 			/*
 			 * We may show a given commit multiple times when
@@ -548,6 +658,8 @@ static int cmd_log_walk_no_free(struct rev_info *rev)
 		if (rev->diffopt.degraded_cc_to_c)
 			saved_dcctc = 1;
 	}
+	if (ahead.prefetch)
+		diff_prefetch_finish(ahead.prefetch);
 	rev->diffopt.degraded_cc_to_c = saved_dcctc;
 	rev->diffopt.needed_rename_limit = saved_nrl;
 
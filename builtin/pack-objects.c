@@ -296,6 +296,7 @@ static void *get_delta(struct object_entry *entry)
 	void *buf, *base_buf, *delta_buf;
 	enum object_type type;
 
+	packing_data_lock(&to_pack);
 	buf = repo_read_object_file(the_repository, &entry->idx.oid, &type,
 				    &size);
 	if (!buf)
@@ -303,6 +304,7 @@ static void *get_delta(struct object_entry *entry)
 	base_buf = repo_read_object_file(the_repository,
 					 &DELTA(entry)->idx.oid, &type,
 					 &base_size);
+	packing_data_unlock(&to_pack);
 	if (!base_buf)
 		die("unable to read %s",
 		    oid_to_hex(&DELTA(entry)->idx.oid));
@@ -444,9 +446,23 @@ static inline int oe_size_greater_than(struct packing_data *pack,
 	return oe_get_size_slow(pack, lhs) > rhs;
 }
 
+/*
+ * Object data deflated ahead of time by a write thread; see
+ * start_deflate_ahead() below.
+ */
+struct deflated_entry {
+	void *data;
+	unsigned long size;	/* inflated size, recorded in the header */
+	unsigned long datalen;	/* deflated size of "data" */
+	enum object_type type;	/* only meaningful if !usable_delta */
+	uint32_t chunk;
+	unsigned usable_delta:1;
+};
+
 /* Return 0 if we will bust the pack-size limit */
 static unsigned long write_no_reuse_object(struct hashfile *f, struct object_entry *entry,
-					   unsigned long limit, int usable_delta)
+					   unsigned long limit, int usable_delta,
+					   struct deflated_entry *pre)
 {
 	unsigned long size, datalen;
 	unsigned char header[MAX_PACK_OBJECT_HEADER],
@@ -457,7 +473,19 @@ static unsigned long write_no_reuse_object(struct hashfile *f, struct object_ent
 	struct git_istream *st = NULL;
 	const unsigned hashsz = the_hash_algo->rawsz;
 
-	if (!usable_delta) {
+	if (pre) {
+		buf = pre->data;
+		pre->data = NULL;
+		size = pre->size;
+		if (usable_delta)
+			type = (allow_ofs_delta && DELTA(entry)->idx.offset) ?
+				OBJ_OFS_DELTA : OBJ_REF_DELTA;
+		else
+			type = pre->type;
+		/* the cached delta, if any, was deflated into "pre" */
+		FREE_AND_NULL(entry->delta_data);
+		entry->z_delta_size = 0;
+	} else if (!usable_delta) {
 		if (oe_type(entry) == OBJ_BLOB &&
 		    oe_size_greater_than(&to_pack, entry, big_file_threshold) &&
 		    (st = open_istream(the_repository, &entry->idx.oid, &type,
@@ -490,7 +518,9 @@ static unsigned long write_no_reuse_object(struct hashfile *f, struct object_ent
 			OBJ_OFS_DELTA : OBJ_REF_DELTA;
 	}
 
-	if (st)	/* large blob case, just assume we don't compress well */
+	if (pre)
+		datalen = pre->datalen;
+	else if (st)	/* large blob case, just assume we don't compress well */
 		datalen = size;
 	else if (entry->z_delta_size)
 		datalen = entry->z_delta_size;
@@ -593,7 +623,8 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 		error(_("bad packed object CRC for %s"),
 		      oid_to_hex(&entry->idx.oid));
 		unuse_pack(&w_curs);
-		return write_no_reuse_object(f, entry, limit, usable_delta);
+		return write_no_reuse_object(f, entry, limit, usable_delta,
+					     NULL);
 	}
 
 	offset += entry->in_pack_header_size;
@@ -604,7 +635,8 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 		error(_("corrupt packed object for %s"),
 		      oid_to_hex(&entry->idx.oid));
 		unuse_pack(&w_curs);
-		return write_no_reuse_object(f, entry, limit, usable_delta);
+		return write_no_reuse_object(f, entry, limit, usable_delta,
+					     NULL);
 	}
 
 	if (type == OBJ_OFS_DELTA) {
@@ -643,6 +675,280 @@ static off_t write_reuse_object(struct hashfile *f, struct object_entry *entry,
 	return hdrlen + datalen;
 }
 
+static int want_reuse_object(struct object_entry *entry, int usable_delta)
+{
+	if (!reuse_object)
+		return 0;	/* explicit */
+	else if (!IN_PACK(entry))
+		return 0;	/* can't reuse what we don't have */
+	else if (oe_type(entry) == OBJ_REF_DELTA ||
+		 oe_type(entry) == OBJ_OFS_DELTA)
+				/* check_object() decided it for us ... */
+		return usable_delta;
+				/* ... but pack split may override that */
+	else if (oe_type(entry) != entry->in_pack_type)
+		return 0;	/* pack has delta which is unusable */
+	else if (DELTA(entry))
+		return 0;	/* we want to pack afresh */
+	else
+		return 1;	/* we have it in-pack undeltified,
+				 * and we do not need to deltify it.
+				 */
+}
+
+/*
+ * Deflating objects that cannot be copied verbatim from an existing
+ * pack dominates the write phase after a fresh delta search.  When
+ * more than one thread is allowed, the write order is cut into chunks
+ * of DEFLATE_CHUNK objects which worker threads claim in order and
+ * deflate into memory, staying at most "window" chunks ahead of the
+ * writer.  The writer still emits every object itself, in order,
+ * through the single hashfile; before writing an object it waits for
+ * the chunk holding it, or deflates that chunk itself if no worker
+ * has picked it up yet (e.g. a delta base far ahead in the order).
+ *
+ * This is only done without a pack size limit, as a pack split can
+ * change whether a delta is usable after the data has been prepared.
+ *
+ * Workers read objects under packing_data_lock(); while they run,
+ * the writer takes the same lock around anything that may access the
+ * object database.
+ */
+#define DEFLATE_CHUNK 64
+
+enum deflate_chunk_state {
+	DEFLATE_CHUNK_PENDING = 0,
+	DEFLATE_CHUNK_BUSY,
+	DEFLATE_CHUNK_DONE,
+};
+
+static struct {
+	struct object_entry **order;
+	uint32_t nr;
+	struct deflated_entry *result;	/* indexed like to_pack.objects */
+	unsigned char *chunk_state;
+	uint32_t nr_chunks;
+	uint32_t next_chunk;
+	uint32_t writer_chunk;
+	uint32_t window;
+	int stop;
+	int nr_threads;
+	pthread_t *threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} ahead;
+
+static inline void deflate_ahead_lock(void)
+{
+	if (ahead.nr_threads)
+		packing_data_lock(&to_pack);
+}
+
+static inline void deflate_ahead_unlock(void)
+{
+	if (ahead.nr_threads)
+		packing_data_unlock(&to_pack);
+}
+
+static void deflate_one_ahead(struct object_entry *entry,
+			      struct deflated_entry *out)
+{
+	/* there is no pack size limit, so any delta is usable */
+	int usable_delta = !!DELTA(entry);
+	enum object_type type = OBJ_NONE;
+	unsigned long size;
+	void *buf;
+
+	if (entry->preferred_base || want_reuse_object(entry, usable_delta))
+		return;
+
+	if (!usable_delta) {
+		/* leave large blobs to be streamed by the writer */
+		if (oe_type(entry) == OBJ_BLOB &&
+		    oe_size_greater_than(&to_pack, entry, big_file_threshold))
+			return;
+		packing_data_lock(&to_pack);
+		buf = repo_read_object_file(the_repository, &entry->idx.oid,
+					    &type, &size);
+		packing_data_unlock(&to_pack);
+		if (!buf)
+			return; /* let the writer complain */
+	} else if (entry->delta_data) {
+		if (entry->z_delta_size)
+			return; /* deflated during the delta search already */
+		size = DELTA_SIZE(entry);
+		buf = xmemdupz(entry->delta_data, size);
+	} else {
+		buf = get_delta(entry);
+		size = DELTA_SIZE(entry);
+	}
+
+	out->datalen = do_compress(&buf, size);
+	out->data = buf;
+	out->size = size;
+	out->type = type;
+	out->usable_delta = usable_delta;
+}
+
+static void deflate_chunk_ahead(uint32_t chunk)
+{
+	uint32_t i = chunk * DEFLATE_CHUNK;
+	uint32_t end = i + DEFLATE_CHUNK;
+
+	if (end > ahead.nr)
+		end = ahead.nr;
+	for (; i < end; i++) {
+		struct object_entry *e = ahead.order[i];
+		deflate_one_ahead(e, &ahead.result[e - to_pack.objects]);
+	}
+}
+
+static void *threaded_deflate_ahead(void *arg UNUSED)
+{
+	pthread_mutex_lock(&ahead.mutex);
+	for (;;) {
+		uint32_t chunk;
+
+		while (ahead.next_chunk < ahead.nr_chunks &&
+		       ahead.chunk_state[ahead.next_chunk] != DEFLATE_CHUNK_PENDING)
+			ahead.next_chunk++;
+		if (ahead.stop || ahead.next_chunk >= ahead.nr_chunks)
+			break;
+		if (ahead.next_chunk >= ahead.writer_chunk + ahead.window) {
+			pthread_cond_wait(&ahead.cond, &ahead.mutex);
+			continue;
+		}
+
+		chunk = ahead.next_chunk++;
+		ahead.chunk_state[chunk] = DEFLATE_CHUNK_BUSY;
+		pthread_mutex_unlock(&ahead.mutex);
+
+		deflate_chunk_ahead(chunk);
+
+		pthread_mutex_lock(&ahead.mutex);
+		ahead.chunk_state[chunk] = DEFLATE_CHUNK_DONE;
+		pthread_cond_broadcast(&ahead.cond);
+	}
+	pthread_mutex_unlock(&ahead.mutex);
+	return NULL;
+}
+
+static void start_deflate_ahead(struct object_entry **write_order)
+{
+	uint32_t i;
+	int t, ret;
+
+	if (delta_search_threads <= 1 || pack_size_limit ||
+	    to_pack.nr_objects <= DEFLATE_CHUNK)
+		return;
+
+	ahead.order = write_order;
+	ahead.nr = to_pack.nr_objects;
+	ahead.nr_chunks = DIV_ROUND_UP(ahead.nr, DEFLATE_CHUNK);
+	ahead.window = 4 * delta_search_threads;
+	CALLOC_ARRAY(ahead.result, ahead.nr);
+	CALLOC_ARRAY(ahead.chunk_state, ahead.nr_chunks);
+	for (i = 0; i < ahead.nr; i++)
+		ahead.result[write_order[i] - to_pack.objects].chunk =
+			i / DEFLATE_CHUNK;
+
+	pthread_mutex_init(&ahead.mutex, NULL);
+	pthread_cond_init(&ahead.cond, NULL);
+	CALLOC_ARRAY(ahead.threads, delta_search_threads);
+	for (t = 0; t < delta_search_threads; t++) {
+		ret = pthread_create(&ahead.threads[t], NULL,
+				     threaded_deflate_ahead, NULL);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+		ahead.nr_threads++;
+	}
+	trace2_data_intmax("pack-objects", the_repository,
+			   "write_pack_file/deflate_threads", ahead.nr_threads);
+}
+
+static void stop_deflate_ahead(void)
+{
+	uint32_t i;
+	int t;
+
+	if (!ahead.nr_threads)
+		return;
+
+	pthread_mutex_lock(&ahead.mutex);
+	ahead.stop = 1;
+	pthread_cond_broadcast(&ahead.cond);
+	pthread_mutex_unlock(&ahead.mutex);
+	for (t = 0; t < ahead.nr_threads; t++)
+		pthread_join(ahead.threads[t], NULL);
+
+	for (i = 0; i < ahead.nr; i++)
+		free(ahead.result[i].data);
+	free(ahead.result);
+	free(ahead.chunk_state);
+	free(ahead.threads);
+	pthread_cond_destroy(&ahead.cond);
+	pthread_mutex_destroy(&ahead.mutex);
+	memset(&ahead, 0, sizeof(ahead));
+}
+
+/* Tell the workers how far the writer has got in the write order. */
+static void deflate_ahead_progress(uint32_t pos)
+{
+	if (!ahead.nr_threads || pos % DEFLATE_CHUNK)
+		return;
+	pthread_mutex_lock(&ahead.mutex);
+	ahead.writer_chunk = pos / DEFLATE_CHUNK;
+	pthread_cond_broadcast(&ahead.cond);
+	pthread_mutex_unlock(&ahead.mutex);
+}
+
+/* Make sure the chunk holding "e" has been deflated. */
+static void wait_deflated(struct object_entry *e)
+{
+	uint32_t chunk;
+
+	if (!ahead.nr_threads)
+		return;
+
+	chunk = ahead.result[e - to_pack.objects].chunk;
+	pthread_mutex_lock(&ahead.mutex);
+	if (ahead.chunk_state[chunk] == DEFLATE_CHUNK_PENDING) {
+		ahead.chunk_state[chunk] = DEFLATE_CHUNK_BUSY;
+		pthread_mutex_unlock(&ahead.mutex);
+
+		deflate_chunk_ahead(chunk);
+
+		pthread_mutex_lock(&ahead.mutex);
+		ahead.chunk_state[chunk] = DEFLATE_CHUNK_DONE;
+		pthread_cond_broadcast(&ahead.cond);
+	}
+	while (ahead.chunk_state[chunk] != DEFLATE_CHUNK_DONE)
+		pthread_cond_wait(&ahead.cond, &ahead.mutex);
+	pthread_mutex_unlock(&ahead.mutex);
+}
+
+/*
+ * Return the data deflated ahead for "entry", or NULL if there is none
+ * or it was prepared under different assumptions (write_one() may have
+ * dropped the delta since).
+ */
+static struct deflated_entry *take_deflated(struct object_entry *entry,
+					    int usable_delta)
+{
+	struct deflated_entry *pre;
+
+	if (!ahead.nr_threads)
+		return NULL;
+	pre = &ahead.result[entry - to_pack.objects];
+	if (!pre->data)
+		return NULL;
+	if (pre->usable_delta != !!usable_delta) {
+		FREE_AND_NULL(pre->data);
+		return NULL;
+	}
+	return pre;
+}
+
 /* Return 0 if we will bust the pack-size limit */
 static off_t write_object(struct hashfile *f,
 			  struct object_entry *entry,
@@ -678,28 +984,21 @@ static off_t write_object(struct hashfile *f,
 	else
 		usable_delta = 0;	/* base could end up in another pack */
 
-	if (!reuse_object)
-		to_reuse = 0;	/* explicit */
-	else if (!IN_PACK(entry))
-		to_reuse = 0;	/* can't reuse what we don't have */
-	else if (oe_type(entry) == OBJ_REF_DELTA ||
-		 oe_type(entry) == OBJ_OFS_DELTA)
-				/* check_object() decided it for us ... */
-		to_reuse = usable_delta;
-				/* ... but pack split may override that */
-	else if (oe_type(entry) != entry->in_pack_type)
-		to_reuse = 0;	/* pack has delta which is unusable */
-	else if (DELTA(entry))
-		to_reuse = 0;	/* we want to pack afresh */
-	else
-		to_reuse = 1;	/* we have it in-pack undeltified,
-				 * and we do not need to deltify it.
-				 */
+	to_reuse = want_reuse_object(entry, usable_delta);
 
-	if (!to_reuse)
-		len = write_no_reuse_object(f, entry, limit, usable_delta);
-	else
+	if (!to_reuse) {
+		struct deflated_entry *pre = take_deflated(entry, usable_delta);
+
+		if (!pre)
+			deflate_ahead_lock();
+		len = write_no_reuse_object(f, entry, limit, usable_delta, pre);
+		if (!pre)
+			deflate_ahead_unlock();
+	} else {
+		deflate_ahead_lock();
 		len = write_reuse_object(f, entry, limit, usable_delta);
+		deflate_ahead_unlock();
+	}
 	if (!len)
 		return 0;
 
@@ -740,6 +1039,12 @@ static enum write_one_status write_one(struct hashfile *f,
 		return WRITE_ONE_SKIP;
 	}
 
+	/*
+	 * Wait for a write thread that may still be looking at this entry
+	 * before we possibly drop its delta below.
+	 */
+	wait_deflated(e);
+
 	/* if we are deltified, write out base object first. */
 	if (DELTA(e)) {
 		e->idx.offset = 1; /* now recurse */
@@ -1251,6 +1556,7 @@ static void write_pack_file(void)
 		progress_state = start_progress(_("Writing objects"), nr_result);
 	ALLOC_ARRAY(written_list, to_pack.nr_objects);
 	write_order = compute_write_order();
+	start_deflate_ahead(write_order);
 
 	do {
 		unsigned char hash[GIT_MAX_RAWSZ];
@@ -1277,10 +1583,12 @@ static void write_pack_file(void)
 		nr_written = 0;
 		for (; i < to_pack.nr_objects; i++) {
 			struct object_entry *e = write_order[i];
+			deflate_ahead_progress(i);
 			if (write_one(f, e, &offset) == WRITE_ONE_BREAK)
 				break;
 			display_progress(progress_state, written);
 		}
+		stop_deflate_ahead();
 
 		if (pack_to_stdout) {
 			/*
@@ -1364,6 +1672,8 @@ static void write_pack_file(void)
 
 				bitmap_writer_show_progress(&bitmap_writer,
 							    progress);
+				bitmap_writer_set_threads(&bitmap_writer,
+							  delta_search_threads);
 				bitmap_writer_select_commits(&bitmap_writer,
 							     indexed_commits,
 							     indexed_commits_nr);
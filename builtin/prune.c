@@ -5,6 +5,7 @@
 #include "environment.h"
 #include "gettext.h"
 #include "hex.h"
+#include "loose-index.h"
 #include "revision.h"
 #include "reachable.h"
 #include "parse-options.h"
@@ -24,6 +25,7 @@ static const char * const prune_usage[] = {
 static int show_only;
 static int verbose;
 static timestamp_t expire;
+static int pruned_loose;
 static int show_progress = -1;
 
 static int prune_tmp_file(const char *fullpath)
@@ -100,8 +102,11 @@ static int prune_object(const struct object_id *oid, const char *fullpath,
 		printf("%s %s\n", oid_to_hex(oid),
 		       (type > 0) ? type_name(type) : "unknown");
 	}
-	if (!show_only)
+	if (!show_only) {
+		if (!pruned_loose++)
+			loose_index_invalidate(the_repository->objects->odb);
 		unlink_or_warn(fullpath);
+	}
 	return 0;
 }
 
@@ -195,6 +200,8 @@ int cmd_prune(int argc, const char **argv, const char *prefix)
 
 	for_each_loose_file_in_objdir(get_object_directory(), prune_object,
 				      prune_cruft, prune_subdir, &revs);
+	if (pruned_loose)
+		loose_index_invalidate(the_repository->objects->odb);
 
 	prune_packed_objects(show_only ? PRUNE_PACKED_DRY_RUN : 0);
 	remove_temporary_files(get_object_directory());
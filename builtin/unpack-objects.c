@@ -5,6 +5,7 @@
 #include "gettext.h"
 #include "git-zlib.h"
 #include "hex.h"
+#include "loose-index.h"
 #include "object-store-ll.h"
 #include "object.h"
 #include "delta.h"
@@ -15,9 +16,14 @@
 #include "progress.h"
 #include "decorate.h"
 #include "fsck.h"
+#include "oidmap.h"
+#include "thread-utils.h"
+#include "trace2.h"
+#include "write-or-die.h"
 
 static int dry_run, quiet, recover, has_errors, strict;
-static const char unpack_usage[] = "git unpack-objects [-n] [-q] [-r] [--strict]";
+static int nr_threads;
+static const char unpack_usage[] = "git unpack-objects [-n] [-q] [-r] [--strict] [--threads=<n>]";
 
 /* We always read in 4kB chunks. */
 static unsigned char buffer[4096];
@@ -255,6 +261,190 @@ static void write_rest(void)
 	}
 }
 
+/*
+ * Deflating and writing out loose objects (with an fsync each unless
+ * core.fsyncMethod is "batch") dominates unpacking a small pack.  With
+ * more than one thread, the main thread only names each object and
+ * queues it for write threads that deflate and write it.  A queued
+ * object stays in the "pending" map until it is on disk, so deltas
+ * against it can be resolved in the meantime; see read_base().
+ */
+struct queued_object {
+	struct oidmap_entry entry;
+	enum object_type type;
+	void *buf;
+	unsigned long size;
+	struct queued_object *next;
+};
+
+static struct {
+	struct oidmap pending;	/* queued or being written */
+	struct queued_object *head, **tail;
+	unsigned nr_pending, max_pending;
+	int stop;
+	int nr;
+	pthread_t *threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} writers;
+
+static void *write_thread(void *arg UNUSED)
+{
+	pthread_mutex_lock(&writers.mutex);
+	for (;;) {
+		struct queued_object *q = writers.head;
+
+		if (!q) {
+			if (writers.stop)
+				break;
+			pthread_cond_wait(&writers.cond, &writers.mutex);
+			continue;
+		}
+		writers.head = q->next;
+		if (!writers.head)
+			writers.tail = &writers.head;
+		pthread_mutex_unlock(&writers.mutex);
+
+		if (write_loose_object_file(q->buf, q->size, q->type,
+					    &q->entry.oid) < 0)
+			die("failed to write object");
+
+		/* only now can readers find it on disk instead */
+		pthread_mutex_lock(&writers.mutex);
+		oidmap_remove(&writers.pending, &q->entry.oid);
+		writers.nr_pending--;
+		pthread_cond_broadcast(&writers.cond);
+		free(q->buf);
+		free(q);
+	}
+	pthread_mutex_unlock(&writers.mutex);
+	return NULL;
+}
+
+static void start_write_threads(void)
+{
+	int t, ret;
+
+	if (!HAVE_THREADS || dry_run || the_repository->compat_hash_algo)
+		return;
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	/* not worth it for a handful of objects */
+	if (nr_threads > nr_objects / 8)
+		nr_threads = nr_objects / 8;
+	if (nr_threads <= 1)
+		return;
+
+	/* the write threads must not race to set these up */
+	if (batch_fsync_enabled(FSYNC_COMPONENT_LOOSE_OBJECT))
+		prepare_loose_object_bulk_checkin();
+	prepare_repo_settings(the_repository);
+	loose_index_maintained(the_repository->objects->odb);
+
+	oidmap_init(&writers.pending, 0);
+	writers.tail = &writers.head;
+	writers.max_pending = 16 * nr_threads;
+	pthread_mutex_init(&writers.mutex, NULL);
+	pthread_cond_init(&writers.cond, NULL);
+	CALLOC_ARRAY(writers.threads, nr_threads);
+	for (t = 0; t < nr_threads; t++) {
+		ret = pthread_create(&writers.threads[t], NULL,
+				     write_thread, NULL);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+		writers.nr++;
+	}
+	trace2_data_intmax("unpack-objects", the_repository,
+			   "write_threads", writers.nr);
+}
+
+static void finish_write_threads(void)
+{
+	int t;
+
+	if (!writers.nr)
+		return;
+
+	pthread_mutex_lock(&writers.mutex);
+	writers.stop = 1;
+	pthread_cond_broadcast(&writers.cond);
+	pthread_mutex_unlock(&writers.mutex);
+	for (t = 0; t < writers.nr; t++)
+		pthread_join(writers.threads[t], NULL);
+
+	oidmap_free(&writers.pending, 0);
+	free(writers.threads);
+	pthread_cond_destroy(&writers.cond);
+	pthread_mutex_destroy(&writers.mutex);
+	memset(&writers, 0, sizeof(writers));
+}
+
+/* Queue "buf", named "oid", to be written; takes ownership of "buf". */
+static void queue_object(const struct object_id *oid, enum object_type type,
+			 void *buf, unsigned long size)
+{
+	struct queued_object *q;
+
+	pthread_mutex_lock(&writers.mutex);
+	q = oidmap_get(&writers.pending, oid);
+	pthread_mutex_unlock(&writers.mutex);
+	if (q || freshen_object(oid)) {
+		free(buf);
+		return;
+	}
+
+	CALLOC_ARRAY(q, 1);
+	oidcpy(&q->entry.oid, oid);
+	q->type = type;
+	q->buf = buf;
+	q->size = size;
+
+	pthread_mutex_lock(&writers.mutex);
+	while (writers.nr_pending >= writers.max_pending)
+		pthread_cond_wait(&writers.cond, &writers.mutex);
+	oidmap_put(&writers.pending, q);
+	writers.nr_pending++;
+	*writers.tail = q;
+	writers.tail = &q->next;
+	pthread_cond_broadcast(&writers.cond);
+	pthread_mutex_unlock(&writers.mutex);
+}
+
+static int has_base(const struct object_id *oid)
+{
+	if (writers.nr) {
+		struct queued_object *q;
+
+		pthread_mutex_lock(&writers.mutex);
+		q = oidmap_get(&writers.pending, oid);
+		pthread_mutex_unlock(&writers.mutex);
+		if (q)
+			return 1;
+	}
+	return repo_has_object_file(the_repository, oid);
+}
+
+static void *read_base(const struct object_id *oid, enum object_type *type,
+		       unsigned long *size)
+{
+	if (writers.nr) {
+		struct queued_object *q;
+		void *buf = NULL;
+
+		pthread_mutex_lock(&writers.mutex);
+		q = oidmap_get(&writers.pending, oid);
+		if (q) {
+			*type = q->type;
+			*size = q->size;
+			buf = xmemdupz(q->buf, q->size);
+		}
+		pthread_mutex_unlock(&writers.mutex);
+		if (buf)
+			return buf;
+	}
+	return repo_read_object_file(the_repository, oid, type, size);
+}
+
 static void added_object(unsigned nr, enum object_type type,
 			 void *data, unsigned long size);
 
@@ -263,23 +453,32 @@ static void added_object(unsigned nr, enum object_type type,
  * of it.  Under --strict, this buffers structured objects in-core,
  * to be checked at the end.
  */
+static void write_and_resolve(unsigned nr, enum object_type type,
+			      void *buf, unsigned long size)
+{
+	if (writers.nr) {
+		hash_object_file(the_hash_algo, buf, size, type,
+				 &obj_list[nr].oid);
+		added_object(nr, type, buf, size);
+		queue_object(&obj_list[nr].oid, type, buf, size);
+		return;
+	}
+	if (write_object_file(buf, size, type,
+			      &obj_list[nr].oid) < 0)
+		die("failed to write object");
+	added_object(nr, type, buf, size);
+	free(buf);
+}
+
 static void write_object(unsigned nr, enum object_type type,
 			 void *buf, unsigned long size)
 {
 	if (!strict) {
-		if (write_object_file(buf, size, type,
-				      &obj_list[nr].oid) < 0)
-			die("failed to write object");
-		added_object(nr, type, buf, size);
-		free(buf);
+		write_and_resolve(nr, type, buf, size);
 		obj_list[nr].obj = NULL;
 	} else if (type == OBJ_BLOB) {
 		struct blob *blob;
-		if (write_object_file(buf, size, type,
-				      &obj_list[nr].oid) < 0)
-			die("failed to write object");
-		added_object(nr, type, buf, size);
-		free(buf);
+		write_and_resolve(nr, type, buf, size);
 
 		blob = lookup_blob(the_repository, &obj_list[nr].oid);
 		if (blob)
@@ -444,7 +643,7 @@ static void unpack_delta_entry(enum object_type type, unsigned long delta_size,
 		delta_data = get_data(delta_size);
 		if (!delta_data)
 			return;
-		if (repo_has_object_file(the_repository, &base_oid))
+		if (has_base(&base_oid))
 			; /* Ok we have this one */
 		else if (resolve_against_held(nr, &base_oid,
 					      delta_data, delta_size))
@@ -510,8 +709,7 @@ static void unpack_delta_entry(enum object_type type, unsigned long delta_size,
 	if (resolve_against_held(nr, &base_oid, delta_data, delta_size))
 		return;
 
-	base = repo_read_object_file(the_repository, &base_oid, &type,
-				     &base_size);
+	base = read_base(&base_oid, &type, &base_size);
 	if (!base) {
 		error("failed to read delta-pack base object %s",
 		      oid_to_hex(&base_oid));
@@ -590,10 +788,12 @@ static void unpack_all(void)
 		progress = start_progress(_("Unpacking objects"), nr_objects);
 	CALLOC_ARRAY(obj_list, nr_objects);
 	begin_odb_transaction();
+	start_write_threads();
 	for (i = 0; i < nr_objects; i++) {
 		unpack_one(i);
 		display_progress(progress, i + 1);
 	}
+	finish_write_threads();
 	end_odb_transaction();
 	stop_progress(&progress);
 
@@ -601,6 +801,23 @@ static void unpack_all(void)
 		die("unresolved deltas left after unpacking");
 }
 
+static int unpack_objects_config(const char *var, const char *value,
+				 const struct config_context *ctx, void *cb)
+{
+	if (!strcmp(var, "pack.threads")) {
+		nr_threads = git_config_int(var, value, ctx->kvi);
+		if (nr_threads < 0)
+			die(_("invalid number of threads specified (%d)"),
+			    nr_threads);
+		if (!HAVE_THREADS && nr_threads != 1) {
+			warning(_("no threads support, ignoring %s"), var);
+			nr_threads = 1;
+		}
+		return 0;
+	}
+	return git_default_config(var, value, ctx, cb);
+}
+
 int cmd_unpack_objects(int argc, const char **argv, const char *prefix UNUSED)
 {
 	int i;
@@ -609,7 +826,7 @@ int cmd_unpack_objects(int argc, const char **argv, const char *prefix UNUSED)
 
 	disable_replace_refs();
 
-	git_config(git_default_config, NULL);
+	git_config(unpack_objects_config, NULL);
 
 	quiet = !isatty(2);
 
@@ -653,6 +870,17 @@ int cmd_unpack_objects(int argc, const char **argv, const char *prefix UNUSED)
 				len = sizeof(*hdr);
 				continue;
 			}
+			if (skip_prefix(arg, "--threads=", &arg)) {
+				char *end;
+				nr_threads = strtoul(arg, &end, 0);
+				if (!*arg || *end || nr_threads < 0)
+					usage(unpack_usage);
+				if (!HAVE_THREADS && nr_threads != 1) {
+					warning(_("no threads support, ignoring --threads"));
+					nr_threads = 1;
+				}
+				continue;
+			}
 			if (skip_prefix(arg, "--max-input-size=", &arg)) {
 				max_input_size = strtoumax(arg, NULL, 10);
 				continue;
@@ -2,6 +2,7 @@
 
 #include "git-compat-util.h"
 #include "environment.h"
+#include "gettext.h"
 #include "hex.h"
 #include "lockfile.h"
 #include "tree.h"
@@ -13,6 +14,8 @@
 #include "read-cache-ll.h"
 #include "replace-object.h"
 #include "promisor-remote.h"
+#include "config.h"
+#include "thread-utils.h"
 #include "trace.h"
 #include "trace2.h"
 
@@ -250,18 +253,41 @@ static int must_check_existence(const struct cache_entry *ce)
 	return !(repo_has_promisor_remote(the_repository) && ce_skip_worktree(ce));
 }
 
+/*
+ * A subtree that cache_tree_update() hands to a worker thread. The
+ * tree objects the worker computes are not written right away, as the
+ * object store does not support concurrent writers; they are queued in
+ * "pending" in the order update_one() would have written them.
+ */
+struct cache_tree_job {
+	struct cache_tree *it;
+	struct cache_entry **cache;
+	int entries;
+	const char *base;
+	int baselen;
+	int result;
+
+	size_t pending_nr, pending_alloc;
+	struct pending_tree {
+		struct object_id oid;
+		struct strbuf buf;
+	} *pending;
+};
+
 static int update_one(struct cache_tree *it,
 		      struct cache_entry **cache,
 		      int entries,
 		      const char *base,
 		      int baselen,
 		      int *skip_count,
-		      int flags)
+		      int flags,
+		      struct cache_tree_job *job)
 {
 	struct strbuf buffer;
 	int missing_ok = flags & WRITE_TREE_MISSING_OK;
 	int dryrun = flags & WRITE_TREE_DRY_RUN;
 	int repair = flags & WRITE_TREE_REPAIR;
+	int defer = job && !dryrun && !repair;
 	int to_invalidate = 0;
 	int i;
 
@@ -332,7 +358,7 @@ static int update_one(struct cache_tree *it,
 				    path,
 				    baselen + sublen + 1,
 				    &subskip,
-				    flags);
+				    flags, job);
 		if (subcnt < 0)
 			return subcnt;
 		if (!subcnt)
@@ -390,12 +416,14 @@ static int update_one(struct cache_tree *it,
 			i++;
 		}
 
+		/* a subtree we just computed may only be queued yet */
 		ce_missing_ok = mode == S_IFGITLINK || missing_ok ||
-			!must_check_existence(ce);
+			!must_check_existence(ce) || (sub && defer);
 		if (is_null_oid(oid) ||
 		    (!ce_missing_ok && !repo_has_object_file(the_repository, oid))) {
 			strbuf_release(&buffer);
-			if (expected_missing)
+			/* the caller redoes failed jobs and reports then */
+			if (expected_missing || job)
 				return -1;
 			return error("invalid object %06o %s for '%.*s'",
 				mode, oid_to_hex(oid), entlen+baselen, path);
@@ -448,6 +476,18 @@ static int update_one(struct cache_tree *it,
 	} else if (dryrun) {
 		hash_object_file(the_hash_algo, buffer.buf, buffer.len,
 				 OBJ_TREE, &it->oid);
+	} else if (defer) {
+		struct pending_tree *pending;
+
+		hash_object_file(the_hash_algo, buffer.buf, buffer.len,
+				 OBJ_TREE, &it->oid);
+		ALLOC_GROW(job->pending, job->pending_nr + 1, job->pending_alloc);
+		pending = &job->pending[job->pending_nr++];
+		oidcpy(&pending->oid, &it->oid);
+		/* hand the buffer over to the job */
+		pending->buf = buffer;
+		it->entry_count = to_invalidate ? -1 : i - *skip_count;
+		return i;
 	} else if (write_object_file_flags(buffer.buf, buffer.len, OBJ_TREE,
 					   &it->oid, NULL, flags & WRITE_TREE_SILENT
 					   ? HASH_SILENT : 0)) {
@@ -465,6 +505,192 @@ static int update_one(struct cache_tree *it,
 	return i;
 }
 
+/*
+ * Mostly randomly chosen: we want at least this many index entries per
+ * thread before it is worth starting one, and each thread should get a
+ * few jobs so that an uneven split does not leave the others idle.
+ */
+#define THREAD_COST (10000)
+#define JOBS_PER_THREAD (4)
+
+struct cache_tree_jobs {
+	struct cache_tree_job *job;
+	size_t nr, alloc;
+	size_t next;
+	int flags;
+	pthread_mutex_t mutex;
+};
+
+/*
+ * Carve the part of the index below "base" into jobs of at most
+ * "job_size" entries, one per subtree that needs updating. A directory
+ * that is larger than that is split further; it and its ancestors are
+ * left for the final single-threaded update_one().
+ */
+static void plan_jobs(struct cache_tree_jobs *jobs, struct cache_tree *it,
+		      struct cache_entry **cache, int entries,
+		      const char *base, int baselen, int job_size)
+{
+	int i = 0;
+
+	while (i < entries) {
+		const struct cache_entry *ce = cache[i];
+		struct cache_tree_sub *sub;
+		const char *path = ce->name, *slash;
+		int pathlen = ce_namelen(ce);
+		int sublen, subcnt;
+
+		if (pathlen <= baselen || memcmp(base, path, baselen))
+			break;
+
+		slash = strchr(path + baselen, '/');
+		if (!slash) {
+			i++;
+			continue;
+		}
+		sublen = slash - (path + baselen);
+		for (subcnt = 1; i + subcnt < entries; subcnt++) {
+			const struct cache_entry *next = cache[i + subcnt];
+
+			if (ce_namelen(next) <= baselen + sublen + 1 ||
+			    memcmp(next->name, path, baselen + sublen + 1))
+				break;
+		}
+
+		sub = find_subtree(it, path + baselen, sublen, 1);
+		if (!sub->cache_tree)
+			sub->cache_tree = cache_tree();
+
+		if (0 <= sub->cache_tree->entry_count &&
+		    repo_has_object_file(the_repository, &sub->cache_tree->oid))
+			; /* nothing to do */
+		else if (subcnt > job_size)
+			plan_jobs(jobs, sub->cache_tree, cache + i, subcnt,
+				  path, baselen + sublen + 1, job_size);
+		else {
+			struct cache_tree_job *job;
+
+			ALLOC_GROW(jobs->job, jobs->nr + 1, jobs->alloc);
+			job = &jobs->job[jobs->nr++];
+			memset(job, 0, sizeof(*job));
+			job->it = sub->cache_tree;
+			job->cache = cache + i;
+			job->entries = subcnt;
+			job->base = path;
+			job->baselen = baselen + sublen + 1;
+		}
+		i += subcnt;
+	}
+}
+
+static void *update_thread(void *_data)
+{
+	struct cache_tree_jobs *jobs = _data;
+
+	for (;;) {
+		struct cache_tree_job *job;
+		int skip;
+
+		pthread_mutex_lock(&jobs->mutex);
+		job = jobs->next < jobs->nr ? &jobs->job[jobs->next++] : NULL;
+		pthread_mutex_unlock(&jobs->mutex);
+		if (!job)
+			return NULL;
+
+		job->result = update_one(job->it, job->cache, job->entries,
+					 job->base, job->baselen, &skip,
+					 jobs->flags, job);
+	}
+}
+
+/*
+ * Update the subtrees of the index in parallel where that is worth it.
+ * This only computes (and writes) what the single-threaded update_one()
+ * of the whole index would have; it is left to that to finish the job
+ * and to report any problems, so that the result does not depend on
+ * whether threads were used.
+ */
+static int update_in_parallel(struct index_state *istate, int flags)
+{
+	struct cache_tree_jobs jobs = { 0 };
+	pthread_t *threads;
+	int nr_threads, job_size, i, ret = 0;
+	int own_lock = !obj_read_use_lock;
+	size_t j, k;
+
+	if (!HAVE_THREADS || (flags & WRITE_TREE_DRY_RUN) ||
+	    repo_has_promisor_remote(the_repository))
+		return 0;
+
+	if (repo_config_get_index_threads(the_repository, &nr_threads))
+		nr_threads = 0;
+	if (!nr_threads) {
+		nr_threads = istate->cache_nr / THREAD_COST;
+		if (nr_threads > online_cpus())
+			nr_threads = online_cpus();
+	}
+	if (nr_threads < 2)
+		return 0;
+
+	job_size = istate->cache_nr / (nr_threads * JOBS_PER_THREAD);
+	plan_jobs(&jobs, istate->cache_tree, istate->cache, istate->cache_nr,
+		  "", 0, job_size ? job_size : 1);
+	if (jobs.nr < 2) {
+		free(jobs.job);
+		return 0;
+	}
+	if (nr_threads > jobs.nr)
+		nr_threads = jobs.nr;
+
+	trace2_region_enter("cache_tree", "update/parallel", the_repository);
+	if (own_lock)
+		enable_obj_read_lock();
+	jobs.flags = flags;
+	pthread_mutex_init(&jobs.mutex, NULL);
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&threads[i], NULL, update_thread, &jobs);
+		if (err)
+			die(_("unable to create cache-tree thread: %s"), strerror(err));
+	}
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_join(threads[i], NULL))
+			die("unable to join cache-tree thread");
+	free(threads);
+	pthread_mutex_destroy(&jobs.mutex);
+	if (own_lock)
+		disable_obj_read_lock();
+
+	for (j = 0; j < jobs.nr; j++) {
+		struct cache_tree_job *job = &jobs.job[j];
+
+		for (k = 0; k < job->pending_nr; k++) {
+			struct pending_tree *pending = &job->pending[k];
+			struct object_id oid;
+
+			/*
+			 * Objects of a failed job are not written; the
+			 * final pass notices they are missing and redoes
+			 * those trees.
+			 */
+			if (!ret && job->result >= 0 &&
+			    write_object_file_flags(pending->buf.buf, pending->buf.len,
+						    OBJ_TREE, &oid, NULL,
+						    flags & WRITE_TREE_SILENT
+						    ? HASH_SILENT : 0))
+				ret = -1;
+			strbuf_release(&pending->buf);
+		}
+		free(job->pending);
+	}
+	trace2_data_intmax("cache_tree", the_repository, "update/jobs", jobs.nr);
+	trace2_data_intmax("cache_tree", the_repository, "update/threads", nr_threads);
+	trace2_region_leave("cache_tree", "update/parallel", the_repository);
+
+	free(jobs.job);
+	return ret;
+}
+
 int cache_tree_update(struct index_state *istate, int flags)
 {
 	int skip, i;
@@ -483,8 +709,10 @@ int cache_tree_update(struct index_state *istate, int flags)
 	trace_performance_enter();
 	trace2_region_enter("cache_tree", "update", the_repository);
 	begin_odb_transaction();
-	i = update_one(istate->cache_tree, istate->cache, istate->cache_nr,
-		       "", 0, &skip, flags);
+	i = update_in_parallel(istate, flags);
+	if (!i)
+		i = update_one(istate->cache_tree, istate->cache, istate->cache_nr,
+			       "", 0, &skip, flags, NULL);
 	end_odb_transaction();
 	trace2_region_leave("cache_tree", "update", the_repository);
 	trace_performance_leave("cache_tree_update");
@@ -434,7 +434,8 @@ static void combine_diff(struct repository *r,
 			 struct sline *sline, unsigned int cnt, int n,
 			 int num_parent, int result_deleted,
 			 struct userdiff_driver *textconv,
-			 const char *path, long flags)
+			 const char *path, const struct diff_options *opt,
+			 int *max_cost_reached)
 {
 	unsigned int p_lno, lno;
 	unsigned long nmask = (1UL << n);
@@ -450,7 +451,9 @@ static void combine_diff(struct repository *r,
 	parent_file.ptr = grab_blob(r, parent, mode, &sz, textconv, path);
 	parent_file.size = sz;
 	memset(&xpp, 0, sizeof(xpp));
-	xpp.flags = flags;
+	xpp.flags = opt->xdl_opts;
+	xpp.max_cost = opt->max_diff_cost;
+	xpp.max_cost_reached = max_cost_reached;
 	memset(&xecfg, 0, sizeof(xecfg));
 	memset(&state, 0, sizeof(state));
 	state.nmask = nmask;
@@ -481,7 +484,7 @@ static void combine_diff(struct repository *r,
 			struct sline *sl = &sline[lno];
 			sl->lost = coalesce_lines(sl->lost, &sl->lenlost,
 						  sl->plost.lost_head,
-						  sl->plost.len, n, flags);
+						  sl->plost.len, n, opt->xdl_opts);
 			sl->plost.lost_head = sl->plost.lost_tail = NULL;
 			sl->plost.len = 0;
 		}
@@ -1030,7 +1033,7 @@ static void show_patch_diff(struct combine_diff_path *elem, int num_parent,
 	char *result, *cp;
 	struct sline *sline; /* survived lines */
 	int mode_differs = 0;
-	int i, show_hunks;
+	int i, show_hunks, max_cost_reached = 0;
 	mmfile_t result_file;
 	struct userdiff_driver *userdiff;
 	struct userdiff_driver *textconv = NULL;
@@ -1207,8 +1210,11 @@ static void show_patch_diff(struct combine_diff_path *elem, int num_parent,
 				     elem->parent[i].mode,
 				     &result_file, sline,
 				     cnt, i, num_parent, result_deleted,
-				     textconv, elem->path, opt->xdl_opts);
+				     textconv, elem->path, opt,
+				     &max_cost_reached);
 	}
+	if (max_cost_reached)
+		diff_warn_max_cost(elem->path);
 
 	show_hunks = make_hunks(sline, cnt, num_parent, rev->dense_combined_merges);
 
@@ -27,6 +27,7 @@
 #include "trace2.h"
 #include "tree.h"
 #include "chunk-format.h"
+#include "thread-utils.h"
 
 void git_test_write_commit_graph_or_die(void)
 {
@@ -1786,12 +1787,163 @@ static void trace2_bloom_filter_write_statistics(struct write_commit_graph_conte
 			   ctx->count_bloom_filter_upgraded);
 }
 
+/*
+ * Computing the changed-path Bloom filters of new commits means a tree
+ * diff per commit, which dominates writing a commit-graph with
+ * --changed-paths.  When more than one thread is allowed, the filters
+ * that are neither in an existing commit-graph nor beyond the
+ * max_new_filters budget are computed up front by worker threads, in
+ * chunks of BLOOM_CHUNK commits claimed in order.  The main thread
+ * takes part in the work and reports progress, and then stores the
+ * results in the usual order, so the outcome and the statistics are the
+ * same as with a single thread.
+ *
+ * Workers only read objects, under the object read lock.
+ */
+#define BLOOM_CHUNK 64
+
+struct bloom_precompute {
+	struct bloom_filter filter;
+	enum bloom_filter_computed computed;
+};
+
+struct bloom_threads {
+	struct write_commit_graph_context *ctx;
+	struct commit **commits;
+	struct bloom_precompute *result;
+	uint32_t nr;
+	uint32_t next_chunk;
+	uint32_t done;
+	pthread_mutex_t mutex;
+};
+
+static int bloom_claim_chunk(struct bloom_threads *bt, uint32_t *done)
+{
+	int chunk = -1;
+
+	pthread_mutex_lock(&bt->mutex);
+	if (done)
+		*done = bt->done;
+	if (bt->next_chunk * BLOOM_CHUNK < bt->nr)
+		chunk = bt->next_chunk++;
+	pthread_mutex_unlock(&bt->mutex);
+	return chunk;
+}
+
+static void bloom_compute_chunk(struct bloom_threads *bt, uint32_t chunk)
+{
+	uint32_t i = chunk * BLOOM_CHUNK;
+	uint32_t end = i + BLOOM_CHUNK;
+
+	if (end > bt->nr)
+		end = bt->nr;
+	for (; i < end; i++)
+		bt->result[i].computed =
+			compute_bloom_filter(bt->ctx->r, bt->commits[i],
+					     &bt->result[i].filter,
+					     bt->ctx->bloom_settings);
+
+	pthread_mutex_lock(&bt->mutex);
+	bt->done += end - chunk * BLOOM_CHUNK;
+	pthread_mutex_unlock(&bt->mutex);
+}
+
+static void *bloom_thread(void *data)
+{
+	struct bloom_threads *bt = data;
+	int chunk;
+
+	while ((chunk = bloom_claim_chunk(bt, NULL)) >= 0)
+		bloom_compute_chunk(bt, chunk);
+	return NULL;
+}
+
+/*
+ * Compute the Bloom filters of the commits in "sorted" that will need
+ * one, using "nr_threads" threads.  Returns an array parallel to
+ * "sorted" where the entries with BLOOM_COMPUTED set hold a filter for
+ * the caller to take over, or NULL if threading is not worth it.
+ */
+static struct bloom_precompute *precompute_bloom_filters(struct write_commit_graph_context *ctx,
+							 struct commit **sorted,
+							 int max_new_filters,
+							 int nr_threads,
+							 struct progress *progress)
+{
+	struct bloom_threads bt = { .ctx = ctx };
+	struct bloom_precompute *pre;
+	uint32_t *todo, done;
+	pthread_t *threads;
+	int i, chunk, lock_was_enabled;
+
+	/*
+	 * Load any filters we already have on the main thread, which also
+	 * parses the commits and their parents for the workers.
+	 */
+	ALLOC_ARRAY(todo, ctx->commits.nr);
+	for (i = 0; i < ctx->commits.nr && bt.nr < max_new_filters; i++) {
+		struct commit *c = sorted[i];
+
+		repo_parse_commit(ctx->r, c);
+		if (get_or_compute_bloom_filter(ctx->r, c, 0, NULL, NULL))
+			continue;
+		todo[bt.nr++] = i;
+	}
+
+	if (bt.nr < 2 * BLOOM_CHUNK) {
+		free(todo);
+		return NULL;
+	}
+	if (nr_threads > DIV_ROUND_UP(bt.nr, BLOOM_CHUNK))
+		nr_threads = DIV_ROUND_UP(bt.nr, BLOOM_CHUNK);
+
+	ALLOC_ARRAY(bt.commits, bt.nr);
+	for (i = 0; i < bt.nr; i++)
+		bt.commits[i] = sorted[todo[i]];
+	CALLOC_ARRAY(bt.result, bt.nr);
+	pthread_mutex_init(&bt.mutex, NULL);
+
+	lock_was_enabled = obj_read_use_lock;
+	if (!lock_was_enabled)
+		enable_obj_read_lock();
+
+	trace2_data_intmax("commit-graph", ctx->r, "bloom/threads", nr_threads);
+
+	CALLOC_ARRAY(threads, nr_threads - 1);
+	for (i = 0; i < nr_threads - 1; i++) {
+		int err = pthread_create(&threads[i], NULL, bloom_thread, &bt);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	while ((chunk = bloom_claim_chunk(&bt, &done)) >= 0) {
+		display_progress(progress, done);
+		bloom_compute_chunk(&bt, chunk);
+	}
+	for (i = 0; i < nr_threads - 1; i++)
+		pthread_join(threads[i], NULL);
+
+	if (!lock_was_enabled)
+		disable_obj_read_lock();
+
+	CALLOC_ARRAY(pre, ctx->commits.nr);
+	for (i = 0; i < bt.nr; i++)
+		pre[todo[i]] = bt.result[i];
+
+	pthread_mutex_destroy(&bt.mutex);
+	free(threads);
+	free(bt.result);
+	free(bt.commits);
+	free(todo);
+	return pre;
+}
+
 static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 {
 	int i;
 	struct progress *progress = NULL;
 	struct commit **sorted_commits;
-	int max_new_filters;
+	struct bloom_precompute *pre = NULL;
+	int max_new_filters, nr_threads;
 
 	init_bloom_filters();
 
@@ -1810,15 +1962,32 @@ static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 	max_new_filters = ctx->opts && ctx->opts->max_new_filters >= 0 ?
 		ctx->opts->max_new_filters : ctx->commits.nr;
 
+	nr_threads = ctx->opts ? ctx->opts->threads : 0;
+	if (nr_threads <= 0)
+		nr_threads = online_cpus();
+	if (HAVE_THREADS && nr_threads > 1)
+		pre = precompute_bloom_filters(ctx, sorted_commits,
+					       max_new_filters, nr_threads,
+					       progress);
+
 	for (i = 0; i < ctx->commits.nr; i++) {
 		enum bloom_filter_computed computed = 0;
 		struct commit *c = sorted_commits[i];
-		struct bloom_filter *filter = get_or_compute_bloom_filter(
-			ctx->r,
-			c,
-			ctx->count_bloom_filter_computed < max_new_filters,
-			ctx->bloom_settings,
-			&computed);
+		struct bloom_filter *filter;
+
+		if (pre && (pre[i].computed & BLOOM_COMPUTED) &&
+		    ctx->count_bloom_filter_computed < max_new_filters) {
+			filter = set_bloom_filter(c, &pre[i].filter);
+			computed = pre[i].computed;
+			pre[i].computed = 0;
+		} else {
+			filter = get_or_compute_bloom_filter(
+				ctx->r,
+				c,
+				ctx->count_bloom_filter_computed < max_new_filters,
+				ctx->bloom_settings,
+				&computed);
+		}
 		if (computed & BLOOM_COMPUTED) {
 			ctx->count_bloom_filter_computed++;
 			if (computed & BLOOM_TRUNC_EMPTY)
@@ -1837,6 +2006,13 @@ static void compute_bloom_filters(struct write_commit_graph_context *ctx)
 	if (trace2_is_enabled())
 		trace2_bloom_filter_write_statistics(ctx);
 
+	if (pre) {
+		/* drop what the budget did not leave room for after all */
+		for (i = 0; i < ctx->commits.nr; i++)
+			if (pre[i].computed & BLOOM_COMPUTED)
+				free(pre[i].filter.to_free);
+		free(pre);
+	}
 	free(sorted_commits);
 	stop_progress(&progress);
 }
@@ -0,0 +1,621 @@
+#include "git-compat-util.h"
+#include "advice.h"
+#include "dir.h"
+#include "fsmonitor-ll.h"
+#include "fsm-listen.h"
+#include "fsmonitor--daemon.h"
+#include "gettext.h"
+#include "hashmap.h"
+#include "simple-ipc.h"
+#include "string-list.h"
+#include "trace.h"
+#include <sys/inotify.h>
+
+/*
+ * inotify(7) only watches single directories, so we keep one watch per
+ * directory of the working tree (other than ".git"), plus one on the
+ * directory holding our cookie files and, when the gitdir is not
+ * inside the working tree, one on the gitdir itself to notice it going
+ * away.  New directories get their watches as we see them created.
+ */
+
+#define WORKTREE_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | \
+		       IN_MOVED_FROM | IN_MOVED_TO | \
+		       IN_DELETE_SELF | IN_MOVE_SELF | \
+		       IN_DONT_FOLLOW | IN_ONLYDIR | IN_EXCL_UNLINK)
+#define COOKIE_MASK (IN_CREATE | IN_DELETE | IN_ONLYDIR)
+#define GITDIR_MASK (IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+struct watch_entry {
+	struct hashmap_entry ent;
+	int wd;
+	unsigned int generation; /* see rewatch_worktree() */
+	char *path; /* absolute, without a trailing slash */
+};
+
+struct fsm_listen_data
+{
+	int fd_inotify;
+	int fd_stop[2];
+
+	struct hashmap watches; /* watch descriptor -> watch_entry */
+	int wd_worktree;
+	int wd_gitdir;
+	int wd_cookies;
+	unsigned int generation;
+
+	enum shutdown_style {
+		SHUTDOWN_EVENT = 0,
+		FORCE_SHUTDOWN,
+		FORCE_ERROR_STOP,
+	} shutdown_style;
+};
+
+static int watch_entry_cmp(const void *cmp_data UNUSED,
+			   const struct hashmap_entry *eptr,
+			   const struct hashmap_entry *entry_or_key,
+			   const void *keydata UNUSED)
+{
+	const struct watch_entry *a =
+		container_of(eptr, const struct watch_entry, ent);
+	const struct watch_entry *b =
+		container_of(entry_or_key, const struct watch_entry, ent);
+
+	return a->wd != b->wd;
+}
+
+static struct watch_entry *find_watch(struct fsm_listen_data *data, int wd)
+{
+	struct watch_entry key;
+
+	hashmap_entry_init(&key.ent, memhash(&wd, sizeof(wd)));
+	key.wd = wd;
+	return hashmap_get_entry(&data->watches, &key, ent, NULL);
+}
+
+static void forget_watch(struct fsm_listen_data *data, int wd)
+{
+	struct watch_entry key, *w;
+
+	hashmap_entry_init(&key.ent, memhash(&wd, sizeof(wd)));
+	key.wd = wd;
+	w = hashmap_remove_entry(&data->watches, &key, ent, NULL);
+	if (w) {
+		free(w->path);
+		free(w);
+	}
+}
+
+/*
+ * Add a watch on "path".  Returns the watch descriptor, or -1 with
+ * errno set.  Watching a directory we already watch (e.g. one that
+ * came back after a rename) just updates its path.
+ */
+static int add_watch(struct fsm_listen_data *data, const char *path,
+		     uint32_t mask)
+{
+	struct watch_entry *w;
+	int wd;
+
+	wd = inotify_add_watch(data->fd_inotify, path, mask);
+	if (wd < 0)
+		return -1;
+
+	w = find_watch(data, wd);
+	if (w) {
+		free(w->path);
+	} else {
+		CALLOC_ARRAY(w, 1);
+		hashmap_entry_init(&w->ent, memhash(&wd, sizeof(wd)));
+		w->wd = wd;
+		hashmap_add(&data->watches, &w->ent);
+	}
+	w->path = xstrdup(path);
+	w->generation = data->generation;
+	return wd;
+}
+
+/*
+ * Stop watching "path" and everything below it, after it has been
+ * moved away; the watches follow the directories, so their paths
+ * would be wrong from now on.
+ */
+static void remove_watches_below(struct fsm_listen_data *data,
+				  const char *path)
+{
+	struct hashmap_iter iter;
+	struct watch_entry *w;
+	size_t len = strlen(path);
+	int *wds = NULL;
+	size_t nr = 0, alloc = 0, i;
+
+	hashmap_for_each_entry(&data->watches, &iter, w, ent) {
+		if (w->wd == data->wd_worktree ||
+		    strncmp(w->path, path, len) ||
+		    (w->path[len] && w->path[len] != '/'))
+			continue;
+		ALLOC_GROW(wds, nr + 1, alloc);
+		wds[nr++] = w->wd;
+	}
+
+	for (i = 0; i < nr; i++) {
+		inotify_rm_watch(data->fd_inotify, wds[i]);
+		forget_watch(data, wds[i]);
+	}
+	free(wds);
+}
+
+static void add_path(struct fsmonitor_daemon_state *state,
+		     struct fsmonitor_batch **batch,
+		     const char *path, int is_dir)
+{
+	const char *rel = path + state->path_worktree_watch.len + 1;
+
+	if (!*batch)
+		*batch = fsmonitor_batch__new();
+
+	if (is_dir) {
+		struct strbuf tmp = STRBUF_INIT;
+
+		strbuf_addf(&tmp, "%s/", rel);
+		fsmonitor_batch__add_path(*batch, tmp.buf);
+		strbuf_release(&tmp);
+	} else {
+		fsmonitor_batch__add_path(*batch, rel);
+	}
+}
+
+/*
+ * Watch the directory "path" and all directories below it.  If
+ * "batch" is given, the directory is new to us and anything in it
+ * may have been created before our watch was in place, so report
+ * everything we find.
+ *
+ * Returns 0 on success or -1 with errno set if we could not add a
+ * watch.  Directories that disappear under us are not an error.
+ */
+static int watch_tree(struct fsmonitor_daemon_state *state,
+		      struct strbuf *path,
+		      struct fsmonitor_batch **batch)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	DIR *dir;
+	struct dirent *de;
+	size_t len = path->len;
+	int ret = 0;
+
+	if (add_watch(data, path->buf, WORKTREE_MASK) < 0)
+		return (errno == ENOENT || errno == ENOTDIR) ? 0 : -1;
+
+	dir = opendir(path->buf);
+	if (!dir)
+		return 0;
+
+	while (!ret && (de = readdir_skip_dot_and_dotdot(dir))) {
+		int dtype = DTYPE(de);
+
+		strbuf_setlen(path, len);
+		strbuf_addf(path, "/%s", de->d_name);
+
+		if (dtype == DT_UNKNOWN) {
+			struct stat st;
+
+			if (lstat(path->buf, &st))
+				continue;
+			dtype = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+		}
+
+		if (dtype != DT_DIR) {
+			if (batch)
+				add_path(state, batch, path->buf, 0);
+			continue;
+		}
+
+		/* We only care about our cookie files inside ".git". */
+		if (fsmonitor_classify_path_absolute(state, path->buf) != IS_WORKDIR_PATH)
+			continue;
+
+		if (batch)
+			add_path(state, batch, path->buf, 1);
+		ret = watch_tree(state, path, batch);
+	}
+
+	strbuf_setlen(path, len);
+	closedir(dir);
+	return ret;
+}
+
+/*
+ * After a queue overflow we may have missed directories being created
+ * (which then have no watch), moved (whose watches have the wrong path)
+ * or removed, so walk the working tree again.  Watching a directory we
+ * already watch only updates its path; the watches we did not come
+ * across are stale and removed afterwards.  We do not simply drop all
+ * watches first, as every removal queues an IN_IGNORED event, which
+ * could overflow the queue all over again.
+ */
+static int rewatch_worktree(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	struct strbuf path = STRBUF_INIT;
+	struct hashmap_iter iter;
+	struct watch_entry *w;
+	int *wds = NULL;
+	size_t nr = 0, alloc = 0, i;
+	int ret;
+
+	data->generation++;
+	strbuf_addbuf(&path, &state->path_worktree_watch);
+	ret = watch_tree(state, &path, NULL);
+	if (ret) {
+		error_errno(_("could not watch '%s'"), path.buf);
+		if (errno == ENOSPC)
+			advise(_("raise fs.inotify.max_user_watches"));
+		goto out;
+	}
+
+	hashmap_for_each_entry(&data->watches, &iter, w, ent) {
+		if (w->generation == data->generation ||
+		    w->wd == data->wd_gitdir || w->wd == data->wd_cookies)
+			continue;
+		ALLOC_GROW(wds, nr + 1, alloc);
+		wds[nr++] = w->wd;
+	}
+	for (i = 0; i < nr; i++) {
+		inotify_rm_watch(data->fd_inotify, wds[i]);
+		forget_watch(data, wds[i]);
+	}
+	free(wds);
+
+out:
+	strbuf_release(&path);
+	return ret;
+}
+
+static void log_mask_set(const char *path, uint32_t mask)
+{
+	struct strbuf msg = STRBUF_INIT;
+
+	if (mask & IN_ACCESS)
+		strbuf_addstr(&msg, "IN_ACCESS|");
+	if (mask & IN_MODIFY)
+		strbuf_addstr(&msg, "IN_MODIFY|");
+	if (mask & IN_ATTRIB)
+		strbuf_addstr(&msg, "IN_ATTRIB|");
+	if (mask & IN_CREATE)
+		strbuf_addstr(&msg, "IN_CREATE|");
+	if (mask & IN_DELETE)
+		strbuf_addstr(&msg, "IN_DELETE|");
+	if (mask & IN_DELETE_SELF)
+		strbuf_addstr(&msg, "IN_DELETE_SELF|");
+	if (mask & IN_MOVED_FROM)
+		strbuf_addstr(&msg, "IN_MOVED_FROM|");
+	if (mask & IN_MOVED_TO)
+		strbuf_addstr(&msg, "IN_MOVED_TO|");
+	if (mask & IN_MOVE_SELF)
+		strbuf_addstr(&msg, "IN_MOVE_SELF|");
+	if (mask & IN_IGNORED)
+		strbuf_addstr(&msg, "IN_IGNORED|");
+	if (mask & IN_ISDIR)
+		strbuf_addstr(&msg, "IN_ISDIR|");
+	if (mask & IN_Q_OVERFLOW)
+		strbuf_addstr(&msg, "IN_Q_OVERFLOW|");
+	if (mask & IN_UNMOUNT)
+		strbuf_addstr(&msg, "IN_UNMOUNT|");
+
+	trace_printf_key(&trace_fsmonitor, "inotify: '%s', mask=0x%x %s",
+			 path, mask, msg.buf);
+
+	strbuf_release(&msg);
+}
+
+/*
+ * Handle the events in one buffer returned by read(2).  Returns 0, or
+ * -1 if the daemon has to shut down.
+ */
+static int process_events(struct fsmonitor_daemon_state *state,
+			  const char *buf, size_t len)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	struct fsmonitor_batch *batch = NULL;
+	struct string_list cookie_list = STRING_LIST_INIT_DUP;
+	struct strbuf path = STRBUF_INIT;
+	const struct inotify_event *event;
+	const char *p;
+	int ret = 0;
+
+	for (p = buf; p < buf + len;
+	     p += sizeof(struct inotify_event) + event->len) {
+		struct watch_entry *w;
+		const char *slash;
+		int is_dir;
+
+		event = (const struct inotify_event *)p;
+
+		if (event->mask & IN_Q_OVERFLOW) {
+			/*
+			 * We have lost sync with the filesystem; set up our
+			 * watches again, throw away the cached data (and what
+			 * we collected so far, which is relative to it) and
+			 * start over.
+			 */
+			trace_printf_key(&trace_fsmonitor,
+					 "inotify: queue overflow");
+			if (rewatch_worktree(state))
+				goto force_error_stop;
+			fsmonitor_force_resync(state);
+			fsmonitor_batch__free_list(batch);
+			string_list_clear(&cookie_list, 0);
+			batch = NULL;
+			continue;
+		}
+
+		w = find_watch(data, event->wd);
+		if (!w)
+			continue; /* stale event for a watch we removed */
+
+		if (event->mask & IN_IGNORED) {
+			if (event->wd == data->wd_cookies) {
+				/* the cookie directory went away */
+				trace_printf_key(&trace_fsmonitor,
+						 "event: cookie dir removed");
+				goto force_shutdown;
+			}
+			forget_watch(data, event->wd);
+			continue;
+		}
+
+		if (event->mask & IN_UNMOUNT) {
+			trace_printf_key(&trace_fsmonitor,
+					 "event: filesystem unmounted");
+			goto force_shutdown;
+		}
+
+		if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+			if (event->wd == data->wd_worktree) {
+				trace_printf_key(&trace_fsmonitor,
+						 "event: worktree root moved");
+				goto force_shutdown;
+			}
+			if (event->wd == data->wd_gitdir) {
+				trace_printf_key(&trace_fsmonitor,
+						 "event: gitdir removed");
+				goto force_shutdown;
+			}
+			/* the parent directory will tell us about it */
+			continue;
+		}
+
+		if (!event->len)
+			continue; /* something about the directory itself */
+
+		strbuf_reset(&path);
+		strbuf_addf(&path, "%s/%s", w->path, event->name);
+		is_dir = !!(event->mask & IN_ISDIR);
+
+		switch (fsmonitor_classify_path_absolute(state, path.buf)) {
+
+		case IS_INSIDE_DOT_GIT_WITH_COOKIE_PREFIX:
+		case IS_INSIDE_GITDIR_WITH_COOKIE_PREFIX:
+			/* special case cookie files within .git or gitdir */
+
+			/* Use just the filename of the cookie file. */
+			slash = find_last_dir_sep(path.buf);
+			string_list_append(&cookie_list,
+					   slash ? slash + 1 : path.buf);
+			break;
+
+		case IS_INSIDE_DOT_GIT:
+		case IS_INSIDE_GITDIR:
+			/* ignore all other paths inside of .git or gitdir */
+			break;
+
+		case IS_DOT_GIT:
+		case IS_GITDIR:
+			/*
+			 * If .git directory is deleted or renamed away,
+			 * we have to quit.
+			 */
+			if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+				trace_printf_key(&trace_fsmonitor,
+						 "event: gitdir removed");
+				goto force_shutdown;
+			}
+			break;
+
+		case IS_WORKDIR_PATH:
+			/* try to queue normal pathnames */
+
+			if (trace_pass_fl(&trace_fsmonitor))
+				log_mask_set(path.buf, event->mask);
+
+			add_path(state, &batch, path.buf, is_dir);
+
+			if (!is_dir)
+				break;
+
+			if (event->mask & IN_MOVED_FROM)
+				remove_watches_below(data, path.buf);
+			else if (event->mask & (IN_CREATE | IN_MOVED_TO) &&
+				 watch_tree(state, &path, &batch)) {
+				error_errno(_("could not watch '%s'"), path.buf);
+				if (errno == ENOSPC)
+					advise(_("raise fs.inotify.max_user_watches"));
+				goto force_error_stop;
+			}
+			break;
+
+		case IS_OUTSIDE_CONE:
+		default:
+			trace_printf_key(&trace_fsmonitor,
+					 "ignoring '%s'", path.buf);
+			break;
+		}
+	}
+
+	fsmonitor_publish(state, batch, &cookie_list);
+	string_list_clear(&cookie_list, 0);
+	strbuf_release(&path);
+	return ret;
+
+force_error_stop:
+	data->shutdown_style = FORCE_ERROR_STOP;
+	goto cleanup;
+force_shutdown:
+	data->shutdown_style = FORCE_SHUTDOWN;
+cleanup:
+	fsmonitor_batch__free_list(batch);
+	string_list_clear(&cookie_list, 0);
+	strbuf_release(&path);
+	return -1;
+}
+
+int fsm_listen__ctor(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+	struct strbuf path = STRBUF_INIT;
+
+	CALLOC_ARRAY(data, 1);
+	state->listen_data = data;
+	hashmap_init(&data->watches, watch_entry_cmp, NULL, 0);
+	data->fd_stop[0] = data->fd_stop[1] = -1;
+	data->wd_gitdir = -1;
+
+	data->fd_inotify = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	if (data->fd_inotify < 0) {
+		error_errno(_("inotify_init1() failed"));
+		goto failed;
+	}
+	if (pipe(data->fd_stop) < 0) {
+		error_errno(_("could not create pipe"));
+		goto failed;
+	}
+
+	strbuf_addbuf(&path, &state->path_worktree_watch);
+	data->wd_worktree = add_watch(data, path.buf, WORKTREE_MASK);
+	if (data->wd_worktree < 0 || watch_tree(state, &path, NULL)) {
+		error_errno(_("could not watch '%s'"), path.buf);
+		if (errno == ENOSPC)
+			advise(_("raise fs.inotify.max_user_watches"));
+		goto failed;
+	}
+
+	if (state->nr_paths_watching > 1) {
+		data->wd_gitdir = add_watch(data, state->path_gitdir_watch.buf,
+					    GITDIR_MASK);
+		if (data->wd_gitdir < 0) {
+			error_errno(_("could not watch '%s'"),
+				    state->path_gitdir_watch.buf);
+			goto failed;
+		}
+	}
+
+	strbuf_reset(&path);
+	strbuf_addbuf(&path, &state->path_cookie_prefix);
+	strbuf_strip_suffix(&path, "/");
+	data->wd_cookies = add_watch(data, path.buf, COOKIE_MASK);
+	if (data->wd_cookies < 0) {
+		error_errno(_("could not watch '%s'"), path.buf);
+		goto failed;
+	}
+
+	trace_printf_key(&trace_fsmonitor, "inotify: watching %u directories",
+			 hashmap_get_size(&data->watches));
+
+	strbuf_release(&path);
+	return 0;
+
+failed:
+	strbuf_release(&path);
+	fsm_listen__dtor(state);
+	return -1;
+}
+
+void fsm_listen__dtor(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data;
+	struct hashmap_iter iter;
+	struct watch_entry *w;
+
+	if (!state || !state->listen_data)
+		return;
+
+	data = state->listen_data;
+
+	hashmap_for_each_entry(&data->watches, &iter, w, ent)
+		free(w->path);
+	hashmap_clear_and_free(&data->watches, struct watch_entry, ent);
+
+	if (data->fd_inotify >= 0)
+		close(data->fd_inotify);
+	if (data->fd_stop[0] >= 0)
+		close(data->fd_stop[0]);
+	if (data->fd_stop[1] >= 0)
+		close(data->fd_stop[1]);
+
+	FREE_AND_NULL(state->listen_data);
+}
+
+void fsm_listen__stop_async(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = state->listen_data;
+
+	data->shutdown_style = SHUTDOWN_EVENT;
+	if (write(data->fd_stop[1], "", 1) < 0)
+		error_errno(_("could not stop the inotify listener"));
+}
+
+void fsm_listen__loop(struct fsmonitor_daemon_state *state)
+{
+	struct fsm_listen_data *data = state->listen_data;
+	/* the buffer must be aligned for struct inotify_event */
+	union {
+		struct inotify_event event;
+		char buf[64 * 1024];
+	} u;
+
+	for (;;) {
+		struct pollfd pfd[2];
+		ssize_t len;
+
+		pfd[0].fd = data->fd_inotify;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = data->fd_stop[0];
+		pfd[1].events = POLLIN;
+
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			error_errno(_("poll() failed"));
+			data->shutdown_style = FORCE_ERROR_STOP;
+			break;
+		}
+
+		if (pfd[1].revents)
+			break;
+
+		len = read(data->fd_inotify, u.buf, sizeof(u.buf));
+		if (len < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			error_errno(_("could not read inotify events"));
+			data->shutdown_style = FORCE_ERROR_STOP;
+			break;
+		}
+
+		if (process_events(state, u.buf, len))
+			break;
+	}
+
+	switch (data->shutdown_style) {
+	case FORCE_ERROR_STOP:
+		state->listen_error_code = -1;
+		/* fall thru */
+	case FORCE_SHUTDOWN:
+		ipc_server_stop_async(state->ipc_server_data);
+		/* fall thru */
+	case SHUTDOWN_EVENT:
+	default:
+		break;
+	}
+}
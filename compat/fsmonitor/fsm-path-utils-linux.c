@@ -0,0 +1,97 @@
+#include "git-compat-util.h"
+#include "fsmonitor-ll.h"
+#include "fsmonitor-path-utils.h"
+#include "gettext.h"
+#include "trace.h"
+#include <sys/vfs.h>
+
+/*
+ * The f_type values of the filesystems we care about.  Not all of
+ * them are in <linux/magic.h>, so spell them out here.
+ */
+static const struct {
+	unsigned long magic;
+	const char *name;
+	int is_remote;
+} fs_types[] = {
+	{ 0x00006969, "nfs", 1 },
+	{ 0x0000517b, "smb", 1 },
+	{ 0xfe534d42, "smb2", 1 },
+	{ 0xff534d42, "cifs", 1 },
+	{ 0x5346414f, "afs", 1 },
+	{ 0x6b414653, "afs", 1 },
+	{ 0x73757245, "coda", 1 },
+	{ 0x00c36400, "ceph", 1 },
+	{ 0x01021997, "9p", 1 },
+	{ 0x65735546, "fuse", 0 },
+	{ 0x00004d44, "msdos", 0 },
+	{ 0x5346544e, "ntfs", 0 },
+	{ 0x2011bab0, "exfat", 0 },
+	{ 0x0000ef53, "ext4", 0 },
+	{ 0x9123683e, "btrfs", 0 },
+	{ 0x58465342, "xfs", 0 },
+	{ 0x01021994, "tmpfs", 0 },
+	{ 0x794c7630, "overlay", 0 },
+};
+
+int fsmonitor__get_fs_info(const char *path, struct fs_info *fs_info)
+{
+	struct statfs fs;
+	size_t i;
+
+	if (statfs(path, &fs) == -1) {
+		int saved_errno = errno;
+		trace_printf_key(&trace_fsmonitor, "statfs('%s') failed: %s",
+				 path, strerror(saved_errno));
+		errno = saved_errno;
+		return -1;
+	}
+
+	fs_info->is_remote = 0;
+	fs_info->typename = NULL;
+	for (i = 0; i < ARRAY_SIZE(fs_types); i++) {
+		if ((unsigned long)fs.f_type == fs_types[i].magic) {
+			fs_info->is_remote = fs_types[i].is_remote;
+			fs_info->typename = xstrdup(fs_types[i].name);
+			break;
+		}
+	}
+	if (!fs_info->typename)
+		fs_info->typename = xstrfmt("0x%08lx", (unsigned long)fs.f_type);
+
+	trace_printf_key(&trace_fsmonitor,
+			 "statfs('%s') [type 0x%08lx] '%s'",
+			 path, (unsigned long)fs.f_type, fs_info->typename);
+
+	trace_printf_key(&trace_fsmonitor,
+				"'%s' is_remote: %d",
+				path, fs_info->is_remote);
+	return 0;
+}
+
+int fsmonitor__is_fs_remote(const char *path)
+{
+	struct fs_info fs;
+	if (fsmonitor__get_fs_info(path, &fs))
+		return -1;
+
+	free(fs.typename);
+
+	return fs.is_remote;
+}
+
+/*
+ * Linux has no equivalent of the synthetic firmlinks of macOS; the
+ * paths we get from inotify are the ones we asked to watch.
+ */
+int fsmonitor__get_alias(const char *path UNUSED,
+			 struct alias_info *info UNUSED)
+{
+	return 0;
+}
+
+char *fsmonitor__resolve_alias(const char *path UNUSED,
+	const struct alias_info *info UNUSED)
+{
+	return NULL;
+}
@@ -0,0 +1,198 @@
+#include "git-compat-util.h"
+
+#include "compat/lstat-batch.h"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+
+/*
+ * A minimal io_uring driver that only knows how to submit IORING_OP_STATX
+ * requests and wait for all of them to complete. We talk to the kernel
+ * directly instead of depending on liburing.
+ */
+struct lstat_batch {
+	int fd;
+	unsigned int depth;
+
+	void *sq_ring;
+	size_t sq_ring_size;
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	void *cq_ring;
+	size_t cq_ring_size;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	struct statx *stx;
+};
+
+static int io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned int to_submit,
+			  unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, NULL, 0);
+}
+
+struct lstat_batch *lstat_batch_init(unsigned int depth)
+{
+	struct lstat_batch *b;
+	struct io_uring_params p;
+	char *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	CALLOC_ARRAY(b, 1);
+	b->fd = io_uring_setup(depth, &p);
+	if (b->fd < 0) {
+		/* no io_uring, or not allowed to use it */
+		free(b);
+		return NULL;
+	}
+
+	b->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	b->sq_ring = mmap(NULL, b->sq_ring_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, b->fd, IORING_OFF_SQ_RING);
+	b->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	b->cq_ring = mmap(NULL, b->cq_ring_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, b->fd, IORING_OFF_CQ_RING);
+	b->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	b->sqes = mmap(NULL, b->sqes_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, b->fd, IORING_OFF_SQES);
+	if (b->sq_ring == MAP_FAILED || b->cq_ring == MAP_FAILED ||
+	    b->sqes == MAP_FAILED) {
+		lstat_batch_release(b);
+		return NULL;
+	}
+
+	sq = b->sq_ring;
+	b->sq_head = (unsigned int *)(sq + p.sq_off.head);
+	b->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+	b->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+	b->sq_array = (unsigned int *)(sq + p.sq_off.array);
+
+	cq = b->cq_ring;
+	b->cq_head = (unsigned int *)(cq + p.cq_off.head);
+	b->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	b->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+	b->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	/* the kernel may round the ring size up, but never down */
+	b->depth = depth;
+	CALLOC_ARRAY(b->stx, depth);
+	return b;
+}
+
+static void statx_to_stat(const struct statx *stx, struct stat *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+	st->st_ino = stx->stx_ino;
+	st->st_mode = stx->stx_mode;
+	st->st_nlink = stx->stx_nlink;
+	st->st_uid = stx->stx_uid;
+	st->st_gid = stx->stx_gid;
+	st->st_rdev = makedev(stx->stx_rdev_major, stx->stx_rdev_minor);
+	st->st_size = stx->stx_size;
+	st->st_blksize = stx->stx_blksize;
+	st->st_blocks = stx->stx_blocks;
+	st->st_atim.tv_sec = stx->stx_atime.tv_sec;
+	st->st_atim.tv_nsec = stx->stx_atime.tv_nsec;
+	st->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+	st->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+	st->st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+	st->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+}
+
+int lstat_batch_run(struct lstat_batch *b, const char **path,
+		    struct stat *st, int *err, unsigned int nr)
+{
+	unsigned int i, tail, to_submit, done = 0;
+	int unsupported = 0;
+
+	if (nr > b->depth)
+		BUG("lstat batch of %u paths exceeds depth %u", nr, b->depth);
+
+	tail = *b->sq_tail;
+	for (i = 0; i < nr; i++) {
+		unsigned int idx = tail & *b->sq_mask;
+		struct io_uring_sqe *sqe = &b->sqes[idx];
+
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_STATX;
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (uintptr_t)path[i];
+		sqe->len = STATX_BASIC_STATS;
+		sqe->off = (uintptr_t)&b->stx[i];
+		sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+		sqe->user_data = i;
+		b->sq_array[idx] = idx;
+		tail++;
+	}
+	__atomic_store_n(b->sq_tail, tail, __ATOMIC_RELEASE);
+
+	to_submit = nr;
+	while (done < nr) {
+		unsigned int head = *b->cq_head;
+		unsigned int cq_tail = __atomic_load_n(b->cq_tail, __ATOMIC_ACQUIRE);
+
+		if (head == cq_tail) {
+			int ret = io_uring_enter(b->fd, to_submit, 1,
+						 IORING_ENTER_GETEVENTS);
+			if (ret < 0) {
+				if (errno == EINTR || errno == EAGAIN ||
+				    errno == EBUSY)
+					continue;
+				/*
+				 * The kernel still owns the buffers of any
+				 * request we managed to submit.
+				 */
+				if (to_submit < nr)
+					die_errno("io_uring_enter");
+				return -1;
+			}
+			to_submit -= ret;
+			continue;
+		}
+
+		for (; head != cq_tail; head++, done++) {
+			const struct io_uring_cqe *cqe = &b->cqes[head & *b->cq_mask];
+			unsigned int n = cqe->user_data;
+
+			if (cqe->res == -EINVAL) {
+				/* IORING_OP_STATX needs Linux 5.6 */
+				unsupported = 1;
+			} else if (cqe->res < 0) {
+				err[n] = -cqe->res;
+			} else {
+				err[n] = 0;
+				statx_to_stat(&b->stx[n], &st[n]);
+			}
+		}
+		__atomic_store_n(b->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	return unsupported ? -1 : 0;
+}
+
+void lstat_batch_release(struct lstat_batch *b)
+{
+	if (!b)
+		return;
+	if (b->sqes && b->sqes != MAP_FAILED)
+		munmap(b->sqes, b->sqes_size);
+	if (b->cq_ring && b->cq_ring != MAP_FAILED)
+		munmap(b->cq_ring, b->cq_ring_size);
+	if (b->sq_ring && b->sq_ring != MAP_FAILED)
+		munmap(b->sq_ring, b->sq_ring_size);
+	close(b->fd);
+	free(b->stx);
+	free(b);
+}
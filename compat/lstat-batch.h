@@ -0,0 +1,30 @@
+#ifndef COMPAT_LSTAT_BATCH_H
+#define COMPAT_LSTAT_BATCH_H
+
+/*
+ * Issue many lstat() calls at once where the platform allows it (e.g.
+ * through io_uring on Linux), so that the latency of each call is not
+ * paid one after another.
+ */
+struct lstat_batch;
+
+/*
+ * Prepare to lstat() up to "depth" paths per call to lstat_batch_run().
+ * Returns NULL if the platform (or the running kernel) cannot do this;
+ * the caller should then call lstat() itself.
+ */
+struct lstat_batch *lstat_batch_init(unsigned int depth);
+
+/*
+ * lstat() the first "nr" (at most "depth") paths in "path", relative
+ * to the current directory. The result for path[i] is stored in st[i],
+ * and err[i] is set to 0 or to the errno lstat() would have reported.
+ * Returns -1 if the batch could not be submitted at all, in which case
+ * none of the results are valid.
+ */
+int lstat_batch_run(struct lstat_batch *batch, const char **path,
+		    struct stat *st, int *err, unsigned int nr);
+
+void lstat_batch_release(struct lstat_batch *batch);
+
+#endif /* COMPAT_LSTAT_BATCH_H */
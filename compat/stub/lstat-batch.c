@@ -0,0 +1,23 @@
+#include "git-compat-util.h"
+
+#include "compat/lstat-batch.h"
+
+/*
+ * Stub. See the sample implementation in compat/linux/lstat-batch.c.
+ */
+struct lstat_batch *lstat_batch_init(unsigned int depth UNUSED)
+{
+	return NULL;
+}
+
+int lstat_batch_run(struct lstat_batch *batch UNUSED,
+		    const char **path UNUSED,
+		    struct stat *st UNUSED, int *err UNUSED,
+		    unsigned int nr UNUSED)
+{
+	return -1;
+}
+
+void lstat_batch_release(struct lstat_batch *batch UNUSED)
+{
+}
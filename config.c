@@ -1653,6 +1653,11 @@ static int git_default_core_config(const char *var, const char *value,
 		return 0;
 	}
 
+	if (!strcmp(var, "core.iouring")) {
+		core_io_uring = git_config_bool(var, value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.createobject")) {
 		if (!value)
 			return config_error_nonbool(var);
@@ -2756,6 +2761,16 @@ int repo_config_get_max_percent_split_change(struct repository *r)
 	return -1; /* default value */
 }
 
+int repo_config_get_split_index_min_entries(struct repository *r)
+{
+	int val;
+
+	if (!repo_config_get_int(r, "splitindex.minentries", &val) && val > 0)
+		return val;
+
+	return 0; /* default value: never split automatically */
+}
+
 int repo_config_get_index_threads(struct repository *r, int *dest)
 {
 	int is_bool, val;
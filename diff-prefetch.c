@@ -0,0 +1,505 @@
+#include "git-compat-util.h"
+#include "diff.h"
+#include "diff-prefetch.h"
+#include "environment.h"
+#include "gettext.h"
+#include "hashmap.h"
+#include "object-store-ll.h"
+#include "oidmap.h"
+#include "pathspec.h"
+#include "thread-utils.h"
+#include "trace2.h"
+#include "xdiff-interface.h"
+
+/* How many commits each worker thread may run ahead of the main thread */
+#define PREFETCH_JOBS_PER_THREAD 4
+
+struct prefetch_blob {
+	struct oidmap_entry entry;
+	void *data;
+	unsigned long size;
+};
+
+struct prefetch_stat {
+	struct hashmap_entry ent;
+	/* the null oid stands for a file that does not exist on that side */
+	struct object_id one, two;
+	uintmax_t added, deleted;
+	int max_cost_reached;
+};
+
+struct prefetch_job {
+	struct object_id old_tree, new_tree;
+	unsigned has_old_tree:1,
+		 has_new_tree:1,
+		 done:1;
+	struct oidmap blobs;
+	struct hashmap stats;
+};
+
+struct prefetch_pair {
+	struct object_id one, two;
+	unsigned has_one:1,
+		 has_two:1;
+};
+
+struct prefetch_pairs {
+	struct prefetch_pair *pair;
+	size_t nr, alloc;
+};
+
+struct diff_prefetch {
+	struct repository *repo;
+
+	/* the tree diff each worker runs is a copy of this one */
+	struct diff_options tree_opt;
+
+	/* how to count lines for the diffstat, if it is shown */
+	int diffstat;
+	xpparam_t xpp;
+	long ctxlen, interhunkctxlen;
+
+	int nr_threads;
+	pthread_t *threads;
+
+	/*
+	 * Jobs in [show, work) have been or are being worked on, the ones
+	 * in [work, add) are waiting for a worker thread.  The ranges are
+	 * modulo nr_jobs; 'queued' counts the jobs in [show, add) and
+	 * 'waiting' the ones in [work, add).
+	 */
+	struct prefetch_job *job;
+	int nr_jobs, queued, waiting;
+	int show, work, add;
+	int finishing;
+
+	/* protects all of the above that can change */
+	pthread_mutex_t mutex;
+	/* signalled when a job is added, and when finishing */
+	pthread_cond_t cond_add;
+	/* signalled when a job is done */
+	pthread_cond_t cond_done;
+};
+
+/* the job of the commit being shown, if any */
+static struct prefetch_job *current_job;
+static struct diff_prefetch *current_prefetch;
+
+static int stat_cmp(const void *cmp_data UNUSED,
+		    const struct hashmap_entry *eptr,
+		    const struct hashmap_entry *entry_or_key,
+		    const void *keydata UNUSED)
+{
+	const struct prefetch_stat *a, *b;
+
+	a = container_of(eptr, const struct prefetch_stat, ent);
+	b = container_of(entry_or_key, const struct prefetch_stat, ent);
+	return !oideq(&a->one, &b->one) || !oideq(&a->two, &b->two);
+}
+
+static unsigned int stat_hash(const struct object_id *one,
+			      const struct object_id *two)
+{
+	return oidhash(one) ^ (oidhash(two) * 31);
+}
+
+static void clear_job(struct prefetch_job *job)
+{
+	struct oidmap_iter iter;
+	struct prefetch_blob *blob;
+
+	oidmap_iter_init(&job->blobs, &iter);
+	while ((blob = oidmap_iter_next(&iter)))
+		free(blob->data);
+	oidmap_free(&job->blobs, 1);
+	hashmap_clear_and_free(&job->stats, struct prefetch_stat, ent);
+}
+
+static void add_pair(struct prefetch_pairs *pairs,
+		     const struct object_id *one, const struct object_id *two)
+{
+	struct prefetch_pair *pair;
+
+	ALLOC_GROW(pairs->pair, pairs->nr + 1, pairs->alloc);
+	pair = &pairs->pair[pairs->nr++];
+	memset(pair, 0, sizeof(*pair));
+	if (one) {
+		oidcpy(&pair->one, one);
+		pair->has_one = 1;
+	}
+	if (two) {
+		oidcpy(&pair->two, two);
+		pair->has_two = 1;
+	}
+}
+
+static void collect_change(struct diff_options *opt,
+			   unsigned old_mode, unsigned new_mode,
+			   const struct object_id *old_oid,
+			   const struct object_id *new_oid,
+			   int old_oid_valid UNUSED, int new_oid_valid UNUSED,
+			   const char *fullpath UNUSED,
+			   unsigned old_dirty_submodule UNUSED,
+			   unsigned new_dirty_submodule UNUSED)
+{
+	if (S_ISREG(old_mode) && S_ISREG(new_mode))
+		add_pair(opt->change_fn_data, old_oid, new_oid);
+}
+
+static void collect_add_remove(struct diff_options *opt,
+			       int addremove, unsigned mode,
+			       const struct object_id *oid,
+			       int oid_valid UNUSED,
+			       const char *fullpath UNUSED,
+			       unsigned dirty_submodule UNUSED)
+{
+	if (!S_ISREG(mode))
+		return;
+	if (addremove == '+')
+		add_pair(opt->change_fn_data, NULL, oid);
+	else
+		add_pair(opt->change_fn_data, oid, NULL);
+}
+
+/*
+ * Read the blob 'oid' into the job, unless it is so large that the diff
+ * machinery would rather not have it in core.
+ */
+static struct prefetch_blob *read_blob(struct diff_prefetch *p,
+				       struct prefetch_job *job,
+				       const struct object_id *oid)
+{
+	struct prefetch_blob *blob = oidmap_get(&job->blobs, oid);
+	enum object_type type;
+	unsigned long size;
+
+	if (blob)
+		return blob->data ? blob : NULL;
+
+	CALLOC_ARRAY(blob, 1);
+	oidcpy(&blob->entry.oid, oid);
+	oidmap_put(&job->blobs, blob);
+
+	if (oid_object_info(p->repo, oid, &size) != OBJ_BLOB ||
+	    size > big_file_threshold)
+		return NULL;
+	blob->data = repo_read_object_file(p->repo, oid, &type, &blob->size);
+	return blob->data ? blob : NULL;
+}
+
+static int count_consume(void *priv, char *line, unsigned long len UNUSED)
+{
+	struct prefetch_stat *stat = priv;
+
+	if (line[0] == '+')
+		stat->added++;
+	else if (line[0] == '-')
+		stat->deleted++;
+	return 0;
+}
+
+/* Count the lines the way builtin_diffstat() does for a pair of text files */
+static void count_lines(struct diff_prefetch *p, struct prefetch_job *job,
+			struct prefetch_pair *pair,
+			struct prefetch_blob *one, struct prefetch_blob *two)
+{
+	struct prefetch_stat *stat;
+	mmfile_t mf1, mf2;
+	xpparam_t xpp;
+	xdemitconf_t xecfg;
+
+	mf1.ptr = one ? one->data : (char *)"";
+	mf1.size = one ? one->size : 0;
+	mf2.ptr = two ? two->data : (char *)"";
+	mf2.size = two ? two->size : 0;
+	if (buffer_is_binary(mf1.ptr, mf1.size) ||
+	    buffer_is_binary(mf2.ptr, mf2.size))
+		return;
+
+	CALLOC_ARRAY(stat, 1);
+	oidcpy(&stat->one, pair->has_one ? &pair->one : null_oid());
+	oidcpy(&stat->two, pair->has_two ? &pair->two : null_oid());
+	hashmap_entry_init(&stat->ent, stat_hash(&stat->one, &stat->two));
+	if (hashmap_get(&job->stats, &stat->ent, NULL)) {
+		free(stat);
+		return;
+	}
+
+	memcpy(&xpp, &p->xpp, sizeof(xpp));
+	memset(&xecfg, 0, sizeof(xecfg));
+	xpp.max_cost_reached = &stat->max_cost_reached;
+	xecfg.ctxlen = p->ctxlen;
+	xecfg.interhunkctxlen = p->interhunkctxlen;
+	xecfg.flags = XDL_EMIT_NO_HUNK_HDR;
+	if (xdi_diff_outf(&mf1, &mf2, NULL, count_consume, stat, &xpp, &xecfg)) {
+		/* leave it to the main thread to complain */
+		free(stat);
+		return;
+	}
+	hashmap_add(&job->stats, &stat->ent);
+}
+
+static void run_job(struct diff_prefetch *p, struct diff_options *opt,
+		    struct prefetch_job *job)
+{
+	struct prefetch_pairs pairs = { 0 };
+	size_t i;
+
+	if (!job->has_new_tree)
+		return;
+
+	opt->change_fn_data = &pairs;
+	diff_tree_oid(job->has_old_tree ? &job->old_tree : NULL,
+		      &job->new_tree, "", opt);
+
+	for (i = 0; i < pairs.nr; i++) {
+		struct prefetch_pair *pair = &pairs.pair[i];
+		struct prefetch_blob *one = NULL, *two = NULL;
+
+		if (pair->has_one && !(one = read_blob(p, job, &pair->one)))
+			continue;
+		if (pair->has_two && !(two = read_blob(p, job, &pair->two)))
+			continue;
+		if (p->diffstat)
+			count_lines(p, job, pair, one, two);
+	}
+	free(pairs.pair);
+}
+
+static void *prefetch_thread(void *data)
+{
+	struct diff_prefetch *p = data;
+	struct diff_options opt;
+
+	memcpy(&opt, &p->tree_opt, sizeof(opt));
+	for (;;) {
+		struct prefetch_job *job;
+
+		pthread_mutex_lock(&p->mutex);
+		while (!p->waiting && !p->finishing)
+			pthread_cond_wait(&p->cond_add, &p->mutex);
+		if (!p->waiting) {
+			pthread_mutex_unlock(&p->mutex);
+			break;
+		}
+		job = &p->job[p->work];
+		p->work = (p->work + 1) % p->nr_jobs;
+		p->waiting--;
+		pthread_mutex_unlock(&p->mutex);
+
+		run_job(p, &opt, job);
+
+		pthread_mutex_lock(&p->mutex);
+		job->done = 1;
+		pthread_cond_signal(&p->cond_done);
+		pthread_mutex_unlock(&p->mutex);
+	}
+	return NULL;
+}
+
+struct diff_prefetch *diff_prefetch_start(struct diff_options *opt,
+					  int nr_threads)
+{
+	struct diff_prefetch *p;
+	int i;
+
+	if (!HAVE_THREADS)
+		BUG("diff_prefetch_start() without threads support");
+	if (current_prefetch)
+		BUG("only one diff prefetch can run at a time");
+
+	CALLOC_ARRAY(p, 1);
+	p->repo = opt->repo;
+	p->diffstat = !!(opt->output_format & (DIFF_FORMAT_DIFFSTAT |
+					       DIFF_FORMAT_NUMSTAT |
+					       DIFF_FORMAT_SHORTSTAT));
+	p->xpp.flags = opt->xdl_opts;
+	p->xpp.ignore_regex = opt->ignore_regex;
+	p->xpp.ignore_regex_nr = opt->ignore_regex_nr;
+	p->xpp.anchors = opt->anchors;
+	p->xpp.anchors_nr = opt->anchors_nr;
+	p->xpp.max_cost = opt->max_diff_cost;
+	p->ctxlen = opt->context;
+	p->interhunkctxlen = opt->interhunkcontext;
+
+	p->tree_opt.repo = opt->repo;
+	p->tree_opt.flags.recursive = 1;
+	p->tree_opt.change = collect_change;
+	p->tree_opt.add_remove = collect_add_remove;
+	/*
+	 * Matching attributes is not thread-safe; read the blobs for all
+	 * paths instead, which only costs some work that goes unused.
+	 */
+	if (!(opt->pathspec.magic & PATHSPEC_ATTR))
+		copy_pathspec(&p->tree_opt.pathspec, &opt->pathspec);
+	p->tree_opt.pathspec.recursive = 1;
+
+	p->nr_threads = nr_threads;
+	p->nr_jobs = nr_threads * PREFETCH_JOBS_PER_THREAD;
+	CALLOC_ARRAY(p->job, p->nr_jobs);
+	pthread_mutex_init(&p->mutex, NULL);
+	pthread_cond_init(&p->cond_add, NULL);
+	pthread_cond_init(&p->cond_done, NULL);
+	enable_obj_read_lock();
+	current_prefetch = p;
+
+	trace2_data_intmax("diff", p->repo, "prefetch/threads", nr_threads);
+	CALLOC_ARRAY(p->threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&p->threads[i], NULL,
+					 prefetch_thread, p);
+		if (err)
+			die(_("unable to create diff prefetch thread: %s"),
+			    strerror(err));
+	}
+	return p;
+}
+
+int diff_prefetch_full(struct diff_prefetch *p)
+{
+	int full;
+
+	pthread_mutex_lock(&p->mutex);
+	full = p->queued == p->nr_jobs;
+	pthread_mutex_unlock(&p->mutex);
+	return full;
+}
+
+void diff_prefetch_add(struct diff_prefetch *p,
+		       const struct object_id *old_tree,
+		       const struct object_id *new_tree)
+{
+	struct prefetch_job *job;
+
+	pthread_mutex_lock(&p->mutex);
+	if (p->queued == p->nr_jobs)
+		BUG("too many diff prefetch jobs queued");
+	job = &p->job[p->add];
+	memset(job, 0, sizeof(*job));
+	if (old_tree) {
+		oidcpy(&job->old_tree, old_tree);
+		job->has_old_tree = 1;
+	}
+	if (new_tree) {
+		oidcpy(&job->new_tree, new_tree);
+		job->has_new_tree = 1;
+	}
+	oidmap_init(&job->blobs, 0);
+	hashmap_init(&job->stats, stat_cmp, NULL, 0);
+	p->add = (p->add + 1) % p->nr_jobs;
+	p->queued++;
+	p->waiting++;
+	pthread_cond_signal(&p->cond_add);
+	pthread_mutex_unlock(&p->mutex);
+}
+
+void diff_prefetch_begin(struct diff_prefetch *p)
+{
+	struct prefetch_job *job;
+
+	pthread_mutex_lock(&p->mutex);
+	if (!p->queued)
+		BUG("no diff prefetch job to begin");
+	job = &p->job[p->show];
+	while (!job->done)
+		pthread_cond_wait(&p->cond_done, &p->mutex);
+	pthread_mutex_unlock(&p->mutex);
+	current_job = job;
+}
+
+void diff_prefetch_end(struct diff_prefetch *p)
+{
+	struct prefetch_job *job = &p->job[p->show];
+
+	if (current_job != job)
+		BUG("ending a diff prefetch job that was not begun");
+	current_job = NULL;
+	clear_job(job);
+
+	pthread_mutex_lock(&p->mutex);
+	p->show = (p->show + 1) % p->nr_jobs;
+	p->queued--;
+	pthread_mutex_unlock(&p->mutex);
+}
+
+void diff_prefetch_finish(struct diff_prefetch *p)
+{
+	int i;
+
+	pthread_mutex_lock(&p->mutex);
+	p->finishing = 1;
+	pthread_cond_broadcast(&p->cond_add);
+	pthread_mutex_unlock(&p->mutex);
+
+	for (i = 0; i < p->nr_threads; i++)
+		pthread_join(p->threads[i], NULL);
+
+	if (current_job)
+		diff_prefetch_end(p);
+	for (; p->queued; p->queued--) {
+		clear_job(&p->job[p->show]);
+		p->show = (p->show + 1) % p->nr_jobs;
+	}
+
+	current_prefetch = NULL;
+	disable_obj_read_lock();
+	pthread_mutex_destroy(&p->mutex);
+	pthread_cond_destroy(&p->cond_add);
+	pthread_cond_destroy(&p->cond_done);
+	clear_pathspec(&p->tree_opt.pathspec);
+	free(p->threads);
+	free(p->job);
+	free(p);
+}
+
+int diff_prefetch_take_blob(struct repository *r,
+			    const struct object_id *oid,
+			    void **data, unsigned long *size)
+{
+	struct prefetch_blob *blob;
+
+	if (!current_job || r != current_prefetch->repo)
+		return 0;
+	blob = oidmap_get(&current_job->blobs, oid);
+	if (!blob || !blob->data)
+		return 0;
+	*data = blob->data;
+	*size = blob->size;
+	blob->data = NULL;
+	return 1;
+}
+
+int diff_prefetch_diffstat(struct diff_options *opt,
+			   const struct object_id *one,
+			   const struct object_id *two,
+			   uintmax_t *added, uintmax_t *deleted,
+			   int *max_cost_reached)
+{
+	struct diff_prefetch *p = current_prefetch;
+	struct prefetch_stat key, *stat;
+
+	if (!current_job)
+		return 0;
+	/* the lines were counted with the options the prefetch started with */
+	if (opt->repo != p->repo ||
+	    opt->xdl_opts != p->xpp.flags ||
+	    opt->ignore_regex != p->xpp.ignore_regex ||
+	    opt->ignore_regex_nr != p->xpp.ignore_regex_nr ||
+	    opt->anchors != p->xpp.anchors ||
+	    opt->anchors_nr != p->xpp.anchors_nr ||
+	    opt->max_diff_cost != p->xpp.max_cost ||
+	    opt->context != p->ctxlen ||
+	    opt->interhunkcontext != p->interhunkctxlen)
+		return 0;
+
+	oidcpy(&key.one, one ? one : null_oid());
+	oidcpy(&key.two, two ? two : null_oid());
+	hashmap_entry_init(&key.ent, stat_hash(&key.one, &key.two));
+	stat = hashmap_get_entry(&current_job->stats, &key, ent, NULL);
+	if (!stat)
+		return 0;
+	*added = stat->added;
+	*deleted = stat->deleted;
+	*max_cost_reached = stat->max_cost_reached;
+	return 1;
+}
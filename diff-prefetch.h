@@ -0,0 +1,76 @@
+#ifndef DIFF_PREFETCH_H
+#define DIFF_PREFETCH_H
+
+/*
+ * diff-prefetch - prepare the diffs of commits that are about to be shown
+ * on worker threads, while the main thread is busy showing earlier ones.
+ *
+ * The caller queues one job per commit, in the order the commits are going
+ * to be shown, giving the trees to compare (or none, if the commit will not
+ * be diffed against a single parent).  Worker threads run the tree diff,
+ * read the blobs of the regular files that changed, and count the lines
+ * added and deleted for the diffstat.
+ *
+ * The diffs themselves are still computed and shown on the main thread,
+ * one commit at a time, by the usual machinery: between
+ * diff_prefetch_begin() and diff_prefetch_end(), diff_populate_filespec()
+ * and the diffstat code take the results of the job of the commit being
+ * shown instead of reading and counting again.  Nothing a worker does can
+ * change the output; a result that is not there (or does not apply to the
+ * filepair at hand) is simply computed as usual.
+ */
+
+struct diff_options;
+struct diff_prefetch;
+struct object_id;
+struct repository;
+
+/*
+ * Start 'nr_threads' worker threads preparing diffs to be shown with the
+ * options 'opt'.  The pathspec and the options that affect how lines are
+ * counted are copied.
+ */
+struct diff_prefetch *diff_prefetch_start(struct diff_options *opt,
+					  int nr_threads);
+
+/*
+ * Queue a job comparing the trees 'old_tree' (NULL for the empty tree) and
+ * 'new_tree'.  When 'new_tree' is NULL the job does nothing, but still has
+ * to be begun and ended in turn.  Must not be called when
+ * diff_prefetch_full() says so.
+ */
+void diff_prefetch_add(struct diff_prefetch *p,
+		       const struct object_id *old_tree,
+		       const struct object_id *new_tree);
+int diff_prefetch_full(struct diff_prefetch *p);
+
+/*
+ * Wait for the oldest job to be done and make its results available, and
+ * discard whatever of them was not used.
+ */
+void diff_prefetch_begin(struct diff_prefetch *p);
+void diff_prefetch_end(struct diff_prefetch *p);
+
+/* Stop the worker threads and free 'p', including any job still queued. */
+void diff_prefetch_finish(struct diff_prefetch *p);
+
+/*
+ * If the job being shown has read the blob 'oid', hand its contents over to
+ * the caller, who is responsible for freeing them, and return 1.
+ */
+int diff_prefetch_take_blob(struct repository *r,
+			    const struct object_id *oid,
+			    void **data, unsigned long *size);
+
+/*
+ * If the job being shown has counted the lines added and deleted between
+ * the blobs 'one' and 'two' (NULL for a file that does not exist on that
+ * side) with the options 'opt', return them and 1.
+ */
+int diff_prefetch_diffstat(struct diff_options *opt,
+			   const struct object_id *one,
+			   const struct object_id *two,
+			   uintmax_t *added, uintmax_t *deleted,
+			   int *max_cost_reached);
+
+#endif
@@ -15,6 +15,7 @@
 #include "quote.h"
 #include "diff.h"
 #include "diffcore.h"
+#include "diff-prefetch.h"
 #include "delta.h"
 #include "hex.h"
 #include "xdiff-interface.h"
@@ -73,6 +74,7 @@ static int diff_stat_graph_width;
 static int diff_dirstat_permille_default = 30;
 static struct diff_options default_diff_options;
 static long diff_algorithm;
+static int diff_max_cost;
 static unsigned ws_error_highlight_default = WSEH_NEW;
 
 static char diff_colors[][COLOR_MAXLEN] = {
@@ -468,6 +470,12 @@ int git_diff_ui_config(const char *var, const char *value,
 				     var, value);
 		return 0;
 	}
+	if (!strcmp(var, "diff.maxcost")) {
+		diff_max_cost = git_config_int(var, value, ctx->kvi);
+		if (diff_max_cost < 0)
+			return -1;
+		return 0;
+	}
 
 	if (git_color_config(var, value, cb) < 0)
 		return -1;
@@ -2170,6 +2178,7 @@ static void diff_words_show(struct diff_words_data *diff_words)
 	diff_words_fill(&diff_words->minus, &minus, diff_words->word_regex);
 	diff_words_fill(&diff_words->plus, &plus, diff_words->word_regex);
 	xpp.flags = 0;
+	xpp.max_cost = diff_words->opt->max_diff_cost;
 	/* as only the hunk header will be parsed, we need a 0-context */
 	xecfg.ctxlen = 0;
 	if (xdi_diff_outf(&minus, &plus, fn_out_diff_words_aux, NULL,
@@ -3529,6 +3538,13 @@ static int set_diff_algorithm(struct diff_options *opts,
 	return 0;
 }
 
+void diff_warn_max_cost(const char *path)
+{
+	warning(_("'%s' was shown with a larger diff than necessary, "
+		  "because a short one would take too long to find "
+		  "(see --max-diff-cost)"), path);
+}
+
 static void builtin_diff(const char *name_a,
 			 const char *name_b,
 			 struct diff_filespec *one,
@@ -3704,6 +3720,7 @@ static void builtin_diff(const char *name_a,
 		xdemitconf_t xecfg;
 		struct emit_callback ecbdata;
 		const struct userdiff_funcname *pe;
+		int max_cost_reached = 0;
 
 		if (must_show_header) {
 			emit_diff_symbol(o, DIFF_SYMBOL_HEADER,
@@ -3736,6 +3753,8 @@ static void builtin_diff(const char *name_a,
 		xpp.ignore_regex_nr = o->ignore_regex_nr;
 		xpp.anchors = o->anchors;
 		xpp.anchors_nr = o->anchors_nr;
+		xpp.max_cost = o->max_diff_cost;
+		xpp.max_cost_reached = &max_cost_reached;
 		xecfg.ctxlen = o->context;
 		xecfg.interhunkctxlen = o->interhunkcontext;
 		xecfg.flags = XDL_EMIT_FUNCNAMES;
@@ -3757,6 +3776,8 @@ static void builtin_diff(const char *name_a,
 		if (xdi_diff_outf(&mf1, &mf2, NULL, fn_out_consume,
 				  &ecbdata, &xpp, &xecfg))
 			die("unable to generate diff for %s", one->path);
+		if (max_cost_reached)
+			diff_warn_max_cost(one->path);
 		if (o->word_diff)
 			free_diff_words_data(&ecbdata);
 		if (textconv_one)
@@ -3855,6 +3876,14 @@ static void builtin_diffstat(const char *name_a, const char *name_b,
 		/* Crazy xdl interfaces.. */
 		xpparam_t xpp;
 		xdemitconf_t xecfg;
+		int max_cost_reached = 0;
+
+		if (diff_prefetch_diffstat(o,
+					   DIFF_FILE_VALID(one) ? &one->oid : NULL,
+					   DIFF_FILE_VALID(two) ? &two->oid : NULL,
+					   &data->added, &data->deleted,
+					   &max_cost_reached))
+			goto counted;
 
 		if (fill_mmfile(o->repo, &mf1, one) < 0 ||
 		    fill_mmfile(o->repo, &mf2, two) < 0)
@@ -3867,12 +3896,18 @@ static void builtin_diffstat(const char *name_a, const char *name_b,
 		xpp.ignore_regex_nr = o->ignore_regex_nr;
 		xpp.anchors = o->anchors;
 		xpp.anchors_nr = o->anchors_nr;
+		xpp.max_cost = o->max_diff_cost;
+		xpp.max_cost_reached = &max_cost_reached;
 		xecfg.ctxlen = o->context;
 		xecfg.interhunkctxlen = o->interhunkcontext;
 		xecfg.flags = XDL_EMIT_NO_HUNK_HDR;
 		if (xdi_diff_outf(&mf1, &mf2, NULL,
 				  diffstat_consume, diffstat, &xpp, &xecfg))
 			die("unable to generate diffstat for %s", one->path);
+counted:
+		/* the patch, if we show one, warns about it */
+		if (max_cost_reached && !(o->output_format & DIFF_FORMAT_PATCH))
+			diff_warn_max_cost(one->path);
 
 		if (DIFF_FILE_VALID(one) && DIFF_FILE_VALID(two)) {
 			struct diffstat_file *file =
@@ -4215,6 +4250,12 @@ int diff_populate_filespec(struct repository *r,
 			.sizep = &s->size
 		};
 
+		if (!size_only &&
+		    diff_prefetch_take_blob(r, &s->oid, &s->data, &s->size)) {
+			s->should_free = 1;
+			return 0;
+		}
+
 		if (!(size_only || check_binary))
 			/*
 			 * Set contentp, since there is no chance that merely
@@ -4767,6 +4808,7 @@ void repo_diff_setup(struct repository *r, struct diff_options *options)
 	options->use_color = diff_use_color_default;
 	options->detect_rename = diff_detect_rename_default;
 	options->xdl_opts |= diff_algorithm;
+	options->max_diff_cost = diff_max_cost;
 	if (diff_indent_heuristic)
 		DIFF_XDL_SET(options, INDENT_HEURISTIC);
 
@@ -5395,6 +5437,18 @@ static int diff_opt_line_prefix(const struct option *opt,
 	return 0;
 }
 
+static int diff_opt_max_diff_cost(const struct option *opt,
+				  const char *arg, int unset)
+{
+	int *max_cost = opt->value;
+
+	BUG_ON_OPT_NEG(unset);
+	if (strtol_i(arg, 10, max_cost) || *max_cost < 0)
+		return error(_("%s expects a non-negative integer value"),
+			     "--max-diff-cost");
+	return 0;
+}
+
 static int diff_opt_no_prefix(const struct option *opt,
 			      const char *optarg, int unset)
 {
@@ -5806,6 +5860,9 @@ struct option *add_diff_options(const struct option *opts,
 		OPT_CALLBACK_F(0, "anchored", options, N_("<text>"),
 			       N_("generate diff using the \"anchored diff\" algorithm"),
 			       PARSE_OPT_NONEG, diff_opt_anchored),
+		OPT_CALLBACK_F(0, "max-diff-cost", &options->max_diff_cost, N_("<n>"),
+			       N_("give up on a short diff after <n> steps per line"),
+			       PARSE_OPT_NONEG, diff_opt_max_diff_cost),
 		OPT_CALLBACK_F(0, "word-diff", options, N_("<mode>"),
 			       N_("show word diff, using <mode> to delimit changed words"),
 			       PARSE_OPT_NONEG | PARSE_OPT_OPTARG, diff_opt_word_diff),
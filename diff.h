@@ -334,6 +334,7 @@ struct diff_options {
 	const char *stat_sep;
 	int xdl_opts;
 	int ignore_driver_algorithm;
+	int max_diff_cost;
 
 	/* see Documentation/diff-options.txt */
 	char **anchors;
@@ -610,6 +611,12 @@ void diff_flush(struct diff_options*);
 void diff_free(struct diff_options*);
 void diff_warn_rename_limit(const char *varname, int needed, int degraded_cc);
 
+/*
+ * Warn that the diff shown for "path" is larger than necessary because
+ * --max-diff-cost gave up on finding a short one.
+ */
+void diff_warn_max_cost(const char *path);
+
 /* diff-raw status letters */
 #define DIFF_STATUS_ADDED		'A'
 #define DIFF_STATUS_COPIED		'C'
@@ -166,6 +166,12 @@ static struct spanhash_top *hash_chars(struct repository *r,
 	return hash;
 }
 
+void *diffcore_count_prepare(struct repository *r,
+			     struct diff_filespec *one)
+{
+	return hash_chars(r, one);
+}
+
 int diffcore_count_changes(struct repository *r,
 			   struct diff_filespec *src,
 			   struct diff_filespec *dst,
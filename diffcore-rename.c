@@ -6,17 +6,24 @@
 #define USE_THE_REPOSITORY_VARIABLE
 
 #include "git-compat-util.h"
+#include "config.h"
 #include "diff.h"
 #include "diffcore.h"
+#include "environment.h"
 #include "object-store-ll.h"
 #include "hashmap.h"
+#include "hex.h"
+#include "ident.h"
 #include "mem-pool.h"
+#include "notes-cache.h"
 #include "oid-array.h"
 #include "progress.h"
 #include "promisor-remote.h"
 #include "string-list.h"
 #include "strmap.h"
+#include "thread-utils.h"
 #include "trace2.h"
+#include "userdiff.h"
 
 /* Table of rename/copy destinations */
 
@@ -129,6 +136,48 @@ static void inexact_prefetch(void *prefetch_options)
 	oid_array_clear(&to_fetch);
 }
 
+/*
+ * We would not consider edits that change the file size so
+ * drastically.  delta_size must be smaller than
+ * (MAX_SCORE-minimum_score)/MAX_SCORE * min(src->size, dst->size).
+ *
+ * Note that base_size == 0 case is handled here already
+ * and the final score computation in counted_similarity() would
+ * not have a divide-by-zero issue.
+ */
+static int sizes_too_different(struct diff_filespec *src,
+			       struct diff_filespec *dst,
+			       int minimum_score)
+{
+	unsigned long max_size, delta_size, base_size;
+
+	max_size = ((src->size > dst->size) ? src->size : dst->size);
+	base_size = ((src->size < dst->size) ? src->size : dst->size);
+	delta_size = max_size - base_size;
+
+	return max_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE;
+}
+
+static int counted_similarity(struct repository *r,
+			      struct diff_filespec *src,
+			      struct diff_filespec *dst)
+{
+	unsigned long max_size, src_copied, literal_added;
+
+	if (diffcore_count_changes(r, src, dst,
+				   &src->cnt_data, &dst->cnt_data,
+				   &src_copied, &literal_added))
+		return 0;
+
+	/* How similar are they?
+	 * what percentage of material in dst are from source?
+	 */
+	max_size = ((src->size > dst->size) ? src->size : dst->size);
+	if (!dst->size)
+		return 0; /* should not happen */
+	return (int)(src_copied * MAX_SCORE / max_size);
+}
+
 static int estimate_similarity(struct repository *r,
 			       struct diff_filespec *src,
 			       struct diff_filespec *dst,
@@ -148,8 +197,6 @@ static int estimate_similarity(struct repository *r,
 	 * match than anything else; the destination does not even
 	 * call into this function in that case.
 	 */
-	unsigned long max_size, delta_size, base_size, src_copied, literal_added;
-	int score;
 
 	/* We deal only with regular files.  Symlink renames are handled
 	 * only when they are exact matches --- in other words, no edits
@@ -176,19 +223,7 @@ static int estimate_similarity(struct repository *r,
 	    diff_populate_filespec(r, dst, dpf_opt))
 		return 0;
 
-	max_size = ((src->size > dst->size) ? src->size : dst->size);
-	base_size = ((src->size < dst->size) ? src->size : dst->size);
-	delta_size = max_size - base_size;
-
-	/* We would not consider edits that change the file size so
-	 * drastically.  delta_size must be smaller than
-	 * (MAX_SCORE-minimum_score)/MAX_SCORE * min(src->size, dst->size).
-	 *
-	 * Note that base_size == 0 case is handled here already
-	 * and the final score computation below would not have a
-	 * divide-by-zero issue.
-	 */
-	if (max_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE)
+	if (sizes_too_different(src, dst, minimum_score))
 		return 0;
 
 	dpf_opt->check_size_only = 0;
@@ -198,19 +233,7 @@ static int estimate_similarity(struct repository *r,
 	if (!dst->cnt_data && diff_populate_filespec(r, dst, dpf_opt))
 		return 0;
 
-	if (diffcore_count_changes(r, src, dst,
-				   &src->cnt_data, &dst->cnt_data,
-				   &src_copied, &literal_added))
-		return 0;
-
-	/* How similar are they?
-	 * what percentage of material in dst are from source?
-	 */
-	if (!dst->size)
-		score = 0; /* should not happen */
-	else
-		score = (int)(src_copied * MAX_SCORE / max_size);
-	return score;
+	return counted_similarity(r, src, dst);
 }
 
 static void record_rename_pair(int dst_index, int src_index, int score)
@@ -1078,6 +1101,484 @@ static void record_if_better(struct diff_score m[], struct diff_score *o)
 		m[worst] = *o;
 }
 
+/*
+ * Mostly randomly chosen: we want at least this many source/destination
+ * pairs per thread before it is worth starting one. The blobs are read
+ * in batches of about this many bytes per thread, to bound the memory
+ * they take.
+ */
+#define RENAME_THREAD_COST (50000)
+#define RENAME_READ_BATCH_SIZE (16 * 1024 * 1024)
+
+struct rename_matrix {
+	struct repository *repo;
+	int minimum_score;
+	int skip_unmodified;
+
+	/* filespecs to summarize with diffcore_count_prepare() */
+	struct diff_filespec **spec;
+	void **cnt;
+	int spec_nr;
+
+	/* the rename_dst index of each row of "mx" */
+	struct diff_score *mx;
+	int *row_dst;
+	int row_nr;
+
+	int next;
+	pthread_mutex_t mutex;
+	struct progress *progress;
+	uint64_t progress_nr;
+	int num_sources;
+};
+
+static void *count_thread(void *_data)
+{
+	struct rename_matrix *rm = _data;
+
+	for (;;) {
+		int k;
+
+		pthread_mutex_lock(&rm->mutex);
+		k = rm->next < rm->spec_nr ? rm->next++ : -1;
+		pthread_mutex_unlock(&rm->mutex);
+		if (k < 0)
+			return NULL;
+
+		rm->cnt[k] = diffcore_count_prepare(rm->repo, rm->spec[k]);
+	}
+}
+
+/*
+ * Like estimate_similarity(), for filespecs whose "cnt_data" has been
+ * computed beforehand; this does not need to read anything.
+ */
+static int estimate_counted_similarity(struct repository *r,
+				       struct diff_filespec *src,
+				       struct diff_filespec *dst,
+				       int minimum_score)
+{
+	if (!S_ISREG(src->mode) || !S_ISREG(dst->mode))
+		return 0;
+	/* we could not read it */
+	if (!src->cnt_data || !dst->cnt_data)
+		return 0;
+	if (sizes_too_different(src, dst, minimum_score))
+		return 0;
+	return counted_similarity(r, src, dst);
+}
+
+static void *matrix_thread(void *_data)
+{
+	struct rename_matrix *rm = _data;
+	int row = -1;
+
+	for (;;) {
+		struct diff_filespec *two;
+		struct diff_score *m;
+		int i, j;
+
+		pthread_mutex_lock(&rm->mutex);
+		if (row >= 0 && rm->progress) {
+			rm->progress_nr += rm->num_sources;
+			display_progress(rm->progress, rm->progress_nr);
+		}
+		row = rm->next < rm->row_nr ? rm->next++ : -1;
+		pthread_mutex_unlock(&rm->mutex);
+		if (row < 0)
+			return NULL;
+
+		i = rm->row_dst[row];
+		two = rename_dst[i].p->two;
+		m = &rm->mx[row * NUM_CANDIDATE_PER_DST];
+		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+			m[j].dst = -1;
+
+		for (j = 0; j < rename_src_nr; j++) {
+			struct diff_filespec *one = rename_src[j].p->one;
+			struct diff_score this_src;
+
+			if (rm->skip_unmodified &&
+			    diff_unmodified_pair(rename_src[j].p))
+				continue;
+
+			this_src.score = estimate_counted_similarity(rm->repo,
+								     one, two,
+								     rm->minimum_score);
+			this_src.name_score = basename_same(one, two);
+			this_src.dst = i;
+			this_src.src = j;
+			record_if_better(m, &this_src);
+		}
+	}
+}
+
+static void run_rename_threads(struct rename_matrix *rm,
+			       void *(*fn)(void *), int nr_threads)
+{
+	pthread_t *threads;
+	int i;
+
+	rm->next = 0;
+	CALLOC_ARRAY(threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		int err = pthread_create(&threads[i], NULL, fn, rm);
+		if (err)
+			die(_("unable to create rename detection thread: %s"),
+			    strerror(err));
+	}
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_join(threads[i], NULL))
+			die("unable to join rename detection thread");
+	free(threads);
+}
+
+static int rename_threads(struct repository *r,
+			  int num_destinations, int num_sources)
+{
+	uint64_t pairs = (uint64_t)num_destinations * (uint64_t)num_sources;
+	int nr_threads;
+
+	if (!HAVE_THREADS)
+		return 1;
+	if (repo_config_get_int(r, "diff.renamethreads", &nr_threads) ||
+	    nr_threads < 0)
+		nr_threads = 0;
+	if (!nr_threads) {
+		nr_threads = online_cpus();
+		if (pairs / RENAME_THREAD_COST < nr_threads)
+			nr_threads = pairs / RENAME_THREAD_COST;
+	}
+	return nr_threads;
+}
+
+static int spec_size_cmp(const void *a_, const void *b_)
+{
+	const struct diff_filespec *a = *(const struct diff_filespec **)a_;
+	const struct diff_filespec *b = *(const struct diff_filespec **)b_;
+
+	return a->size < b->size ? -1 : a->size > b->size;
+}
+
+/*
+ * Is there a filespec in "v" (sorted by size) whose size is not too
+ * different from that of "one" for them to be scored at all?
+ */
+static int has_size_partner(struct diff_filespec *one,
+			    struct diff_filespec **v, size_t nr,
+			    int minimum_score)
+{
+	size_t lo = 0, hi = nr;
+
+	/*
+	 * Find the smallest one that is not too much smaller than "one".
+	 * If it is too much larger, so are all the ones after it.
+	 */
+	while (lo < hi) {
+		size_t mi = lo + (hi - lo) / 2;
+
+		if ((uint64_t)v[mi]->size * MAX_SCORE <
+		    (uint64_t)one->size * minimum_score)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return lo < nr && !sizes_too_different(one, v[lo], minimum_score);
+}
+
+/*
+ * Append to "todo" those filespecs of "v" that have a size partner in
+ * "other" and are small enough to be read.
+ */
+static void add_readable(struct diff_filespec ***todo, size_t *todo_nr,
+			 size_t *todo_alloc,
+			 struct diff_filespec **v, size_t nr,
+			 struct diff_filespec **other, size_t other_nr,
+			 int minimum_score)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++) {
+		if (v[i]->cnt_data || v[i]->size > big_file_threshold ||
+		    !has_size_partner(v[i], other, other_nr, minimum_score))
+			continue;
+		ALLOC_GROW(*todo, *todo_nr + 1, *todo_alloc);
+		(*todo)[(*todo_nr)++] = v[i];
+	}
+}
+
+/*
+ * Fill "mx" with the best candidates for each destination, exactly like
+ * the single-threaded loop in diffcore_rename_extended() does, and
+ * return the number of rows.
+ *
+ * Reading the blobs may convert them, look up their attributes or fetch
+ * them from a promisor remote, none of which can be done from several
+ * threads, so that is done here. Summarizing their contents and
+ * comparing every destination with every source is spread over threads.
+ *
+ * Only the sizes are looked up first, and a blob is read only if some
+ * blob on the other side is close enough in size to be compared with
+ * it. Blobs larger than core.bigFileThreshold are not read at all, and
+ * are not considered for inexact renames.
+ */
+static int fill_matrix_in_parallel(struct diff_options *options,
+				   struct diff_score *mx,
+				   int minimum_score, int skip_unmodified,
+				   struct diff_populate_filespec_options *dpf_opt,
+				   struct progress *progress,
+				   int num_sources, int nr_threads)
+{
+	struct rename_matrix rm = {
+		.repo = options->repo,
+		.minimum_score = minimum_score,
+		.skip_unmodified = skip_unmodified,
+		.mx = mx,
+		.progress = progress,
+		.num_sources = num_sources,
+	};
+	struct diff_filespec **src = NULL, **dst = NULL, **todo = NULL;
+	size_t src_nr = 0, src_alloc = 0, dst_nr = 0, dst_alloc = 0;
+	size_t todo_nr = 0, todo_alloc = 0, spec_alloc = 0, k;
+	size_t batch = st_mult(nr_threads, RENAME_READ_BATCH_SIZE);
+	int i;
+
+	dpf_opt->check_size_only = 1;
+	for (i = 0; i < rename_src_nr; i++) {
+		struct diff_filespec *one = rename_src[i].p->one;
+
+		if (skip_unmodified && diff_unmodified_pair(rename_src[i].p))
+			continue;
+		if (!S_ISREG(one->mode) ||
+		    (!one->cnt_data &&
+		     diff_populate_filespec(options->repo, one, dpf_opt)))
+			continue;
+		diff_free_filespec_blob(one);
+		ALLOC_GROW(src, src_nr + 1, src_alloc);
+		src[src_nr++] = one;
+	}
+	ALLOC_ARRAY(rm.row_dst, rename_dst_nr);
+	for (i = 0; i < rename_dst_nr; i++) {
+		struct diff_filespec *two = rename_dst[i].p->two;
+
+		if (rename_dst[i].is_rename)
+			continue; /* exact or basename match already handled */
+		rm.row_dst[rm.row_nr++] = i;
+		if (!S_ISREG(two->mode) ||
+		    (!two->cnt_data &&
+		     diff_populate_filespec(options->repo, two, dpf_opt)))
+			continue;
+		diff_free_filespec_blob(two);
+		ALLOC_GROW(dst, dst_nr + 1, dst_alloc);
+		dst[dst_nr++] = two;
+	}
+	QSORT(src, src_nr, spec_size_cmp);
+	QSORT(dst, dst_nr, spec_size_cmp);
+	add_readable(&todo, &todo_nr, &todo_alloc, src, src_nr,
+		     dst, dst_nr, minimum_score);
+	add_readable(&todo, &todo_nr, &todo_alloc, dst, dst_nr,
+		     src, src_nr, minimum_score);
+	free(src);
+	free(dst);
+
+	pthread_mutex_init(&rm.mutex, NULL);
+	dpf_opt->check_size_only = 0;
+	for (k = 0; k < todo_nr; ) {
+		size_t bytes = 0;
+		int l;
+
+		for (rm.spec_nr = 0; k < todo_nr && bytes < batch; k++) {
+			struct diff_filespec *one = todo[k];
+
+			if (one->cnt_data ||
+			    diff_populate_filespec(options->repo, one, dpf_opt))
+				continue;
+			diff_filespec_is_binary(options->repo, one);
+			bytes += one->size;
+			ALLOC_GROW(rm.spec, rm.spec_nr + 1, spec_alloc);
+			rm.spec[rm.spec_nr++] = one;
+		}
+		REALLOC_ARRAY(rm.cnt, spec_alloc);
+		run_rename_threads(&rm, count_thread, nr_threads);
+		for (l = 0; l < rm.spec_nr; l++) {
+			struct diff_filespec *one = rm.spec[l];
+
+			/* the same filespec may be listed twice */
+			if (one->cnt_data)
+				free(rm.cnt[l]);
+			else
+				one->cnt_data = rm.cnt[l];
+			diff_free_filespec_blob(one);
+		}
+	}
+	free(rm.spec);
+	free(rm.cnt);
+	free(todo);
+
+	run_rename_threads(&rm, matrix_thread, nr_threads);
+	pthread_mutex_destroy(&rm.mutex);
+	free(rm.row_dst);
+	return rm.row_nr;
+}
+
+/*
+ * With diff.renameCache, the candidates found by inexact rename
+ * detection are remembered in a notes tree. They are keyed by a hash of
+ * everything that went into them: the paths, modes and blobs of all the
+ * sources and destinations, whether their attributes say they are
+ * binary, and the options that affect the scores. Running the same
+ * rename detection again (e.g. "git log -M" over the same history, or a
+ * rebase replaying the same renames) then does not need to read blobs.
+ */
+#define RENAME_CACHE_VALIDITY "rename candidates v1"
+
+static struct notes_cache *get_rename_cache(struct repository *r)
+{
+	static struct notes_cache *cache;
+	static int initialized;
+	int enabled;
+
+	if (r != the_repository)
+		return NULL;
+	if (!initialized) {
+		initialized = 1;
+		if (!repo_config_get_bool(r, "diff.renamecache", &enabled) &&
+		    enabled) {
+			cache = xmalloc(sizeof(*cache));
+			notes_cache_init(r, cache, "renames",
+					 RENAME_CACHE_VALIDITY);
+		}
+	}
+	return cache;
+}
+
+static void add_rename_cache_key(struct strbuf *key, struct repository *r,
+				 struct diff_filespec *one, int skip)
+{
+	struct userdiff_driver *driver = one->driver;
+
+	if (!driver && S_ISREG(one->mode))
+		driver = userdiff_find_by_path(r->index, one->path);
+	strbuf_addf(key, "%s %06o %d %d %s", oid_to_hex(&one->oid), one->mode,
+		    driver ? driver->binary : -1, skip, one->path);
+	strbuf_addch(key, '\0');
+}
+
+/*
+ * Returns -1 if the blobs are not all known (e.g. some come from the
+ * working tree), in which case the result cannot be cached.
+ */
+static int rename_cache_key(struct repository *r, struct object_id *oid,
+			    int minimum_score, int skip_unmodified)
+{
+	struct strbuf key = STRBUF_INIT;
+	git_hash_ctx ctx;
+	int i;
+
+	strbuf_addf(&key, "%d %d\n", minimum_score, skip_unmodified);
+	for (i = 0; i < rename_src_nr; i++) {
+		struct diff_filepair *p = rename_src[i].p;
+
+		if (!p->one->oid_valid)
+			goto fail;
+		add_rename_cache_key(&key, r, p->one,
+				     skip_unmodified && diff_unmodified_pair(p));
+	}
+	strbuf_addch(&key, '\n');
+	for (i = 0; i < rename_dst_nr; i++) {
+		struct diff_filespec *two = rename_dst[i].p->two;
+
+		if (!rename_dst[i].is_rename && !two->oid_valid)
+			goto fail;
+		add_rename_cache_key(&key, r, two, rename_dst[i].is_rename);
+	}
+
+	r->hash_algo->init_fn(&ctx);
+	r->hash_algo->update_fn(&ctx, key.buf, key.len);
+	r->hash_algo->final_oid_fn(oid, &ctx);
+	strbuf_release(&key);
+	return 0;
+
+fail:
+	strbuf_release(&key);
+	return -1;
+}
+
+/*
+ * Fill "mx" from the cache. Returns -1 if there is no (usable) entry,
+ * leaving "mx" in an unspecified state.
+ */
+static int read_rename_cache(struct notes_cache *cache, struct object_id *key,
+			     struct diff_score *mx, int dst_cnt)
+{
+	char *buf, *p;
+	size_t size;
+	int i, ret = -1;
+
+	buf = notes_cache_get(cache, key, &size);
+	if (!buf)
+		return -1;
+
+	p = buf;
+	for (i = 0; i < dst_cnt * NUM_CANDIDATE_PER_DST; i++) {
+		struct diff_score *m = &mx[i];
+		long dst, src, score, name_score;
+		char *end;
+
+		dst = strtol(p, &end, 10);
+		src = strtol(end, &end, 10);
+		score = strtol(end, &end, 10);
+		name_score = strtol(end, &end, 10);
+		if (*end != '\n')
+			goto out;
+		p = end + 1;
+
+		if (dst == -1) {
+			m->dst = -1;
+			continue;
+		}
+		if (dst < 0 || dst >= rename_dst_nr ||
+		    rename_dst[dst].is_rename ||
+		    src < 0 || src >= rename_src_nr ||
+		    score < 0 || score > MAX_SCORE ||
+		    name_score < 0 || name_score > 1)
+			goto out;
+		m->dst = dst;
+		m->src = src;
+		m->score = score;
+		m->name_score = name_score;
+	}
+	if (p == buf + size)
+		ret = 0;
+
+out:
+	free(buf);
+	return ret;
+}
+
+static void write_rename_cache(struct notes_cache *cache, struct object_id *key,
+			       struct diff_score *mx, int dst_cnt)
+{
+	struct strbuf buf = STRBUF_INIT;
+	int i;
+
+	/*
+	 * Writing the cache makes a commit; do not die for lack of an
+	 * identity in the middle of what may be a read-only command.
+	 */
+	git_committer_info(0);
+	if (!committer_ident_sufficiently_given())
+		return;
+
+	for (i = 0; i < dst_cnt * NUM_CANDIDATE_PER_DST; i++)
+		strbuf_addf(&buf, "%d %d %d %d\n", mx[i].dst, mx[i].src,
+			    mx[i].score, mx[i].name_score);
+	/* ignore errors, as we might be in a readonly repository */
+	notes_cache_put(cache, key, buf.buf, buf.len);
+	notes_cache_write(cache);
+	strbuf_release(&buf);
+}
+
 /*
  * Returns:
  * 0 if we are under the limit;
@@ -1392,7 +1893,9 @@ void diffcore_rename_extended(struct diff_options *options,
 	struct diff_score *mx;
 	int i, j, rename_count, skip_unmodified = 0;
 	int num_destinations, dst_cnt;
-	int num_sources, want_copies;
+	int num_sources, want_copies, nr_threads;
+	struct notes_cache *cache;
+	struct object_id cache_key;
 	struct progress *progress = NULL;
 	struct mem_pool local_pool;
 	struct dir_rename_info info;
@@ -1580,48 +2083,70 @@ void diffcore_rename_extended(struct diff_options *options,
 	}
 
 	CALLOC_ARRAY(mx, st_mult(NUM_CANDIDATE_PER_DST, num_destinations));
-	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
-		struct diff_filespec *two = rename_dst[i].p->two;
-		struct diff_score *m;
-
-		if (rename_dst[i].is_rename)
-			continue; /* exact or basename match already handled */
-
-		m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
-		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
-			m[j].dst = -1;
-
-		for (j = 0; j < rename_src_nr; j++) {
-			struct diff_filespec *one = rename_src[j].p->one;
-			struct diff_score this_src;
-
-			assert(!one->rename_used || want_copies || break_idx);
-
-			if (skip_unmodified &&
-			    diff_unmodified_pair(rename_src[j].p))
-				continue;
-
-			this_src.score = estimate_similarity(options->repo,
-							     one, two,
-							     minimum_score,
-							     &dpf_options);
-			this_src.name_score = basename_same(one, two);
-			this_src.dst = i;
-			this_src.src = j;
-			record_if_better(m, &this_src);
-			/*
-			 * Once we run estimate_similarity,
-			 * We do not need the text anymore.
-			 */
-			diff_free_filespec_blob(one);
-			diff_free_filespec_blob(two);
+	cache = get_rename_cache(options->repo);
+	if (cache && rename_cache_key(options->repo, &cache_key,
+				      minimum_score, skip_unmodified))
+		cache = NULL;
+	nr_threads = rename_threads(options->repo, num_destinations, num_sources);
+	if (cache && !read_rename_cache(cache, &cache_key, mx, num_destinations)) {
+		trace2_data_intmax("diff", options->repo,
+				   "inexact renames/cached", num_destinations);
+		dst_cnt = num_destinations;
+		cache = NULL;
+	} else if (nr_threads > 1) {
+		trace2_data_intmax("diff", options->repo,
+				   "inexact renames/threads", nr_threads);
+		dst_cnt = fill_matrix_in_parallel(options, mx, minimum_score,
+						  skip_unmodified, &dpf_options,
+						  progress, num_sources,
+						  nr_threads);
+	} else {
+		for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
+			struct diff_filespec *two = rename_dst[i].p->two;
+			struct diff_score *m;
+
+			if (rename_dst[i].is_rename)
+				continue; /* exact or basename match already handled */
+
+			m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
+			for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+				m[j].dst = -1;
+
+			for (j = 0; j < rename_src_nr; j++) {
+				struct diff_filespec *one = rename_src[j].p->one;
+				struct diff_score this_src;
+
+				assert(!one->rename_used || want_copies || break_idx);
+
+				if (skip_unmodified &&
+				    diff_unmodified_pair(rename_src[j].p))
+					continue;
+
+				this_src.score = estimate_similarity(options->repo,
+								     one, two,
+								     minimum_score,
+								     &dpf_options);
+				this_src.name_score = basename_same(one, two);
+				this_src.dst = i;
+				this_src.src = j;
+				record_if_better(m, &this_src);
+				/*
+				 * Once we run estimate_similarity,
+				 * We do not need the text anymore.
+				 */
+				diff_free_filespec_blob(one);
+				diff_free_filespec_blob(two);
+			}
+			dst_cnt++;
+			display_progress(progress,
+					 (uint64_t)dst_cnt * (uint64_t)num_sources);
 		}
-		dst_cnt++;
-		display_progress(progress,
-				 (uint64_t)dst_cnt * (uint64_t)num_sources);
 	}
 	stop_progress(&progress);
 
+	if (cache)
+		write_rename_cache(cache, &cache_key, mx, dst_cnt);
+
 	/* cost matrix sorted by most to least similar pair */
 	STABLE_QSORT(mx, dst_cnt * NUM_CANDIDATE_PER_DST, score_compare);
 
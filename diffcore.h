@@ -219,6 +219,17 @@ void diff_debug_queue(const char *, struct diff_queue_struct *);
 #define diff_debug_queue(a,b) do { /* nothing */ } while (0)
 #endif
 
+/*
+ * Summarize the contents of "one", which must already be populated, the
+ * way diffcore_count_changes() needs them. The result can be given to it
+ * through "src_count_p" or "dst_count_p" (e.g. by storing it in
+ * one->cnt_data) to avoid looking at the data again. Apart from
+ * diff_filespec_is_binary(), which the caller can call beforehand, this
+ * only looks at "one" and is safe to call from several threads.
+ */
+void *diffcore_count_prepare(struct repository *r,
+			     struct diff_filespec *one);
+
 int diffcore_count_changes(struct repository *r,
 			   struct diff_filespec *src,
 			   struct diff_filespec *dst,
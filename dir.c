@@ -22,6 +22,7 @@
 #include "refs.h"
 #include "wildmatch.h"
 #include "pathspec.h"
+#include "preload-index.h"
 #include "utf8.h"
 #include "varint.h"
 #include "ewah/ewok.h"
@@ -926,6 +927,170 @@ int hashmap_contains_parent(struct hashmap *map,
 	return 0;
 }
 
+/*
+ * Matching a path against a long list of patterns one by one is slow,
+ * but most lines of large ignore files are either plain names
+ * ("foo", "/dir/file") or "*suffix". Those can be looked up in hash
+ * tables by the basename, the path relative to the list's base and
+ * the ends of the basename, respectively, leaving only the remaining
+ * patterns to be tried in order.
+ */
+#define PATTERN_LOOKUP_MIN_PATTERNS 32
+
+struct pattern_lookup_entry {
+	struct hashmap_entry ent;
+	const char *key;
+	size_t len;
+	/* indices into pl->patterns, in increasing order */
+	int *idx;
+	int nr, alloc;
+};
+
+struct pattern_lookup {
+	struct hashmap basenames;
+	struct hashmap pathnames;
+	struct hashmap suffixes;
+
+	/* the distinct lengths of the keys in "suffixes" */
+	int *suffix_len;
+	int suffix_len_nr, suffix_len_alloc;
+
+	/* indices of all other patterns, in increasing order */
+	int *rest;
+	int rest_nr, rest_alloc;
+};
+
+static unsigned int pattern_lookup_hash(const char *key, size_t len)
+{
+	return ignore_case ? memihash(key, len) : memhash(key, len);
+}
+
+static int pattern_lookup_entry_cmp(const void *cmp_data UNUSED,
+				    const struct hashmap_entry *eptr,
+				    const struct hashmap_entry *entry_or_key,
+				    const void *keydata UNUSED)
+{
+	const struct pattern_lookup_entry *a, *b;
+
+	a = container_of(eptr, const struct pattern_lookup_entry, ent);
+	b = container_of(entry_or_key, const struct pattern_lookup_entry, ent);
+	return a->len != b->len || fspathncmp(a->key, b->key, a->len);
+}
+
+static struct pattern_lookup_entry *pattern_lookup_get(struct hashmap *map,
+						       const char *key,
+						       size_t len)
+{
+	struct pattern_lookup_entry k;
+
+	hashmap_entry_init(&k.ent, pattern_lookup_hash(key, len));
+	k.key = key;
+	k.len = len;
+	return hashmap_get_entry(map, &k, ent, NULL);
+}
+
+static int pattern_lookup_add(struct hashmap *map, const char *key,
+			      size_t len, int i)
+{
+	struct pattern_lookup_entry *e = pattern_lookup_get(map, key, len);
+	int is_new = !e;
+
+	if (is_new) {
+		CALLOC_ARRAY(e, 1);
+		hashmap_entry_init(&e->ent, pattern_lookup_hash(key, len));
+		e->key = key;
+		e->len = len;
+		hashmap_add(map, &e->ent);
+	}
+	ALLOC_GROW(e->idx, e->nr + 1, e->alloc);
+	e->idx[e->nr++] = i;
+	return is_new;
+}
+
+static void free_pattern_lookup_map(struct hashmap *map)
+{
+	struct hashmap_iter iter;
+	struct pattern_lookup_entry *e;
+
+	hashmap_for_each_entry(map, &iter, e, ent)
+		free(e->idx);
+	hashmap_clear_and_free(map, struct pattern_lookup_entry, ent);
+}
+
+static void clear_pattern_lookup(struct pattern_list *pl)
+{
+	struct pattern_lookup *lookup = pl->lookup;
+
+	if (!lookup)
+		return;
+	free_pattern_lookup_map(&lookup->basenames);
+	free_pattern_lookup_map(&lookup->pathnames);
+	free_pattern_lookup_map(&lookup->suffixes);
+	free(lookup->suffix_len);
+	free(lookup->rest);
+	FREE_AND_NULL(pl->lookup);
+}
+
+static void build_pattern_lookup(struct pattern_list *pl)
+{
+	struct pattern_lookup *lookup;
+	const char *base = pl->patterns[0]->base;
+	int baselen = pl->patterns[0]->baselen;
+	int i, j;
+
+	CALLOC_ARRAY(lookup, 1);
+	hashmap_init(&lookup->basenames, pattern_lookup_entry_cmp, NULL, 0);
+	hashmap_init(&lookup->pathnames, pattern_lookup_entry_cmp, NULL, 0);
+	hashmap_init(&lookup->suffixes, pattern_lookup_entry_cmp, NULL, 0);
+
+	for (i = 0; i < pl->nr; i++) {
+		struct path_pattern *pattern = pl->patterns[i];
+		const char *p = pattern->pattern;
+		int len = pattern->patternlen;
+
+		if (pattern->flags & PATTERN_FLAG_NODIR) {
+			if (pattern->nowildcardlen == len) {
+				pattern_lookup_add(&lookup->basenames, p, len, i);
+				continue;
+			}
+			if ((pattern->flags & PATTERN_FLAG_ENDSWITH) &&
+			    len > 1) {
+				if (!pattern_lookup_add(&lookup->suffixes,
+							p + 1, len - 1, i))
+					continue;
+				for (j = 0; j < lookup->suffix_len_nr; j++)
+					if (lookup->suffix_len[j] == len - 1)
+						break;
+				if (j == lookup->suffix_len_nr) {
+					ALLOC_GROW(lookup->suffix_len,
+						   lookup->suffix_len_nr + 1,
+						   lookup->suffix_len_alloc);
+					lookup->suffix_len[lookup->suffix_len_nr++] = len - 1;
+				}
+				continue;
+			}
+		} else if (pattern->nowildcardlen == len &&
+			   pattern->baselen == baselen &&
+			   (pattern->base == base ||
+			    !fspathncmp(pattern->base, base, baselen))) {
+			/* see match_pathname() */
+			if (*p == '/') {
+				p++;
+				len--;
+			}
+			if (len) {
+				pattern_lookup_add(&lookup->pathnames, p, len, i);
+				continue;
+			}
+		}
+
+		ALLOC_GROW(lookup->rest, lookup->rest_nr + 1, lookup->rest_alloc);
+		lookup->rest[lookup->rest_nr++] = i;
+	}
+
+	pl->lookup = lookup;
+}
+
 void add_pattern(const char *string, const char *base,
 		 int baselen, struct pattern_list *pl, int srcpos)
 {
@@ -945,6 +1110,7 @@ void add_pattern(const char *string, const char *base,
 	ALLOC_GROW(pl->patterns, pl->nr + 1, pl->alloc);
 	pl->patterns[pl->nr++] = pattern;
 	pattern->pl = pl;
+	clear_pattern_lookup(pl);
 
 	add_pattern_to_hashsets(pl, pattern);
 }
@@ -979,6 +1145,7 @@ void clear_pattern_list(struct pattern_list *pl)
 	free(pl->patterns);
 	clear_pattern_entry_hashmap(&pl->recursive_hashmap);
 	clear_pattern_entry_hashmap(&pl->parent_hashmap);
+	clear_pattern_lookup(pl);
 
 	memset(pl, 0, sizeof(*pl));
 }
@@ -1364,6 +1531,97 @@ int match_pathname(const char *pathname, int pathlen,
 				 WM_PATHNAME) == 0;
 }
 
+static int pattern_matches(struct path_pattern *pattern,
+			   const char *pathname, int pathlen,
+			   const char *basename, int *dtype,
+			   struct index_state *istate)
+{
+	const char *exclude = pattern->pattern;
+	int prefix = pattern->nowildcardlen;
+
+	if (pattern->flags & PATTERN_FLAG_MUSTBEDIR) {
+		*dtype = resolve_dtype(*dtype, istate, pathname, pathlen);
+		if (*dtype != DT_DIR)
+			return 0;
+	}
+
+	if (pattern->flags & PATTERN_FLAG_NODIR)
+		return match_basename(basename,
+				      pathlen - (basename - pathname),
+				      exclude, prefix, pattern->patternlen,
+				      pattern->flags);
+
+	assert(pattern->baselen == 0 ||
+	       pattern->base[pattern->baselen - 1] == '/');
+	return match_pathname(pathname, pathlen,
+			      pattern->base,
+			      pattern->baselen ? pattern->baselen - 1 : 0,
+			      exclude, prefix, pattern->patternlen);
+}
+
+/*
+ * Return the highest index in "e" of a pattern matching the path that
+ * is above "best", or "best" if there is none.
+ */
+static int last_matching_pattern_from_entry(struct pattern_lookup_entry *e,
+					    int best, struct pattern_list *pl,
+					    const char *pathname, int pathlen,
+					    const char *basename, int *dtype,
+					    struct index_state *istate)
+{
+	int i;
+
+	if (!e)
+		return best;
+	for (i = e->nr - 1; 0 <= i && best < e->idx[i]; i--)
+		if (pattern_matches(pl->patterns[e->idx[i]], pathname, pathlen,
+				    basename, dtype, istate))
+			return e->idx[i];
+	return best;
+}
+
+static struct path_pattern *last_matching_pattern_from_lookup(const char *pathname,
+							      int pathlen,
+							      const char *basename,
+							      int *dtype,
+							      struct pattern_list *pl,
+							      struct index_state *istate)
+{
+	struct pattern_lookup *lookup = pl->lookup;
+	int basenamelen = pathlen - (basename - pathname);
+	const char *base = pl->patterns[0]->base;
+	int baselen = pl->patterns[0]->baselen;
+	int best = -1, i;
+
+	best = last_matching_pattern_from_entry(
+		pattern_lookup_get(&lookup->basenames, basename, basenamelen),
+		best, pl, pathname, pathlen, basename, dtype, istate);
+
+	for (i = 0; i < lookup->suffix_len_nr; i++) {
+		int len = lookup->suffix_len[i];
+
+		if (len > basenamelen)
+			continue;
+		best = last_matching_pattern_from_entry(
+			pattern_lookup_get(&lookup->suffixes,
+					   basename + basenamelen - len, len),
+			best, pl, pathname, pathlen, basename, dtype, istate);
+	}
+
+	if (pathlen > baselen && !fspathncmp(pathname, base, baselen))
+		best = last_matching_pattern_from_entry(
+			pattern_lookup_get(&lookup->pathnames, pathname + baselen,
+					   pathlen - baselen),
+			best, pl, pathname, pathlen, basename, dtype, istate);
+
+	for (i = lookup->rest_nr - 1; 0 <= i && best < lookup->rest[i]; i--)
+		if (pattern_matches(pl->patterns[lookup->rest[i]],
+				    pathname, pathlen, basename, dtype, istate))
+			return pl->patterns[lookup->rest[i]];
+
+	return best < 0 ? NULL : pl->patterns[best];
+}
+
 /*
  * Scan the given exclude list in reverse to see whether pathname
  * should be ignored.  The first match (i.e. the last on the list), if
@@ -1377,45 +1635,23 @@ static struct path_pattern *last_matching_pattern_from_list(const char *pathname
 						       struct pattern_list *pl,
 						       struct index_state *istate)
 {
-	struct path_pattern *res = NULL; /* undecided */
 	int i;
 
 	if (!pl->nr)
 		return NULL;	/* undefined */
 
-	for (i = pl->nr - 1; 0 <= i; i--) {
-		struct path_pattern *pattern = pl->patterns[i];
-		const char *exclude = pattern->pattern;
-		int prefix = pattern->nowildcardlen;
-
-		if (pattern->flags & PATTERN_FLAG_MUSTBEDIR) {
-			*dtype = resolve_dtype(*dtype, istate, pathname, pathlen);
-			if (*dtype != DT_DIR)
-				continue;
-		}
-
-		if (pattern->flags & PATTERN_FLAG_NODIR) {
-			if (match_basename(basename,
-					   pathlen - (basename - pathname),
-					   exclude, prefix, pattern->patternlen,
-					   pattern->flags)) {
-				res = pattern;
-				break;
-			}
-			continue;
-		}
-
-		assert(pattern->baselen == 0 ||
-		       pattern->base[pattern->baselen - 1] == '/');
-		if (match_pathname(pathname, pathlen,
-				   pattern->base,
-				   pattern->baselen ? pattern->baselen - 1 : 0,
-				   exclude, prefix, pattern->patternlen)) {
-			res = pattern;
-			break;
-		}
-	}
-	return res;
+	if (!pl->lookup && pl->nr >= PATTERN_LOOKUP_MIN_PATTERNS)
+		build_pattern_lookup(pl);
+	if (pl->lookup)
+		return last_matching_pattern_from_lookup(pathname, pathlen,
+							 basename, dtype,
+							 pl, istate);
+
+	for (i = pl->nr - 1; 0 <= i; i--)
+		if (pattern_matches(pl->patterns[i], pathname, pathlen,
+				    basename, dtype, istate))
+			return pl->patterns[i];
+	return NULL;
 }
 
 /*
@@ -3086,6 +3322,7 @@ int read_directory(struct dir_struct *dir, struct index_state *istate,
 		   const char *path, int len, const struct pathspec *pathspec)
 {
 	struct untracked_cache_dir *untracked;
+	struct preload_dirs *preload = NULL;
 
 	trace2_region_enter("dir", "read_directory", istate->repo);
 	dir->internal.visited_paths = 0;
@@ -3097,14 +3334,22 @@ int read_directory(struct dir_struct *dir, struct index_state *istate,
 	}
 
 	untracked = validate_untracked_cache(dir, len, pathspec, istate);
-	if (!untracked)
+	if (!untracked) {
 		/*
 		 * make sure untracked cache code path is disabled,
 		 * e.g. prep_exclude()
 		 */
 		dir->untracked = NULL;
+
+		/*
+		 * We are going to read every directory; the untracked
+		 * cache would let us skip most of them instead.
+		 */
+		preload = start_preload_tracked_directories(istate, path, len);
+	}
 	if (!len || treat_leading_path(dir, istate, path, len, pathspec))
 		read_directory_recursive(dir, istate, path, len, untracked, 0, 0, pathspec);
+	finish_preload_tracked_directories(preload);
 	QSORT(dir->entries, dir->nr, cmp_dir_entry);
 	QSORT(dir->ignored, dir->ignored_nr, cmp_dir_entry);
 
@@ -119,6 +119,12 @@ struct pattern_list {
 	 * Used to check single-level parents of blobs.
 	 */
 	struct hashmap parent_hashmap;
+
+	/*
+	 * Hash tables of the patterns that are plain strings or
+	 * "*suffix", built when a long list is first matched against.
+	 */
+	struct pattern_lookup *lookup;
 };
 
 /*
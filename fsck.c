@@ -1361,6 +1361,10 @@ int git_fsck_config(const char *var, const char *value,
 		return 0;
 	}
 
+	/* read by git-fsck itself, not a message type */
+	if (!strcmp(var, "fsck.threads"))
+		return 0;
+
 	if (skip_prefix(var, "fsck.", &msg_id)) {
 		if (!value)
 			return config_error_nonbool(var);
@@ -104,28 +104,60 @@ int oid_pos(const struct object_id *oid, const void *table, size_t nr,
 	return index_pos_to_insert_pos(lo);
 }
 
+/*
+ * Object names are uniformly distributed, so within the range given by
+ * the fanout table the position of a name is roughly proportional to
+ * the value of its next bytes.  The first few probes of bsearch_hash()
+ * interpolate on those (as a 32-bit number) between the names known to
+ * bound the target, which on real tables lands next to it in a few
+ * probes instead of the log2(n) a bisection needs, each of which is
+ * likely a cache miss.  If the names turn out not to be that evenly
+ * spread, we fall back to bisecting after INTERPOLATION_PROBES probes.
+ */
+#define INTERPOLATION_PROBES 4
+
+static inline uint32_t hash_key(const unsigned char *hash)
+{
+	return get_be32(hash + 1);
+}
+
 int bsearch_hash(const unsigned char *hash, const uint32_t *fanout_nbo,
 		 const unsigned char *table, size_t stride, uint32_t *result)
 {
 	uint32_t hi, lo;
+	/* all names in [lo, hi) have keys in [lov, hiv] */
+	uint64_t lov = 0, hiv = UINT32_MAX, key = hash_key(hash);
+	int probes = 0;
 
 	hi = ntohl(fanout_nbo[*hash]);
 	lo = ((*hash == 0x0) ? 0 : ntohl(fanout_nbo[*hash - 1]));
 
 	while (lo < hi) {
-		unsigned mi = lo + (hi - lo) / 2;
-		int cmp = hashcmp(table + mi * stride, hash,
-				  the_repository->hash_algo);
+		unsigned mi;
+		const unsigned char *at;
+		int cmp;
+
+		if (probes < INTERPOLATION_PROBES && lov <= key && key <= hiv) {
+			mi = lo + (hi - lo) * (key - lov) / (hiv - lov + 1);
+			probes++;
+		} else {
+			mi = lo + (hi - lo) / 2;
+		}
+		at = table + mi * stride;
+		cmp = hashcmp(at, hash, the_repository->hash_algo);
 
 		if (!cmp) {
 			if (result)
 				*result = mi;
 			return 1;
 		}
-		if (cmp > 0)
+		if (cmp > 0) {
 			hi = mi;
-		else
+			hiv = hash_key(at);
+		} else {
 			lo = mi + 1;
+			lov = hash_key(at);
+		}
 	}
 
 	if (result)
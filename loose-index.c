@@ -0,0 +1,408 @@
+#define USE_THE_REPOSITORY_VARIABLE
+
+#include "git-compat-util.h"
+#include "gettext.h"
+#include "hash-lookup.h"
+#include "lockfile.h"
+#include "loose-index.h"
+#include "object-file.h"
+#include "object-store-ll.h"
+#include "oid-array.h"
+#include "path.h"
+#include "repository.h"
+#include "strbuf.h"
+#include "trace2.h"
+#include "wrapper.h"
+#include "write-or-die.h"
+
+#define LOOSE_INDEX_SIGNATURE 0x4c4f4958 /* "LOIX" */
+#define LOOSE_INDEX_VERSION 1
+#define LOOSE_INDEX_HEADER_SIZE 16
+#define LOOSE_INDEX_FANOUT_SIZE (256 * 4)
+
+/*
+ * Rebuild the index once this many names have been appended to it,
+ * which keeps the cost of loading the unsorted part proportional to
+ * that of the sorted table.
+ */
+#define LOOSE_INDEX_MAX_APPENDED(nr) ((nr) / 4 + 1024)
+
+static void loose_index_path(struct strbuf *buf, struct object_directory *odb)
+{
+	strbuf_addf(buf, "%s/info/loose-index", odb->path);
+}
+
+static void free_loose_index(struct loose_index *li)
+{
+	if (!li)
+		return;
+	munmap((void *)li->data, li->data_len);
+	oidtree_clear(&li->appended);
+	free(li);
+}
+
+static struct loose_index *load_loose_index(struct object_directory *odb,
+					    const struct git_hash_algo *algo)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct loose_index *li = NULL;
+	const unsigned char *data;
+	size_t len, sorted_end, rawsz = algo->rawsz;
+	uint32_t nr, prev = 0, i;
+	struct stat st;
+	int fd;
+
+	loose_index_path(&path, odb);
+	fd = git_open(path.buf);
+	if (fd < 0)
+		goto out;
+	if (fstat(fd, &st)) {
+		close(fd);
+		goto out;
+	}
+	len = xsize_t(st.st_size);
+	if (len < LOOSE_INDEX_HEADER_SIZE + LOOSE_INDEX_FANOUT_SIZE) {
+		close(fd);
+		warning(_("ignoring invalid loose object index '%s'"), path.buf);
+		goto out;
+	}
+	data = xmmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (get_be32(data) != LOOSE_INDEX_SIGNATURE ||
+	    get_be32(data + 4) != LOOSE_INDEX_VERSION ||
+	    get_be32(data + 8) != algo->format_id)
+		goto bad;
+
+	nr = get_be32(data + 12);
+	if (nr > (len - LOOSE_INDEX_HEADER_SIZE - LOOSE_INDEX_FANOUT_SIZE) / rawsz)
+		goto bad;
+	for (i = 0; i < 256; i++) {
+		uint32_t n = get_be32(data + LOOSE_INDEX_HEADER_SIZE + i * 4);
+		if (n < prev)
+			goto bad;
+		prev = n;
+	}
+	if (prev != nr)
+		goto bad;
+
+	CALLOC_ARRAY(li, 1);
+	li->data = data;
+	li->data_len = len;
+	li->fanout = data + LOOSE_INDEX_HEADER_SIZE;
+	li->lookup = li->fanout + LOOSE_INDEX_FANOUT_SIZE;
+	li->nr_sorted = nr;
+
+	sorted_end = LOOSE_INDEX_HEADER_SIZE + LOOSE_INDEX_FANOUT_SIZE + nr * rawsz;
+	li->nr_appended = (len - sorted_end) / rawsz;
+	oidtree_init(&li->appended);
+	for (i = 0; i < li->nr_appended; i++) {
+		struct object_id oid;
+
+		oidread(&oid, data + sorted_end + i * rawsz, algo);
+		oidtree_insert(&li->appended, &oid);
+	}
+	goto out;
+
+bad:
+	warning(_("ignoring invalid loose object index '%s'"), path.buf);
+	munmap((void *)data, len);
+out:
+	strbuf_release(&path);
+	return li;
+}
+
+struct subdir_stat {
+	int exists;
+	timestamp_t sec;
+	unsigned int nsec;
+};
+
+static void stat_subdir(struct strbuf *path, unsigned int subdir_nr,
+			struct subdir_stat *out)
+{
+	size_t origlen = path->len;
+	struct stat st;
+
+	strbuf_addf(path, "/%02x", subdir_nr);
+	memset(out, 0, sizeof(*out));
+	if (!stat(path->buf, &st)) {
+		out->exists = 1;
+		out->sec = st.st_mtime;
+		out->nsec = ST_MTIME_NSEC(st);
+	}
+	strbuf_setlen(path, origlen);
+}
+
+static int collect_loose_oid(const struct object_id *oid,
+			     const char *path UNUSED,
+			     void *data)
+{
+	oid_array_append(data, oid);
+	return 0;
+}
+
+static int write_loose_index(struct repository *r,
+			     struct object_directory *odb)
+{
+	const struct git_hash_algo *algo = r->hash_algo;
+	struct lock_file lk = LOCK_INIT;
+	struct strbuf path = STRBUF_INIT, buf = STRBUF_INIT;
+	struct oid_array oids = OID_ARRAY_INIT;
+	struct subdir_stat before[256];
+	uint32_t fanout[256];
+	unsigned char hdr[LOOSE_INDEX_HEADER_SIZE];
+	time_t start = time(NULL);
+	size_t i, nr = 0;
+	int fd, ret = -1;
+
+	loose_index_path(&path, odb);
+	fd = hold_lock_file_for_update(&lk, path.buf, 0);
+	if (fd < 0)
+		goto out;
+
+	trace2_region_enter("loose-index", "write", r);
+
+	strbuf_addstr(&buf, odb->path);
+	for (i = 0; i < 256; i++) {
+		stat_subdir(&buf, i, &before[i]);
+		if (for_each_file_in_obj_subdir(i, &buf, collect_loose_oid,
+						NULL, NULL, &oids))
+			goto out;
+	}
+
+	oid_array_sort(&oids);
+	memset(fanout, 0, sizeof(fanout));
+	for (i = 0; i < oids.nr; i++) {
+		if (i && oideq(&oids.oid[i - 1], &oids.oid[i]))
+			continue;
+		fanout[oids.oid[i].hash[0]]++;
+		nr++;
+	}
+	for (i = 1; i < 256; i++)
+		fanout[i] += fanout[i - 1];
+
+	put_be32(hdr, LOOSE_INDEX_SIGNATURE);
+	put_be32(hdr + 4, LOOSE_INDEX_VERSION);
+	put_be32(hdr + 8, algo->format_id);
+	put_be32(hdr + 12, nr);
+	strbuf_reset(&buf);
+	strbuf_add(&buf, hdr, sizeof(hdr));
+	for (i = 0; i < 256; i++) {
+		unsigned char be[4];
+
+		put_be32(be, fanout[i]);
+		strbuf_add(&buf, be, sizeof(be));
+	}
+	for (i = 0; i < oids.nr; i++) {
+		if (i && oideq(&oids.oid[i - 1], &oids.oid[i]))
+			continue;
+		strbuf_add(&buf, oids.oid[i].hash, algo->rawsz);
+	}
+
+	if (write_in_full(fd, buf.buf, buf.len) < 0) {
+		error_errno(_("unable to write loose object index '%s'"),
+			    path.buf);
+		goto out;
+	}
+	fsync_component_or_die(FSYNC_COMPONENT_LOOSE_OBJECT, fd,
+			       get_lock_file_path(&lk));
+	if (adjust_shared_perm(get_lock_file_path(&lk)) ||
+	    commit_lock_file(&lk)) {
+		error_errno(_("unable to write loose object index '%s'"),
+			    path.buf);
+		goto out;
+	}
+
+	/*
+	 * Objects written while we were scanning did not find an index to
+	 * append to. Their fan-out directories have changed since we looked
+	 * at them (or changed too recently to tell), so look again and add
+	 * whatever we missed; anything written from now on finds the index.
+	 */
+	strbuf_reset(&buf);
+	strbuf_addstr(&buf, odb->path);
+	for (i = 0; i < 256; i++) {
+		struct oid_array late = OID_ARRAY_INIT;
+		struct subdir_stat after;
+		size_t j;
+
+		stat_subdir(&buf, i, &after);
+		if (!after.exists ||
+		    (before[i].exists &&
+		     before[i].sec == after.sec &&
+		     before[i].nsec == after.nsec &&
+		     after.sec < start))
+			continue;
+
+		for_each_file_in_obj_subdir(i, &buf, collect_loose_oid,
+					    NULL, NULL, &late);
+		for (j = 0; j < late.nr; j++)
+			if (oid_array_lookup(&oids, &late.oid[j]) < 0)
+				loose_index_append(odb, &late.oid[j]);
+		oid_array_clear(&late);
+	}
+
+	trace2_data_intmax("loose-index", r, "objects", nr);
+	ret = 0;
+
+out:
+	if (fd >= 0)
+		trace2_region_leave("loose-index", "write", r);
+	rollback_lock_file(&lk);
+	oid_array_clear(&oids);
+	strbuf_release(&buf);
+	strbuf_release(&path);
+	return ret;
+}
+
+struct loose_index *odb_loose_index(struct repository *r,
+				    struct object_directory *odb)
+{
+	struct loose_index *li;
+
+	if (odb->loose_index_loaded)
+		return odb->loose_index;
+	odb->loose_index_loaded = 1;
+
+	/*
+	 * The loose object cache also knows the compatibility names of
+	 * loose objects, which the index does not record.
+	 */
+	prepare_repo_settings(r);
+	if (!r->settings.core_loose_object_index || r->compat_hash_algo)
+		return NULL;
+
+	li = load_loose_index(odb, r->hash_algo);
+
+	/*
+	 * Only (re)write the index of our own object directory, and not
+	 * that of a quarantine whose objects are about to be migrated.
+	 */
+	if ((!li || li->nr_appended > LOOSE_INDEX_MAX_APPENDED(li->nr_sorted)) &&
+	    odb == r->objects->odb && !odb->disable_ref_updates &&
+	    !write_loose_index(r, odb)) {
+		free_loose_index(li);
+		li = load_loose_index(odb, r->hash_algo);
+	}
+
+	odb->loose_index = li;
+	return li;
+}
+
+int loose_index_contains(struct loose_index *li, const struct object_id *oid)
+{
+	uint32_t pos;
+
+	return bsearch_hash(oid->hash, (const uint32_t *)li->fanout,
+			    li->lookup, the_hash_algo->rawsz, &pos) ||
+	       oidtree_contains(&li->appended, oid);
+}
+
+static int match_prefix(const unsigned char *hash, const unsigned char *prefix,
+			size_t len)
+{
+	size_t bytes = len / 2;
+
+	if (memcmp(hash, prefix, bytes))
+		return 0;
+	return !(len & 1) || (hash[bytes] & 0xf0) == (prefix[bytes] & 0xf0);
+}
+
+void loose_index_each(struct loose_index *li, const struct object_id *prefix,
+		      size_t len, oidtree_iter cb, void *data)
+{
+	const size_t rawsz = the_hash_algo->rawsz;
+	unsigned char start[GIT_MAX_RAWSZ];
+	uint32_t pos;
+
+	/* find the first name at or after the prefix padded with zeroes */
+	memset(start, 0, sizeof(start));
+	memcpy(start, prefix->hash, len / 2);
+	if (len & 1)
+		start[len / 2] = prefix->hash[len / 2] & 0xf0;
+	bsearch_hash(start, (const uint32_t *)li->fanout, li->lookup,
+		     rawsz, &pos);
+
+	for (; pos < li->nr_sorted; pos++) {
+		const unsigned char *hash = li->lookup + (size_t)pos * rawsz;
+		struct object_id oid;
+
+		if (!match_prefix(hash, start, len))
+			break;
+		oidread(&oid, hash, the_hash_algo);
+		if (cb(&oid, data) != CB_CONTINUE)
+			return;
+	}
+
+	oidtree_each(&li->appended, prefix, len, cb, data);
+}
+
+int loose_index_maintained(struct object_directory *odb)
+{
+	struct strbuf path = STRBUF_INIT;
+
+	prepare_repo_settings(the_repository);
+	if (the_repository->settings.core_loose_object_index)
+		return 1;
+
+	if (!odb->loose_index_unmaintained_checked) {
+		odb->loose_index_unmaintained_checked = 1;
+		loose_index_path(&path, odb);
+		if (unlink(path.buf) && errno != ENOENT)
+			warning_errno(_("unable to unlink '%s'"), path.buf);
+		strbuf_release(&path);
+	}
+	return 0;
+}
+
+void loose_index_append(struct object_directory *odb,
+			const struct object_id *oid)
+{
+	struct strbuf path = STRBUF_INIT;
+	int fd;
+
+	if (!loose_index_maintained(odb))
+		return;
+
+	loose_index_path(&path, odb);
+	fd = open(path.buf, O_WRONLY | O_APPEND);
+	if (fd >= 0) {
+		struct stat st;
+
+		/*
+		 * A local clone may have hard-linked the index along with
+		 * the objects, and what we append must not show up in the
+		 * other repository. A short write would misalign every name
+		 * appended after it. In either case, give up on our index.
+		 */
+		if (fstat(fd, &st) || st.st_nlink > 1 ||
+		    write_in_full(fd, oid->hash, the_hash_algo->rawsz) < 0)
+			unlink_or_warn(path.buf);
+		close(fd);
+	}
+	strbuf_release(&path);
+}
+
+void loose_index_invalidate(struct object_directory *odb)
+{
+	struct strbuf path = STRBUF_INIT;
+
+	loose_index_path(&path, odb);
+	unlink_or_warn(path.buf);
+	strbuf_release(&path);
+
+	/*
+	 * Do not let this process write a new index either, since it is
+	 * presumably about to remove more objects.
+	 */
+	close_loose_index(odb);
+	odb->loose_index_loaded = 1;
+}
+
+void close_loose_index(struct object_directory *odb)
+{
+	free_loose_index(odb->loose_index);
+	odb->loose_index = NULL;
+	odb->loose_index_loaded = 0;
+}
@@ -0,0 +1,90 @@
+#ifndef LOOSE_INDEX_H
+#define LOOSE_INDEX_H
+
+#include "oidtree.h"
+
+struct repository;
+struct object_directory;
+struct object_id;
+
+/*
+ * An optional index of the loose objects of an object directory, kept
+ * in "$GIT_OBJECT_DIRECTORY/info/loose-index" when core.looseObjectIndex
+ * is set. It answers the same racy questions as the readdir(3)-based
+ * loose object cache (existence with OBJECT_INFO_QUICK, abbreviated
+ * object names) without reading the fan-out directories.
+ *
+ * The file consists of:
+ *
+ *   - a 4-byte signature "LOIX", a 4-byte version (1), the 4-byte
+ *     format id of the hash function and the 4-byte number N of sorted
+ *     entries, all in network byte order;
+ *
+ *   - a 256-entry fan-out table of 4-byte counts, as in a pack .idx;
+ *
+ *   - N sorted object names;
+ *
+ *   - any number of unsorted object names appended by writers since
+ *     the sorted table was written. A trailing partial name is ignored.
+ *
+ * Writers of loose objects append to an existing index; it is only
+ * (re)built, by scanning the object directory, when a reader finds it
+ * missing or when the appended part has grown too large. Removing loose
+ * objects deletes the index.
+ */
+struct loose_index {
+	const unsigned char *data;
+	size_t data_len;
+
+	const unsigned char *fanout;
+	const unsigned char *lookup;
+	uint32_t nr_sorted;
+
+	struct oidtree appended;
+	uint32_t nr_appended;
+};
+
+/*
+ * Return the loose object index of "odb", loading it (and writing it
+ * first, for the primary object directory, if it is missing or due
+ * for a rebuild) on the first call. Returns NULL if core.looseObjectIndex
+ * is not set or no usable index is available, in which case callers
+ * should fall back to odb_loose_cache().
+ */
+struct loose_index *odb_loose_index(struct repository *r,
+				    struct object_directory *odb);
+
+int loose_index_contains(struct loose_index *li, const struct object_id *oid);
+
+/*
+ * Call "cb" for each object in "li" whose name starts with the first
+ * "len" hex digits of "prefix", like oidtree_each().
+ */
+void loose_index_each(struct loose_index *li, const struct object_id *prefix,
+		      size_t len, oidtree_iter cb, void *data);
+
+/*
+ * Whether writers of loose objects to "odb" have to record them with
+ * loose_index_append(), i.e. whether core.looseObjectIndex is set. When
+ * it is not, an index left behind from when it was is deleted instead
+ * (on the first call), as it would go stale. The first call is not
+ * thread-safe, so make it before writing loose objects from threads.
+ */
+int loose_index_maintained(struct object_directory *odb);
+
+/*
+ * Record a loose object just written to "odb" in its index, if there is
+ * one and loose_index_maintained() says so.
+ */
+void loose_index_append(struct object_directory *odb,
+			const struct object_id *oid);
+
+/*
+ * Delete the index of "odb"; to be called by anything that removes
+ * loose objects, which the index would otherwise still claim to exist.
+ */
+void loose_index_invalidate(struct object_directory *odb);
+
+void close_loose_index(struct object_directory *odb);
+
+#endif /* LOOSE_INDEX_H */
@@ -65,6 +65,36 @@ void mem_pool_init(struct mem_pool *pool, size_t initial_size)
 		mem_pool_alloc_block(pool, initial_size, NULL);
 }
 
+void mem_pool_init_prefault(struct mem_pool *pool, size_t initial_size)
+{
+	mem_pool_init(pool, initial_size);
+
+#if defined(MADV_HUGEPAGE) || defined(MADV_POPULATE_WRITE)
+	if (pool->mp_block) {
+		uintptr_t pagesize = getpagesize();
+		uintptr_t start = (uintptr_t)pool->mp_block->space;
+		uintptr_t end = (uintptr_t)pool->mp_block->end;
+
+		/* madvise(2) wants whole pages */
+		start = (start + pagesize - 1) & ~(pagesize - 1);
+		end &= ~(pagesize - 1);
+		if (start >= end)
+			return;
+
+		/*
+		 * Both are only hints; older kernels reject them with
+		 * EINVAL and we simply fault the pages in as we go.
+		 */
+#ifdef MADV_HUGEPAGE
+		madvise((void *)start, end - start, MADV_HUGEPAGE);
+#endif
+#ifdef MADV_POPULATE_WRITE
+		madvise((void *)start, end - start, MADV_POPULATE_WRITE);
+#endif
+	}
+#endif
+}
+
 void mem_pool_discard(struct mem_pool *pool, int invalidate_memory)
 {
 	struct mp_block *block, *block_to_free;
@@ -26,6 +26,15 @@ struct mem_pool {
  */
 void mem_pool_init(struct mem_pool *pool, size_t initial_size);
 
+/*
+ * Like mem_pool_init(), for a caller that is about to fill the initial
+ * block right away: ask the system to back all of it up front (with huge
+ * pages if possible) instead of taking a page fault on first touch of
+ * each page. Do not use it with a generous guess of the initial size, as
+ * all of it becomes resident.
+ */
+void mem_pool_init_prefault(struct mem_pool *pool, size_t initial_size);
+
 /*
  * Discard all the memory the memory pool is responsible for.
  */
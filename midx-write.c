@@ -19,6 +19,7 @@
 #include "list-objects.h"
 #include "path.h"
 #include "pack-revindex.h"
+#include "thread-utils.h"
 
 #define PACK_EXPIRED UINT_MAX
 #define BITMAP_POS_UNKNOWN (~((uint32_t)0))
@@ -110,8 +111,73 @@ struct write_midx_context {
 	uint32_t num_multi_pack_indexes_before;
 
 	struct string_list *to_include;
+
+	int nr_threads;
+};
+
+/*
+ * Call fn(i, data) for each 0 <= i < nr, spreading the calls over up
+ * to nr_threads threads that claim indices in order. The calls for
+ * different indices must be independent of each other, and must not
+ * open packs or their indexes: xmmap() may unmap pack windows to make
+ * room, without any locking.
+ */
+struct midx_parallel {
+	void (*fn)(size_t i, void *data);
+	void *data;
+	size_t next, nr;
+	pthread_mutex_t mutex;
 };
 
+static void *midx_parallel_thread(void *_mp)
+{
+	struct midx_parallel *mp = _mp;
+
+	for (;;) {
+		size_t i;
+
+		pthread_mutex_lock(&mp->mutex);
+		i = mp->next < mp->nr ? mp->next++ : mp->nr;
+		pthread_mutex_unlock(&mp->mutex);
+		if (i == mp->nr)
+			break;
+		mp->fn(i, mp->data);
+	}
+	return NULL;
+}
+
+static void midx_for_each_parallel(int nr_threads, size_t nr,
+				   void (*fn)(size_t i, void *data),
+				   void *data)
+{
+	struct midx_parallel mp = { .fn = fn, .data = data, .nr = nr };
+	pthread_t *threads;
+	int t;
+
+	if (nr_threads > nr)
+		nr_threads = nr;
+	if (!HAVE_THREADS || nr_threads <= 1) {
+		size_t i;
+		for (i = 0; i < nr; i++)
+			fn(i, data);
+		return;
+	}
+
+	pthread_mutex_init(&mp.mutex, NULL);
+	CALLOC_ARRAY(threads, nr_threads - 1);
+	for (t = 0; t < nr_threads - 1; t++) {
+		int err = pthread_create(&threads[t], NULL,
+					 midx_parallel_thread, &mp);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	midx_parallel_thread(&mp);
+	for (t = 0; t < nr_threads - 1; t++)
+		pthread_join(threads[t], NULL);
+	free(threads);
+	pthread_mutex_destroy(&mp.mutex);
+}
+
 static int should_include_pack(const struct write_midx_context *ctx,
 			       const char *file_name)
 {
@@ -326,13 +392,111 @@ static void midx_fanout_add_pack_fanout(struct midx_fanout *fanout,
  * Copy only the de-duplicated entries (selected by most-recent modified time
  * of a packfile containing the object).
  */
+static void add_fanout_entries(struct write_midx_context *ctx,
+			       uint32_t start_pack, uint32_t cur_fanout,
+			       struct midx_fanout *fanout,
+			       struct pack_midx_entry **entries,
+			       size_t *entries_nr, size_t *entries_alloc)
+{
+	uint32_t cur_pack, cur_object;
+
+	fanout->nr = 0;
+
+	if (ctx->m && !ctx->incremental)
+		midx_fanout_add_midx_fanout(fanout, ctx->m, cur_fanout,
+					    ctx->preferred_pack_idx);
+
+	for (cur_pack = start_pack; cur_pack < ctx->nr; cur_pack++) {
+		int preferred = cur_pack == ctx->preferred_pack_idx;
+		midx_fanout_add_pack_fanout(fanout,
+					    ctx->info, cur_pack,
+					    preferred, cur_fanout);
+	}
+
+	if (-1 < ctx->preferred_pack_idx && ctx->preferred_pack_idx < start_pack)
+		midx_fanout_add_pack_fanout(fanout, ctx->info,
+					    ctx->preferred_pack_idx, 1,
+					    cur_fanout);
+
+	midx_fanout_sort(fanout);
+
+	/*
+	 * The batch is now sorted by OID and then mtime (descending).
+	 * Take only the first duplicate.
+	 */
+	for (cur_object = 0; cur_object < fanout->nr; cur_object++) {
+		if (cur_object && oideq(&fanout->entries[cur_object - 1].oid,
+					&fanout->entries[cur_object].oid))
+			continue;
+		if (ctx->incremental && ctx->base_midx &&
+		    midx_has_oid(ctx->base_midx,
+				 &fanout->entries[cur_object].oid))
+			continue;
+
+		ALLOC_GROW(*entries, st_add(*entries_nr, 1), *entries_alloc);
+		memcpy(&(*entries)[*entries_nr],
+		       &fanout->entries[cur_object],
+		       sizeof(struct pack_midx_entry));
+		(*entries_nr)++;
+	}
+}
+
+/*
+ * With more than one thread, each of the 256 slices is gathered,
+ * sorted and de-duplicated on its own, in the slice's own fanout array
+ * which then holds the result; the slices are concatenated in order
+ * at the end.
+ */
+struct sorted_entries_data {
+	struct write_midx_context *ctx;
+	uint32_t start_pack;
+	struct midx_fanout slices[256];
+};
+
+static void compute_slice_entries(size_t cur_fanout, void *_data)
+{
+	struct sorted_entries_data *data = _data;
+	struct midx_fanout *slice = &data->slices[cur_fanout];
+	struct midx_fanout scratch = { 0 };
+
+	add_fanout_entries(data->ctx, data->start_pack, cur_fanout, &scratch,
+			   &slice->entries, &slice->nr, &slice->alloc);
+	free(scratch.entries);
+}
+
 static void compute_sorted_entries(struct write_midx_context *ctx,
 				   uint32_t start_pack)
 {
-	uint32_t cur_fanout, cur_pack, cur_object;
+	uint32_t cur_fanout, cur_pack;
 	size_t alloc_objects, total_objects = 0;
 	struct midx_fanout fanout = { 0 };
 
+	if (ctx->nr_threads > 1) {
+		struct sorted_entries_data *data;
+		size_t nr = 0;
+
+		CALLOC_ARRAY(data, 1);
+		data->ctx = ctx;
+		data->start_pack = start_pack;
+		midx_for_each_parallel(ctx->nr_threads, 256,
+				       compute_slice_entries, data);
+
+		for (cur_fanout = 0; cur_fanout < 256; cur_fanout++)
+			nr = st_add(nr, data->slices[cur_fanout].nr);
+		ALLOC_ARRAY(ctx->entries, nr);
+		ctx->entries_nr = 0;
+		for (cur_fanout = 0; cur_fanout < 256; cur_fanout++) {
+			struct midx_fanout *slice = &data->slices[cur_fanout];
+
+			COPY_ARRAY(ctx->entries + ctx->entries_nr,
+				   slice->entries, slice->nr);
+			ctx->entries_nr += slice->nr;
+			free(slice->entries);
+		}
+		free(data);
+		return;
+	}
+
 	for (cur_pack = start_pack; cur_pack < ctx->nr; cur_pack++)
 		total_objects = st_add(total_objects,
 				       ctx->info[cur_pack].p->num_objects);
@@ -348,48 +512,10 @@ static void compute_sorted_entries(struct write_midx_context *ctx,
 	ALLOC_ARRAY(ctx->entries, alloc_objects);
 	ctx->entries_nr = 0;
 
-	for (cur_fanout = 0; cur_fanout < 256; cur_fanout++) {
-		fanout.nr = 0;
-
-		if (ctx->m && !ctx->incremental)
-			midx_fanout_add_midx_fanout(&fanout, ctx->m, cur_fanout,
-						    ctx->preferred_pack_idx);
-
-		for (cur_pack = start_pack; cur_pack < ctx->nr; cur_pack++) {
-			int preferred = cur_pack == ctx->preferred_pack_idx;
-			midx_fanout_add_pack_fanout(&fanout,
-						    ctx->info, cur_pack,
-						    preferred, cur_fanout);
-		}
-
-		if (-1 < ctx->preferred_pack_idx && ctx->preferred_pack_idx < start_pack)
-			midx_fanout_add_pack_fanout(&fanout, ctx->info,
-						    ctx->preferred_pack_idx, 1,
-						    cur_fanout);
-
-		midx_fanout_sort(&fanout);
-
-		/*
-		 * The batch is now sorted by OID and then mtime (descending).
-		 * Take only the first duplicate.
-		 */
-		for (cur_object = 0; cur_object < fanout.nr; cur_object++) {
-			if (cur_object && oideq(&fanout.entries[cur_object - 1].oid,
-						&fanout.entries[cur_object].oid))
-				continue;
-			if (ctx->incremental && ctx->base_midx &&
-			    midx_has_oid(ctx->base_midx,
-					 &fanout.entries[cur_object].oid))
-				continue;
-
-			ALLOC_GROW(ctx->entries, st_add(ctx->entries_nr, 1),
-				   alloc_objects);
-			memcpy(&ctx->entries[ctx->entries_nr],
-			       &fanout.entries[cur_object],
-			       sizeof(struct pack_midx_entry));
-			ctx->entries_nr++;
-		}
-	}
+	for (cur_fanout = 0; cur_fanout < 256; cur_fanout++)
+		add_fanout_entries(ctx, start_pack, cur_fanout, &fanout,
+				   &ctx->entries, &ctx->entries_nr,
+				   &alloc_objects);
 
 	free(fanout.entries);
 }
@@ -599,6 +725,65 @@ static int midx_pack_order_cmp(const void *va, const void *vb)
 		return 0;
 }
 
+/*
+ * Objects are ordered first by their pack (see midx_pack_order_cmp()),
+ * so rather than sorting all of them at once, distribute them into one
+ * bucket per pack (and preferred-ness) and sort each bucket by offset,
+ * the buckets in parallel.
+ */
+struct pack_order_buckets {
+	struct midx_pack_order_data *data;
+	size_t *start; /* bucket i is [start[i], start[i + 1]) */
+};
+
+static uint32_t pack_order_bucket(const struct midx_pack_order_data *d,
+				  uint32_t nr_packs)
+{
+	uint32_t pack = d->pack & ~(1U << 31);
+
+	if (pack >= nr_packs)
+		BUG("unexpected pack %"PRIu32" in pack order", pack);
+	return (d->pack & (1U << 31)) ? nr_packs + pack : pack;
+}
+
+static void sort_pack_order_bucket(size_t i, void *_b)
+{
+	struct pack_order_buckets *b = _b;
+
+	QSORT(b->data + b->start[i], b->start[i + 1] - b->start[i],
+	      midx_pack_order_cmp);
+}
+
+static void sort_pack_order(struct write_midx_context *ctx,
+			    struct midx_pack_order_data *data)
+{
+	struct pack_order_buckets b;
+	struct midx_pack_order_data *sorted;
+	size_t nr_buckets = st_mult(2, ctx->nr);
+	size_t *next;
+	uint32_t i;
+
+	CALLOC_ARRAY(b.start, nr_buckets + 1);
+	for (i = 0; i < ctx->entries_nr; i++)
+		b.start[pack_order_bucket(&data[i], ctx->nr) + 1]++;
+	for (i = 0; i < nr_buckets; i++)
+		b.start[i + 1] += b.start[i];
+
+	DUP_ARRAY(next, b.start, nr_buckets);
+	ALLOC_ARRAY(sorted, ctx->entries_nr);
+	for (i = 0; i < ctx->entries_nr; i++)
+		sorted[next[pack_order_bucket(&data[i], ctx->nr)]++] = data[i];
+
+	b.data = sorted;
+	midx_for_each_parallel(ctx->nr_threads, nr_buckets,
+			       sort_pack_order_bucket, &b);
+
+	COPY_ARRAY(data, sorted, ctx->entries_nr);
+	free(sorted);
+	free(next);
+	free(b.start);
+}
+
 static uint32_t *midx_pack_order(struct write_midx_context *ctx)
 {
 	struct midx_pack_order_data *data;
@@ -623,7 +808,7 @@ static uint32_t *midx_pack_order(struct write_midx_context *ctx)
 		data[i].offset = e->offset;
 	}
 
-	QSORT(data, ctx->entries_nr, midx_pack_order_cmp);
+	sort_pack_order(ctx, data);
 
 	for (i = 0; i < ctx->entries_nr; i++) {
 		struct pack_midx_entry *e = &ctx->entries[data[i].nr];
@@ -832,6 +1017,7 @@ static int write_midx_bitmap(const char *midx_name,
 			     struct commit **commits,
 			     uint32_t commits_nr,
 			     uint32_t *pack_order,
+			     int nr_threads,
 			     unsigned flags)
 {
 	int ret, i;
@@ -860,6 +1046,7 @@ static int write_midx_bitmap(const char *midx_name,
 
 	bitmap_writer_init(&writer, the_repository, pdata);
 	bitmap_writer_show_progress(&writer, flags & MIDX_PROGRESS);
+	bitmap_writer_set_threads(&writer, nr_threads);
 	bitmap_writer_build_type_index(&writer, index);
 
 	/*
@@ -1071,6 +1258,13 @@ static int write_midx_internal(const char *object_dir,
 
 	trace2_region_enter("midx", "write_midx_internal", the_repository);
 
+	if (repo_config_get_int(the_repository, "pack.threads", &ctx.nr_threads) ||
+	    ctx.nr_threads <= 0)
+		ctx.nr_threads = online_cpus();
+	if (!HAVE_THREADS)
+		ctx.nr_threads = 1;
+	trace2_data_intmax("midx", the_repository, "threads", ctx.nr_threads);
+
 	ctx.incremental = !!(flags & MIDX_WRITE_INCREMENTAL);
 	if (ctx.incremental && (flags & MIDX_WRITE_BITMAP))
 		die(_("cannot write incremental MIDX with bitmap"));
@@ -1406,7 +1600,7 @@ static int write_midx_internal(const char *object_dir,
 
 		if (write_midx_bitmap(midx_name.buf, midx_hash, &pdata,
 				      commits, commits_nr, ctx.pack_order,
-				      flags) < 0) {
+				      ctx.nr_threads, flags) < 0) {
 			error(_("could not write multi-pack bitmap"));
 			result = 1;
 			clear_packing_data(&pdata);
@@ -39,6 +39,7 @@
 #include "submodule.h"
 #include "fsck.h"
 #include "loose.h"
+#include "loose-index.h"
 #include "object-file-convert.h"
 
 /* The maximum size for an object header. */
@@ -1213,7 +1214,10 @@ static int quick_has_loose(struct repository *r,
 
 	prepare_alt_odb(r);
 	for (odb = r->objects->odb; odb; odb = odb->next) {
-		if (oidtree_contains(odb_loose_cache(odb, oid), oid))
+		struct loose_index *li = odb_loose_index(r, odb);
+
+		if (li ? loose_index_contains(li, oid) :
+		    oidtree_contains(odb_loose_cache(odb, oid), oid))
 			return 1;
 	}
 	return 0;
@@ -1534,6 +1538,7 @@ void enable_obj_read_lock(void)
 
 	obj_read_use_lock = 1;
 	init_recursive_mutex(&obj_read_mutex);
+	set_delta_base_cache_threaded(1);
 }
 
 void disable_obj_read_lock(void)
@@ -1543,6 +1548,7 @@ void disable_obj_read_lock(void)
 
 	obj_read_use_lock = 0;
 	pthread_mutex_destroy(&obj_read_mutex);
+	set_delta_base_cache_threaded(0);
 }
 
 int fetch_if_missing = 1;
@@ -2140,8 +2146,8 @@ static int write_loose_object(const struct object_id *oid, char *hdr,
 	git_zstream stream;
 	git_hash_ctx c;
 	struct object_id parano_oid;
-	static struct strbuf tmp_file = STRBUF_INIT;
-	static struct strbuf filename = STRBUF_INIT;
+	struct strbuf tmp_file = STRBUF_INIT;
+	struct strbuf filename = STRBUF_INIT;
 
 	if (batch_fsync_enabled(FSYNC_COMPONENT_LOOSE_OBJECT))
 		prepare_loose_object_bulk_checkin();
@@ -2151,8 +2157,10 @@ static int write_loose_object(const struct object_id *oid, char *hdr,
 	fd = start_loose_object_common(&tmp_file, filename.buf, flags,
 				       &stream, compressed, sizeof(compressed),
 				       &c, NULL, hdr, hdrlen);
-	if (fd < 0)
-		return -1;
+	if (fd < 0) {
+		ret = -1;
+		goto out;
+	}
 
 	/* Then the data itself.. */
 	stream.next_in = (void *)buf;
@@ -2186,7 +2194,13 @@ static int write_loose_object(const struct object_id *oid, char *hdr,
 			warning_errno(_("failed utime() on %s"), tmp_file.buf);
 	}
 
-	return finalize_object_file(tmp_file.buf, filename.buf);
+	ret = finalize_object_file(tmp_file.buf, filename.buf);
+	if (!ret)
+		loose_index_append(the_repository->objects->odb, oid);
+out:
+	strbuf_release(&tmp_file);
+	strbuf_release(&filename);
+	return ret;
 }
 
 static int freshen_loose_object(const struct object_id *oid)
@@ -2309,6 +2323,8 @@ int stream_loose_object(struct input_stream *in_stream, size_t len,
 	}
 
 	err = finalize_object_file(tmp_file.buf, filename.buf);
+	if (!err)
+		loose_index_append(the_repository->objects->odb, oid);
 	if (!err && compat)
 		err = repo_add_loose_object_map(the_repository, oid, &compat_oid);
 cleanup:
@@ -2357,6 +2373,23 @@ int write_object_file_flags(const void *buf, unsigned long len,
 	return 0;
 }
 
+int freshen_object(const struct object_id *oid)
+{
+	return freshen_packed_object(oid) || freshen_loose_object(oid);
+}
+
+int write_loose_object_file(const void *buf, unsigned long len,
+			    enum object_type type, const struct object_id *oid)
+{
+	char hdr[MAX_HEADER_LEN];
+	int hdrlen;
+
+	if (the_repository->compat_hash_algo)
+		BUG("write_loose_object_file() cannot map compat object names");
+	hdrlen = format_object_header(hdr, sizeof(hdr), type, len);
+	return write_loose_object(oid, hdr, hdrlen, buf, len, 0, 0);
+}
+
 int write_object_file_literally(const void *buf, unsigned long len,
 				const char *type, struct object_id *oid,
 				unsigned flags)
@@ -2868,6 +2901,7 @@ void odb_clear_loose_cache(struct object_directory *odb)
 	FREE_AND_NULL(odb->loose_objects_cache);
 	memset(&odb->loose_objects_subdir_seen, 0,
 	       sizeof(odb->loose_objects_subdir_seen));
+	close_loose_index(odb);
 }
 
 static int check_stream_oid(git_zstream *stream,
@@ -7,6 +7,7 @@
 #include "environment.h"
 #include "gettext.h"
 #include "hex.h"
+#include "loose-index.h"
 #include "tag.h"
 #include "commit.h"
 #include "tree.h"
@@ -112,9 +113,16 @@ static void find_short_object_filename(struct disambiguate_state *ds)
 {
 	struct object_directory *odb;
 
-	for (odb = ds->repo->objects->odb; odb && !ds->ambiguous; odb = odb->next)
-		oidtree_each(odb_loose_cache(odb, &ds->bin_pfx),
-				&ds->bin_pfx, ds->len, match_prefix, ds);
+	for (odb = ds->repo->objects->odb; odb && !ds->ambiguous; odb = odb->next) {
+		struct loose_index *li = odb_loose_index(ds->repo, odb);
+
+		if (li)
+			loose_index_each(li, &ds->bin_pfx, ds->len,
+					 match_prefix, ds);
+		else
+			oidtree_each(odb_loose_cache(odb, &ds->bin_pfx),
+				     &ds->bin_pfx, ds->len, match_prefix, ds);
+	}
 }
 
 static int match_hash(unsigned len, const unsigned char *a, const unsigned char *b)
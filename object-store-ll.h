@@ -26,6 +26,14 @@ struct object_directory {
 	uint32_t loose_objects_subdir_seen[8]; /* 256 bits */
 	struct oidtree *loose_objects_cache;
 
+	/*
+	 * The on-disk index of loose objects, which when enabled answers
+	 * the same questions as the cache above. See loose-index.h.
+	 */
+	struct loose_index *loose_index;
+	int loose_index_loaded;
+	int loose_index_unmaintained_checked;
+
 	/* Map between object IDs for loose objects. */
 	struct loose_object_map *loose_map;
 
@@ -265,6 +273,19 @@ static inline int write_object_file(const void *buf, unsigned long len,
 int write_object_file_literally(const void *buf, unsigned long len,
 				const char *type, struct object_id *oid,
 				unsigned flags);
+
+/*
+ * The two halves of write_object_file(), for callers that compute the
+ * object name themselves and want to write objects from several threads.
+ * freshen_object() returns 1 if "oid" already exists, updating its mtime.
+ * write_loose_object_file() writes "buf" as the loose object "oid"; it
+ * may be called from several threads at once as long as no compatibility
+ * hash algorithm is configured and prepare_loose_object_bulk_checkin()
+ * was called beforehand within an ODB transaction.
+ */
+int freshen_object(const struct object_id *oid);
+int write_loose_object_file(const void *buf, unsigned long len,
+			    enum object_type type, const struct object_id *oid);
 int stream_loose_object(struct input_stream *in_stream, size_t len,
 			struct object_id *oid);
 
@@ -409,10 +430,17 @@ void assert_oid_type(const struct object_id *oid, enum object_type expect);
  * following functions in parallel: repo_read_object_file(),
  * read_object_with_reference(), oid_object_info() and oid_object_info_extended().
  *
+ * The lock only serializes the bookkeeping of the object database: finding
+ * packs and loose objects and managing pack windows. The expensive parts of
+ * a read run without it: zlib inflation from a pack window (which is kept
+ * mapped by its in-use count), applying deltas to private buffers, and
+ * copying bases out of the delta base cache, which is then sharded and
+ * protected by per-shard locks of its own.
+ *
  * obj_read_lock() and obj_read_unlock() may also be used to protect other
  * section which cannot execute in parallel with object reading. Since the used
  * lock is a recursive mutex, these sections can even contain calls to object
- * reading functions. However, beware that in these cases zlib inflation won't
+ * reading functions. However, beware that in these cases the steps above won't
  * be performed in parallel, losing performance.
  *
  * TODO: oid_object_info_extended()'s call stack has a recursive behavior. If
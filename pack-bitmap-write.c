@@ -25,6 +25,7 @@
 #include "alloc.h"
 #include "refs.h"
 #include "strmap.h"
+#include "thread-utils.h"
 
 struct bitmapped_commit {
 	struct commit *commit;
@@ -97,6 +98,11 @@ void bitmap_writer_show_progress(struct bitmap_writer *writer, int show)
 	writer->show_progress = show;
 }
 
+void bitmap_writer_set_threads(struct bitmap_writer *writer, int nr_threads)
+{
+	writer->nr_threads = nr_threads;
+}
+
 /**
  * Build the initial type index for the packfile or multi-pack-index
  */
@@ -266,6 +272,7 @@ struct bb_commit {
 		 maximal:1,
 		 pseudo_merge:1;
 	unsigned idx; /* within selected array */
+	unsigned pending; /* unfinished commits feeding our bitmap */
 };
 
 static void clear_bb_commit(struct bb_commit *commit)
@@ -422,42 +429,74 @@ static void bitmap_builder_clear(struct bitmap_builder *bb)
 	bb->commits_nr = bb->commits_alloc = 0;
 }
 
+/*
+ * While bitmaps are built by several threads, this protects what is
+ * not safe to touch concurrently: the existing bitmap index (whose
+ * bitmaps are loaded lazily), parsing commit trees, and the reuse
+ * counters below.  Reading objects is covered by the object read lock.
+ */
+static int build_threaded;
+static pthread_mutex_t build_mutex;
+
+static inline void build_lock(void)
+{
+	if (build_threaded)
+		pthread_mutex_lock(&build_mutex);
+}
+
+static inline void build_unlock(void)
+{
+	if (build_threaded)
+		pthread_mutex_unlock(&build_mutex);
+}
+
 static int fill_bitmap_tree(struct bitmap_writer *writer,
 			    struct bitmap *bitmap,
-			    struct tree *tree)
+			    const struct object_id *oid)
 {
-	int found;
+	int found, ret = 0;
 	uint32_t pos;
 	struct tree_desc desc;
 	struct name_entry entry;
+	enum object_type type;
+	unsigned long size;
+	void *buf;
 
 	/*
 	 * If our bit is already set, then there is nothing to do. Both this
 	 * tree and all of its children will be set.
 	 */
-	pos = find_object_pos(writer, &tree->object.oid, &found);
+	pos = find_object_pos(writer, oid, &found);
 	if (!found)
 		return -1;
 	if (bitmap_get(bitmap, pos))
 		return 0;
 	bitmap_set(bitmap, pos);
 
-	if (parse_tree(tree) < 0)
-		die("unable to load tree object %s",
-		    oid_to_hex(&tree->object.oid));
-	init_tree_desc(&desc, &tree->object.oid, tree->buffer, tree->size);
+	/*
+	 * Read the tree directly rather than through parse_tree(), which
+	 * would allocate a "struct tree" for each subtree and cannot be
+	 * used from several threads at once.
+	 */
+	buf = repo_read_object_file(the_repository, oid, &type, &size);
+	if (!buf || type != OBJ_TREE)
+		die("unable to load tree object %s", oid_to_hex(oid));
+	init_tree_desc(&desc, oid, buf, size);
 
 	while (tree_entry(&desc, &entry)) {
 		switch (object_type(entry.mode)) {
 		case OBJ_TREE:
-			if (fill_bitmap_tree(writer, bitmap,
-					     lookup_tree(the_repository, &entry.oid)) < 0)
-				return -1;
+			if (fill_bitmap_tree(writer, bitmap, &entry.oid) < 0) {
+				ret = -1;
+				goto out;
+			}
 			break;
 		case OBJ_BLOB:
 			pos = find_object_pos(writer, &entry.oid, &found);
-			if (!found)
-				return -1;
+			if (!found) {
+				ret = -1;
+				goto out;
+			}
 			bitmap_set(bitmap, pos);
 			break;
 		default:
@@ -466,8 +505,9 @@ static int fill_bitmap_tree(struct bitmap_writer *writer,
 		}
 	}
 
-	free_tree_buffer(tree);
-	return 0;
+out:
+	free(buf);
+	return ret;
 }
 
 static int reused_bitmaps_nr;
@@ -496,10 +536,12 @@ static int fill_bitmap_commit(struct bitmap_writer *writer,
 			struct ewah_bitmap *old;
 			struct bitmap *remapped = bitmap_new();
 
+			build_lock();
 			if (commit->object.flags & BITMAP_PSEUDO_MERGE)
 				old = pseudo_merge_bitmap_for_commit(old_bitmap, c);
 			else
 				old = bitmap_for_commit(old_bitmap, c);
+			build_unlock();
 			/*
 			 * If this commit has an old bitmap, then translate that
 			 * bitmap and add its bits to this one. No need to walk
@@ -508,10 +550,12 @@ static int fill_bitmap_commit(struct bitmap_writer *writer,
 			if (old && !rebuild_bitmap(mapping, old, remapped)) {
 				bitmap_or(ent->bitmap, remapped);
 				bitmap_free(remapped);
+				build_lock();
 				if (commit->object.flags & BITMAP_PSEUDO_MERGE)
 					reused_pseudo_merge_bitmaps_nr++;
 				else
 					reused_bitmaps_nr++;
+				build_unlock();
 				continue;
 			}
 			bitmap_free(remapped);
@@ -526,8 +570,10 @@ static int fill_bitmap_commit(struct bitmap_writer *writer,
 			if (!found)
 				return -1;
 			bitmap_set(ent->bitmap, pos);
+			build_lock();
 			prio_queue_put(tree_queue,
 				       repo_get_commit_tree(the_repository, c));
+			build_unlock();
 		}
 
 		for (p = c->parents; p; p = p->next) {
@@ -543,8 +589,9 @@ static int fill_bitmap_commit(struct bitmap_writer *writer,
 	}
 
 	while (tree_queue->nr) {
+		struct tree *tree = prio_queue_get(tree_queue);
 		if (fill_bitmap_tree(writer, ent->bitmap,
-				     prio_queue_get(tree_queue)) < 0)
+				     &tree->object.oid) < 0)
 			return -1;
 	}
 	return 0;
@@ -556,8 +603,6 @@ static void store_selected(struct bitmap_writer *writer,
 	struct bitmapped_commit *stored = &writer->selected[ent->idx];
 	khiter_t hash_pos;
 
-	stored->bitmap = bitmap_to_ewah(ent->bitmap);
-
 	if (ent->pseudo_merge)
 		return;
 
@@ -569,6 +614,193 @@ static void store_selected(struct bitmap_writer *writer,
 	kh_value(writer->bitmaps, hash_pos) = stored;
 }
 
+/*
+ * Hand the bitmap of a finished commit down to the maximal commits it
+ * feeds (see bitmap_builder_init()), reusing its memory for the first.
+ */
+static void pass_to_children(struct bitmap_builder *bb, struct bb_commit *ent)
+{
+	struct commit *child;
+	int reused = 0;
+
+	while ((child = pop_commit(&ent->reverse_edges))) {
+		struct bb_commit *child_ent =
+			bb_data_at(&bb->data, child);
+
+		if (child_ent->bitmap)
+			bitmap_or(child_ent->bitmap, ent->bitmap);
+		else if (reused)
+			child_ent->bitmap = bitmap_dup(ent->bitmap);
+		else {
+			child_ent->bitmap = ent->bitmap;
+			reused = 1;
+		}
+	}
+	if (!reused)
+		bitmap_free(ent->bitmap);
+	ent->bitmap = NULL;
+}
+
+/*
+ * The bitmap of each maximal commit starts out as the union of the
+ * bitmaps handed down to it and is then completed by a walk, so the
+ * commits form a forest in which independent branches can be built at
+ * the same time.  Commits whose inputs are all done go on a "ready"
+ * stack from which the threads (including the calling one, which
+ * also reports progress) take their next commit.  The result does not
+ * depend on the order in which this happens.
+ */
+struct build_threads {
+	struct bitmap_writer *writer;
+	struct bitmap_builder *bb;
+	struct bitmap_index *old_bitmap;
+	const uint32_t *mapping;
+
+	struct commit **ready;
+	size_t ready_nr, ready_alloc;
+	size_t remaining;
+	int nr_stored;
+	int failed;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+static void build_thread_one(struct build_threads *bt, int show_progress)
+{
+	struct prio_queue queue = { compare_commits_by_gen_then_commit_date };
+	struct prio_queue tree_queue = { NULL };
+
+	pthread_mutex_lock(&bt->mutex);
+	for (;;) {
+		struct commit *commit;
+		struct bb_commit *ent;
+		struct commit_list *e;
+		int ret;
+
+		while (!bt->ready_nr && bt->remaining && !bt->failed)
+			pthread_cond_wait(&bt->cond, &bt->mutex);
+		if (!bt->ready_nr || bt->failed)
+			break;
+		commit = bt->ready[--bt->ready_nr];
+		ent = bb_data_at(&bt->bb->data, commit);
+		pthread_mutex_unlock(&bt->mutex);
+
+		ret = fill_bitmap_commit(bt->writer, ent, commit, &queue,
+					 &tree_queue, bt->old_bitmap,
+					 bt->mapping);
+		if (!ret && ent->selected)
+			bt->writer->selected[ent->idx].bitmap =
+				bitmap_to_ewah(ent->bitmap);
+
+		pthread_mutex_lock(&bt->mutex);
+		if (ret < 0) {
+			bt->failed = 1;
+			pthread_cond_broadcast(&bt->cond);
+			break;
+		}
+		if (ent->selected) {
+			store_selected(bt->writer, ent, commit);
+			bt->nr_stored++;
+		}
+		for (e = ent->reverse_edges; e; e = e->next) {
+			struct bb_commit *child_ent =
+				bb_data_at(&bt->bb->data, e->item);
+			if (!--child_ent->pending) {
+				ALLOC_GROW(bt->ready, bt->ready_nr + 1,
+					   bt->ready_alloc);
+				bt->ready[bt->ready_nr++] = e->item;
+			}
+		}
+		pass_to_children(bt->bb, ent);
+		bt->remaining--;
+		pthread_cond_broadcast(&bt->cond);
+
+		if (show_progress) {
+			int nr_stored = bt->nr_stored;
+			pthread_mutex_unlock(&bt->mutex);
+			display_progress(bt->writer->progress, nr_stored);
+			pthread_mutex_lock(&bt->mutex);
+		}
+	}
+	pthread_mutex_unlock(&bt->mutex);
+
+	clear_prio_queue(&queue);
+	clear_prio_queue(&tree_queue);
+}
+
+static void *build_thread(void *data)
+{
+	build_thread_one(data, 0);
+	return NULL;
+}
+
+static int build_bitmaps_threaded(struct bitmap_writer *writer,
+				  struct bitmap_builder *bb,
+				  struct bitmap_index *old_bitmap,
+				  const uint32_t *mapping)
+{
+	struct build_threads bt = {
+		.writer = writer,
+		.bb = bb,
+		.old_bitmap = old_bitmap,
+		.mapping = mapping,
+		.remaining = bb->commits_nr,
+	};
+	int nr_threads = writer->nr_threads;
+	int lock_was_enabled = obj_read_use_lock;
+	pthread_t *threads;
+	size_t i;
+
+	for (i = 0; i < bb->commits_nr; i++) {
+		struct bb_commit *ent = bb_data_at(&bb->data, bb->commits[i]);
+		struct commit_list *e;
+
+		for (e = ent->reverse_edges; e; e = e->next)
+			bb_data_at(&bb->data, e->item)->pending++;
+	}
+	/* oldest first, like the sequential build */
+	for (i = 0; i < bb->commits_nr; i++) {
+		struct commit *c = bb->commits[i];
+
+		if (bb_data_at(&bb->data, c)->pending)
+			continue;
+		ALLOC_GROW(bt.ready, bt.ready_nr + 1, bt.ready_alloc);
+		bt.ready[bt.ready_nr++] = c;
+	}
+
+	if (!lock_was_enabled)
+		enable_obj_read_lock();
+	pthread_mutex_init(&build_mutex, NULL);
+	build_threaded = 1;
+	pthread_mutex_init(&bt.mutex, NULL);
+	pthread_cond_init(&bt.cond, NULL);
+
+	trace2_data_intmax("pack-bitmap-write", the_repository,
+			   "building_bitmaps_threads", nr_threads);
+
+	CALLOC_ARRAY(threads, nr_threads - 1);
+	for (i = 0; i < nr_threads - 1; i++) {
+		int err = pthread_create(&threads[i], NULL, build_thread, &bt);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+	build_thread_one(&bt, 1);
+	for (i = 0; i < nr_threads - 1; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_cond_destroy(&bt.cond);
+	pthread_mutex_destroy(&bt.mutex);
+	build_threaded = 0;
+	pthread_mutex_destroy(&build_mutex);
+	if (!lock_was_enabled)
+		disable_obj_read_lock();
+
+	free(threads);
+	free(bt.ready);
+	return bt.failed ? -1 : 0;
+}
+
 int bitmap_writer_build(struct bitmap_writer *writer)
 {
 	struct bitmap_builder bb;
@@ -593,40 +825,30 @@ int bitmap_writer_build(struct bitmap_writer *writer)
 		mapping = NULL;
 
 	bitmap_builder_init(&bb, writer, old_bitmap);
-	for (i = bb.commits_nr; i > 0; i--) {
-		struct commit *commit = bb.commits[i-1];
-		struct bb_commit *ent = bb_data_at(&bb.data, commit);
-		struct commit *child;
-		int reused = 0;
-
-		if (fill_bitmap_commit(writer, ent, commit, &queue, &tree_queue,
-				       old_bitmap, mapping) < 0) {
+	if (HAVE_THREADS && writer->nr_threads > 1 && bb.commits_nr > 1) {
+		if (build_bitmaps_threaded(writer, &bb, old_bitmap, mapping) < 0)
 			closed = 0;
-			break;
-		}
-
-		if (ent->selected) {
-			store_selected(writer, ent, commit);
-			nr_stored++;
-			display_progress(writer->progress, nr_stored);
-		}
-
-		while ((child = pop_commit(&ent->reverse_edges))) {
-			struct bb_commit *child_ent =
-				bb_data_at(&bb.data, child);
+	} else {
+		for (i = bb.commits_nr; i > 0; i--) {
+			struct commit *commit = bb.commits[i-1];
+			struct bb_commit *ent = bb_data_at(&bb.data, commit);
+
+			if (fill_bitmap_commit(writer, ent, commit, &queue, &tree_queue,
+					       old_bitmap, mapping) < 0) {
+				closed = 0;
+				break;
+			}
 
-			if (child_ent->bitmap)
-				bitmap_or(child_ent->bitmap, ent->bitmap);
-			else if (reused)
-				child_ent->bitmap = bitmap_dup(ent->bitmap);
-			else {
-				child_ent->bitmap = ent->bitmap;
-				reused = 1;
+			if (ent->selected) {
+				writer->selected[ent->idx].bitmap =
+					bitmap_to_ewah(ent->bitmap);
+				store_selected(writer, ent, commit);
+				nr_stored++;
+				display_progress(writer->progress, nr_stored);
 			}
+
+			pass_to_children(&bb, ent);
 		}
-		if (!reused)
-			bitmap_free(ent->bitmap);
-		ent->bitmap = NULL;
 	}
 	clear_prio_queue(&queue);
 	clear_prio_queue(&tree_queue);
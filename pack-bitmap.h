@@ -120,12 +120,14 @@ struct bitmap_writer {
 
 	struct progress *progress;
 	int show_progress;
+	int nr_threads;
 	unsigned char pack_checksum[GIT_MAX_RAWSZ];
 };
 
 void bitmap_writer_init(struct bitmap_writer *writer, struct repository *r,
 			struct packing_data *pdata);
 void bitmap_writer_show_progress(struct bitmap_writer *writer, int show);
+void bitmap_writer_set_threads(struct bitmap_writer *writer, int nr_threads);
 void bitmap_writer_set_checksum(struct bitmap_writer *writer,
 				const unsigned char *sha1);
 void bitmap_writer_build_type_index(struct bitmap_writer *writer,
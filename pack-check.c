@@ -2,13 +2,16 @@
 
 #include "git-compat-util.h"
 #include "environment.h"
+#include "gettext.h"
 #include "hex.h"
 #include "repository.h"
 #include "pack.h"
 #include "progress.h"
+#include "strbuf.h"
 #include "packfile.h"
 #include "object-file.h"
 #include "object-store-ll.h"
+#include "thread-utils.h"
 
 struct idx_entry {
 	off_t                offset;
@@ -34,7 +37,15 @@ int check_pack_crc(struct packed_git *p, struct pack_window **w_curs,
 
 	do {
 		unsigned long avail;
-		void *data = use_pack(p, w_curs, offset, &avail);
+		void *data;
+
+		/*
+		 * Only mapping the window needs the lock; it stays mapped
+		 * through its in-use count while we checksum it.
+		 */
+		obj_read_lock();
+		data = use_pack(p, w_curs, offset, &avail);
+		obj_read_unlock();
 		if (avail > len)
 			avail = len;
 		data_crc = crc32(data_crc, data, avail);
@@ -48,11 +59,276 @@ int check_pack_crc(struct packed_git *p, struct pack_window **w_curs,
 	return data_crc != ntohl(*index_crc);
 }
 
+/*
+ * The outcome of checking one pack entry, as handed from verify_entry()
+ * to report_entry().
+ */
+struct verify_result {
+	struct object_id oid;
+	void *data;
+	unsigned long size;
+	enum object_type type;
+	int err;
+	unsigned check_ok:1;	/* hand the object to the verify_fn */
+	struct strbuf reports;	/* deferred messages, see verify_threaded() */
+};
+
+/*
+ * Inflate and hash the i-th entry (in pack order).  This is the bulk of
+ * the work and may run in a worker thread, in which case the object
+ * read lock has been enabled and protects the pack windows.
+ */
+static void verify_entry(struct repository *r, struct packed_git *p,
+			 struct pack_window **w_curs,
+			 const struct idx_entry *entries, uint32_t i,
+			 struct verify_result *res)
+{
+	void *data;
+	struct object_id *oid = &res->oid;
+	enum object_type type;
+	unsigned long size;
+	off_t curpos;
+	int data_valid;
+
+	res->err = 0;
+	res->check_ok = 0;
+
+	if (nth_packed_object_id(oid, p, entries[i].nr) < 0)
+		BUG("unable to get oid of object %lu from %s",
+		    (unsigned long)entries[i].nr, p->pack_name);
+
+	if (p->index_version > 1) {
+		off_t offset = entries[i].offset;
+		off_t len = entries[i+1].offset - offset;
+		unsigned int nr = entries[i].nr;
+		if (check_pack_crc(p, w_curs, offset, len, nr))
+			res->err = error("index CRC mismatch for object %s "
+					 "from %s at offset %"PRIuMAX"",
+					 oid_to_hex(oid),
+					 p->pack_name, (uintmax_t)offset);
+	}
+
+	obj_read_lock();
+	curpos = entries[i].offset;
+	type = unpack_object_header(p, w_curs, &curpos, &size);
+	unuse_pack(w_curs);
+
+	if (type == OBJ_BLOB && big_file_threshold <= size) {
+		/*
+		 * Let stream_object_signature() check it with
+		 * the streaming interface; no point slurping
+		 * the data in-core only to discard.
+		 */
+		data = NULL;
+		data_valid = 0;
+	} else {
+		data = unpack_entry(r, p, entries[i].offset, &type, &size);
+		data_valid = 1;
+	}
+	obj_read_unlock();
+
+	if (data_valid && !data)
+		res->err = error("cannot unpack %s from %s at offset %"PRIuMAX"",
+				 oid_to_hex(oid), p->pack_name,
+				 (uintmax_t)entries[i].offset);
+	else if (data && check_object_signature(r, oid, data, size,
+						type) < 0)
+		res->err = error("packed %s from %s is corrupt",
+				 oid_to_hex(oid), p->pack_name);
+	else if (!data) {
+		/* the streaming interface reads through the pack windows */
+		obj_read_lock();
+		if (stream_object_signature(r, oid) < 0)
+			res->err = error("packed %s from %s is corrupt",
+					 oid_to_hex(oid), p->pack_name);
+		else
+			res->check_ok = 1;
+		obj_read_unlock();
+	} else
+		res->check_ok = 1;
+
+	if (!res->check_ok)
+		FREE_AND_NULL(data);
+	res->data = data;
+	res->type = type;
+	res->size = size;
+}
+
+/*
+ * Hand an entry over to "fn", in pack order and on the calling
+ * thread, and release what verify_entry() kept of it.
+ */
+static int report_entry(struct verify_result *res, verify_fn fn)
+{
+	int err = res->err;
+
+	if (res->reports.len) {
+		fflush(stderr);
+		write_in_full(2, res->reports.buf, res->reports.len);
+		strbuf_reset(&res->reports);
+	}
+
+	if (res->check_ok && fn) {
+		int eaten = 0;
+
+		err |= fn(&res->oid, res->type, res->size, res->data, &eaten);
+		if (eaten)
+			res->data = NULL;
+	}
+	FREE_AND_NULL(res->data);
+	return err;
+}
+
+/*
+ * With more than one thread, the entries (in pack order) are cut into
+ * chunks of VERIFY_CHUNK which worker threads claim in order, inflate
+ * and hash, staying at most "window" chunks ahead of the calling
+ * thread.  The caller reports each chunk in turn once it is done, so
+ * the verify_fn sees objects in the same order as without threads and
+ * runs on the calling thread only.  Messages issued by the workers are
+ * deferred and printed along with the object they are about.
+ */
+#define VERIFY_CHUNK 64
+
+struct verify_threads {
+	struct repository *r;
+	struct packed_git *p;
+	const struct idx_entry *entries;
+	uint32_t nr_objects;
+	uint32_t nr_chunks;
+	uint32_t next_chunk;
+	uint32_t report_chunk;
+	uint32_t window;
+	struct verify_result *results;	/* window * VERIFY_CHUNK slots */
+	unsigned char *done;		/* one per slot chunk */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+static void *verify_thread(void *data)
+{
+	struct verify_threads *v = data;
+	struct pack_window *w_curs = NULL;
+
+	pthread_mutex_lock(&v->mutex);
+	for (;;) {
+		uint32_t chunk, i, end;
+
+		if (v->next_chunk >= v->nr_chunks)
+			break;
+		if (v->next_chunk >= v->report_chunk + v->window) {
+			pthread_cond_wait(&v->cond, &v->mutex);
+			continue;
+		}
+		chunk = v->next_chunk++;
+		pthread_mutex_unlock(&v->mutex);
+
+		i = chunk * VERIFY_CHUNK;
+		end = i + VERIFY_CHUNK;
+		if (end > v->nr_objects)
+			end = v->nr_objects;
+		for (; i < end; i++) {
+			struct verify_result *res =
+				&v->results[i % (v->window * VERIFY_CHUNK)];
+
+			defer_thread_reports(&res->reports);
+			verify_entry(v->r, v->p, &w_curs, v->entries, i, res);
+			defer_thread_reports(NULL);
+		}
+
+		pthread_mutex_lock(&v->mutex);
+		v->done[chunk % v->window] = 1;
+		pthread_cond_broadcast(&v->cond);
+	}
+	pthread_mutex_unlock(&v->mutex);
+
+	obj_read_lock();
+	unuse_pack(&w_curs);
+	obj_read_unlock();
+	return NULL;
+}
+
+static int verify_threaded(struct repository *r, struct packed_git *p,
+			   const struct idx_entry *entries, uint32_t nr_objects,
+			   verify_fn fn, struct progress *progress,
+			   uint32_t base_count, int nr_threads)
+{
+	struct verify_threads v = {
+		.r = r,
+		.p = p,
+		.entries = entries,
+		.nr_objects = nr_objects,
+		.nr_chunks = DIV_ROUND_UP(nr_objects, VERIFY_CHUNK),
+		.window = 4 * nr_threads,
+	};
+	int own_lock = !obj_read_use_lock;
+	pthread_t *threads;
+	uint32_t chunk, i, nr_slots;
+	int t, ret, err = 0;
+
+	nr_slots = v.window * VERIFY_CHUNK;
+	CALLOC_ARRAY(v.results, nr_slots);
+	for (i = 0; i < nr_slots; i++)
+		strbuf_init(&v.results[i].reports, 0);
+	CALLOC_ARRAY(v.done, v.window);
+	pthread_mutex_init(&v.mutex, NULL);
+	pthread_cond_init(&v.cond, NULL);
+
+	enable_obj_read_lock();
+	start_deferred_reports();
+	CALLOC_ARRAY(threads, nr_threads);
+	for (t = 0; t < nr_threads; t++) {
+		ret = pthread_create(&threads[t], NULL, verify_thread, &v);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+
+	for (chunk = 0, i = 0; chunk < v.nr_chunks; chunk++) {
+		uint32_t end = i + VERIFY_CHUNK;
+
+		if (end > nr_objects)
+			end = nr_objects;
+
+		pthread_mutex_lock(&v.mutex);
+		while (!v.done[chunk % v.window])
+			pthread_cond_wait(&v.cond, &v.mutex);
+		pthread_mutex_unlock(&v.mutex);
+
+		for (; i < end; i++) {
+			err |= report_entry(&v.results[i % nr_slots], fn);
+			if (((base_count + i) & 1023) == 0)
+				display_progress(progress, base_count + i);
+		}
+
+		pthread_mutex_lock(&v.mutex);
+		v.done[chunk % v.window] = 0;
+		v.report_chunk = chunk + 1;
+		pthread_cond_broadcast(&v.cond);
+		pthread_mutex_unlock(&v.mutex);
+	}
+
+	for (t = 0; t < nr_threads; t++)
+		pthread_join(threads[t], NULL);
+	stop_deferred_reports();
+	if (own_lock)
+		disable_obj_read_lock();
+
+	for (i = 0; i < nr_slots; i++)
+		strbuf_release(&v.results[i].reports);
+	free(v.results);
+	free(v.done);
+	free(threads);
+	pthread_cond_destroy(&v.cond);
+	pthread_mutex_destroy(&v.mutex);
+	return err;
+}
+
 static int verify_packfile(struct repository *r,
 			   struct packed_git *p,
 			   struct pack_window **w_curs,
 			   verify_fn fn,
-			   struct progress *progress, uint32_t base_count)
+			   struct progress *progress, uint32_t base_count,
+			   int nr_threads)
 
 {
 	off_t index_size = p->index_size;
@@ -103,67 +379,19 @@ static int verify_packfile(struct repository *r,
 	}
 	QSORT(entries, nr_objects, compare_entries);
 
-	for (i = 0; i < nr_objects; i++) {
-		void *data;
-		struct object_id oid;
-		enum object_type type;
-		unsigned long size;
-		off_t curpos;
-		int data_valid;
-
-		if (nth_packed_object_id(&oid, p, entries[i].nr) < 0)
-			BUG("unable to get oid of object %lu from %s",
-			    (unsigned long)entries[i].nr, p->pack_name);
-
-		if (p->index_version > 1) {
-			off_t offset = entries[i].offset;
-			off_t len = entries[i+1].offset - offset;
-			unsigned int nr = entries[i].nr;
-			if (check_pack_crc(p, w_curs, offset, len, nr))
-				err = error("index CRC mismatch for object %s "
-					    "from %s at offset %"PRIuMAX"",
-					    oid_to_hex(&oid),
-					    p->pack_name, (uintmax_t)offset);
-		}
-
-		curpos = entries[i].offset;
-		type = unpack_object_header(p, w_curs, &curpos, &size);
-		unuse_pack(w_curs);
-
-		if (type == OBJ_BLOB && big_file_threshold <= size) {
-			/*
-			 * Let stream_object_signature() check it with
-			 * the streaming interface; no point slurping
-			 * the data in-core only to discard.
-			 */
-			data = NULL;
-			data_valid = 0;
-		} else {
-			data = unpack_entry(r, p, entries[i].offset, &type, &size);
-			data_valid = 1;
-		}
+	if (HAVE_THREADS && nr_threads > 1 && nr_objects > VERIFY_CHUNK) {
+		err |= verify_threaded(r, p, entries, nr_objects, fn,
+				       progress, base_count, nr_threads);
+		i = nr_objects;
+	} else {
+		struct verify_result res = { .reports = STRBUF_INIT };
 
-		if (data_valid && !data)
-			err = error("cannot unpack %s from %s at offset %"PRIuMAX"",
-				    oid_to_hex(&oid), p->pack_name,
-				    (uintmax_t)entries[i].offset);
-		else if (data && check_object_signature(r, &oid, data, size,
-							type) < 0)
-			err = error("packed %s from %s is corrupt",
-				    oid_to_hex(&oid), p->pack_name);
-		else if (!data && stream_object_signature(r, &oid) < 0)
-			err = error("packed %s from %s is corrupt",
-				    oid_to_hex(&oid), p->pack_name);
-		else if (fn) {
-			int eaten = 0;
-			err |= fn(&oid, type, size, data, &eaten);
-			if (eaten)
-				data = NULL;
+		for (i = 0; i < nr_objects; i++) {
+			verify_entry(r, p, w_curs, entries, i, &res);
+			err |= report_entry(&res, fn);
+			if (((base_count + i) & 1023) == 0)
+				display_progress(progress, base_count + i);
 		}
-		if (((base_count + i) & 1023) == 0)
-			display_progress(progress, base_count + i);
-		free(data);
-
 	}
 	display_progress(progress, base_count + i);
 	free(entries);
@@ -186,7 +414,7 @@ int verify_pack_index(struct packed_git *p)
 }
 
 int verify_pack(struct repository *r, struct packed_git *p, verify_fn fn,
-		struct progress *progress, uint32_t base_count)
+		struct progress *progress, uint32_t base_count, int nr_threads)
 {
 	int err = 0;
 	struct pack_window *w_curs = NULL;
@@ -195,7 +423,8 @@ int verify_pack(struct repository *r, struct packed_git *p, verify_fn fn,
 	if (!p->index_data)
 		return -1;
 
-	err |= verify_packfile(r, p, &w_curs, fn, progress, base_count);
+	err |= verify_packfile(r, p, &w_curs, fn, progress, base_count,
+			       nr_threads);
 	unuse_pack(&w_curs);
 
 	return err;
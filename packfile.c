@@ -24,6 +24,7 @@
 #include "commit-graph.h"
 #include "pack-revindex.h"
 #include "promisor-remote.h"
+#include "trace2.h"
 
 char *odb_pack_name(struct strbuf *buf,
 		    const unsigned char *hash,
@@ -1370,10 +1371,26 @@ static enum object_type packed_to_object_type(struct repository *r,
 	goto out;
 }
 
-static struct hashmap delta_base_cache;
-static size_t delta_base_cached;
+/*
+ * The delta base cache is split into shards, picked by the hash of the
+ * (pack, offset) key, so that threads reading objects concurrently do
+ * not all contend on a single lock and LRU list.  Each shard owns an
+ * equal part of delta_base_cache_limit and only evicts from its own
+ * LRU list.  Unless set_delta_base_cache_threaded() was called there
+ * is a single, unlocked shard, which is the classic global cache.
+ */
+#define DELTA_BASE_CACHE_SHARDS 16
+
+struct delta_base_cache_shard {
+	struct hashmap map;
+	struct list_head lru;
+	size_t cached;
+	pthread_mutex_t mutex;
+};
 
-static LIST_HEAD(delta_base_cache_lru);
+static struct delta_base_cache_shard delta_base_cache[DELTA_BASE_CACHE_SHARDS];
+static unsigned int delta_base_cache_nr_shards = 1;
+static int delta_base_cache_threaded;
 
 struct delta_base_cache_key {
 	struct packed_git *p;
@@ -1398,22 +1415,6 @@ static unsigned int pack_entry_hash(struct packed_git *p, off_t base_offset)
 	return hash;
 }
 
-static struct delta_base_cache_entry *
-get_delta_base_cache_entry(struct packed_git *p, off_t base_offset)
-{
-	struct hashmap_entry entry, *e;
-	struct delta_base_cache_key key;
-
-	if (!delta_base_cache.cmpfn)
-		return NULL;
-
-	hashmap_entry_init(&entry, pack_entry_hash(p, base_offset));
-	key.p = p;
-	key.base_offset = base_offset;
-	e = hashmap_get(&delta_base_cache, &entry, &key);
-	return e ? container_of(e, struct delta_base_cache_entry, ent) : NULL;
-}
-
 static int delta_base_cache_key_eq(const struct delta_base_cache_key *a,
 				   const struct delta_base_cache_key *b)
 {
@@ -1437,21 +1438,75 @@ static int delta_base_cache_hash_cmp(const void *cmp_data UNUSED,
 		return !delta_base_cache_key_eq(&a->key, &b->key);
 }
 
+static void init_delta_base_cache_shard(struct delta_base_cache_shard *shard)
+{
+	if (shard->map.cmpfn)
+		return;
+	hashmap_init(&shard->map, delta_base_cache_hash_cmp, NULL, 0);
+	INIT_LIST_HEAD(&shard->lru);
+}
+
+/*
+ * Return the shard responsible for the given key, locked if the cache
+ * is in threaded mode; release it with unlock_delta_base_cache_shard().
+ */
+static struct delta_base_cache_shard *lock_delta_base_cache_shard(unsigned int hash)
+{
+	struct delta_base_cache_shard *shard;
+
+	shard = &delta_base_cache[hash % delta_base_cache_nr_shards];
+	if (delta_base_cache_threaded)
+		pthread_mutex_lock(&shard->mutex);
+	else
+		init_delta_base_cache_shard(shard);
+	return shard;
+}
+
+static void unlock_delta_base_cache_shard(struct delta_base_cache_shard *shard)
+{
+	if (delta_base_cache_threaded)
+		pthread_mutex_unlock(&shard->mutex);
+}
+
+/* The caller must hold the lock of "shard". */
+static struct delta_base_cache_entry *
+get_delta_base_cache_entry(struct delta_base_cache_shard *shard,
+			   unsigned int hash,
+			   struct packed_git *p, off_t base_offset)
+{
+	struct hashmap_entry entry, *e;
+	struct delta_base_cache_key key;
+
+	hashmap_entry_init(&entry, hash);
+	key.p = p;
+	key.base_offset = base_offset;
+	e = hashmap_get(&shard->map, &entry, &key);
+	return e ? container_of(e, struct delta_base_cache_entry, ent) : NULL;
+}
+
 static int in_delta_base_cache(struct packed_git *p, off_t base_offset)
 {
-	return !!get_delta_base_cache_entry(p, base_offset);
+	unsigned int hash = pack_entry_hash(p, base_offset);
+	struct delta_base_cache_shard *shard = lock_delta_base_cache_shard(hash);
+	int ret = !!get_delta_base_cache_entry(shard, hash, p, base_offset);
+
+	unlock_delta_base_cache_shard(shard);
+	return ret;
 }
 
 /*
  * Remove the entry from the cache, but do _not_ free the associated
  * entry data. The caller takes ownership of the "data" buffer, and
  * should copy out any fields it wants before detaching.
+ *
+ * The caller must hold the lock of "shard".
  */
-static void detach_delta_base_cache_entry(struct delta_base_cache_entry *ent)
+static void detach_delta_base_cache_entry(struct delta_base_cache_shard *shard,
+					  struct delta_base_cache_entry *ent)
 {
-	hashmap_remove(&delta_base_cache, &ent->ent, &ent->key);
+	hashmap_remove(&shard->map, &ent->ent, &ent->key);
 	list_del(&ent->lru);
-	delta_base_cached -= ent->size;
+	shard->cached -= ent->size;
 	free(ent);
 }
 
@@ -1459,59 +1514,122 @@ static void *cache_or_unpack_entry(struct repository *r, struct packed_git *p,
 				   off_t base_offset, unsigned long *base_size,
 				   enum object_type *type)
 {
+	unsigned int hash = pack_entry_hash(p, base_offset);
+	struct delta_base_cache_shard *shard;
 	struct delta_base_cache_entry *ent;
+	void *data;
+
+	/*
+	 * The shard lock alone protects the entry, so other readers may
+	 * proceed while we copy a potentially large base out of it.
+	 */
+	obj_read_unlock();
+	shard = lock_delta_base_cache_shard(hash);
+	ent = get_delta_base_cache_entry(shard, hash, p, base_offset);
+	if (ent) {
+		if (type)
+			*type = ent->type;
+		if (base_size)
+			*base_size = ent->size;
+		data = xmemdupz(ent->data, ent->size);
+	}
+	unlock_delta_base_cache_shard(shard);
+	obj_read_lock();
 
-	ent = get_delta_base_cache_entry(p, base_offset);
-	if (!ent)
+	if (!ent) {
+		/* unpack_entry() accounts for the miss */
 		return unpack_entry(r, p, base_offset, type, base_size);
+	}
 
-	if (type)
-		*type = ent->type;
-	if (base_size)
-		*base_size = ent->size;
-	return xmemdupz(ent->data, ent->size);
+	trace2_counter_add(TRACE2_COUNTER_ID_DELTA_BASE_CACHE_HIT, 1);
+	return data;
 }
 
-static inline void release_delta_base_cache(struct delta_base_cache_entry *ent)
+static inline void release_delta_base_cache(struct delta_base_cache_shard *shard,
+					    struct delta_base_cache_entry *ent)
 {
 	free(ent->data);
-	detach_delta_base_cache_entry(ent);
+	detach_delta_base_cache_entry(shard, ent);
 }
 
 void clear_delta_base_cache(void)
 {
-	struct list_head *lru, *tmp;
-	list_for_each_safe(lru, tmp, &delta_base_cache_lru) {
-		struct delta_base_cache_entry *entry =
-			list_entry(lru, struct delta_base_cache_entry, lru);
-		release_delta_base_cache(entry);
+	unsigned int i;
+
+	for (i = 0; i < delta_base_cache_nr_shards; i++) {
+		struct delta_base_cache_shard *shard = &delta_base_cache[i];
+		struct list_head *lru, *tmp;
+
+		if (!shard->map.cmpfn)
+			continue;
+		if (delta_base_cache_threaded)
+			pthread_mutex_lock(&shard->mutex);
+		list_for_each_safe(lru, tmp, &shard->lru) {
+			struct delta_base_cache_entry *entry =
+				list_entry(lru, struct delta_base_cache_entry, lru);
+			release_delta_base_cache(shard, entry);
+		}
+		if (delta_base_cache_threaded)
+			pthread_mutex_unlock(&shard->mutex);
+	}
+}
+
+void set_delta_base_cache_threaded(int threaded)
+{
+	unsigned int i;
+
+	if (delta_base_cache_threaded == !!threaded)
+		return;
+
+	/* entries would end up in the wrong shard; start afresh */
+	clear_delta_base_cache();
+
+	if (threaded) {
+		delta_base_cache_nr_shards = DELTA_BASE_CACHE_SHARDS;
+		for (i = 0; i < delta_base_cache_nr_shards; i++) {
+			init_delta_base_cache_shard(&delta_base_cache[i]);
+			pthread_mutex_init(&delta_base_cache[i].mutex, NULL);
+		}
+	} else {
+		for (i = 0; i < delta_base_cache_nr_shards; i++)
+			pthread_mutex_destroy(&delta_base_cache[i].mutex);
+		delta_base_cache_nr_shards = 1;
 	}
+	delta_base_cache_threaded = !!threaded;
 }
 
 static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 	void *base, unsigned long base_size, enum object_type type)
 {
+	unsigned int hash = pack_entry_hash(p, base_offset);
+	size_t limit = delta_base_cache_limit / delta_base_cache_nr_shards;
+	struct delta_base_cache_shard *shard;
 	struct delta_base_cache_entry *ent;
 	struct list_head *lru, *tmp;
+	uint64_t evicted = 0;
+
+	shard = lock_delta_base_cache_shard(hash);
 
 	/*
 	 * Check required to avoid redundant entries when more than one thread
 	 * is unpacking the same object, in unpack_entry() (since its phases I
 	 * and III might run concurrently across multiple threads).
 	 */
-	if (in_delta_base_cache(p, base_offset)) {
+	if (get_delta_base_cache_entry(shard, hash, p, base_offset)) {
+		unlock_delta_base_cache_shard(shard);
 		free(base);
 		return;
 	}
 
-	delta_base_cached += base_size;
+	shard->cached += base_size;
 
-	list_for_each_safe(lru, tmp, &delta_base_cache_lru) {
+	list_for_each_safe(lru, tmp, &shard->lru) {
 		struct delta_base_cache_entry *f =
 			list_entry(lru, struct delta_base_cache_entry, lru);
-		if (delta_base_cached <= delta_base_cache_limit)
+		if (shard->cached <= limit)
 			break;
-		release_delta_base_cache(f);
+		release_delta_base_cache(shard, f);
+		evicted++;
 	}
 
 	ent = xmalloc(sizeof(*ent));
@@ -1520,12 +1638,15 @@ static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 	ent->type = type;
 	ent->data = base;
 	ent->size = base_size;
-	list_add_tail(&ent->lru, &delta_base_cache_lru);
+	list_add_tail(&ent->lru, &shard->lru);
 
-	if (!delta_base_cache.cmpfn)
-		hashmap_init(&delta_base_cache, delta_base_cache_hash_cmp, NULL, 0);
-	hashmap_entry_init(&ent->ent, pack_entry_hash(p, base_offset));
-	hashmap_add(&delta_base_cache, &ent->ent);
+	hashmap_entry_init(&ent->ent, hash);
+	hashmap_add(&shard->map, &ent->ent);
+	unlock_delta_base_cache_shard(shard);
+
+	if (evicted)
+		trace2_counter_add(TRACE2_COUNTER_ID_DELTA_BASE_CACHE_EVICT,
+				   evicted);
 }
 
 int packed_object_info(struct repository *r, struct packed_git *p,
@@ -1697,17 +1818,23 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 	for (;;) {
 		off_t base_offset;
 		int i;
+		unsigned int hash = pack_entry_hash(p, curpos);
+		struct delta_base_cache_shard *shard;
 		struct delta_base_cache_entry *ent;
 
-		ent = get_delta_base_cache_entry(p, curpos);
+		shard = lock_delta_base_cache_shard(hash);
+		ent = get_delta_base_cache_entry(shard, hash, p, curpos);
 		if (ent) {
 			type = ent->type;
 			data = ent->data;
 			size = ent->size;
-			detach_delta_base_cache_entry(ent);
+			detach_delta_base_cache_entry(shard, ent);
+			unlock_delta_base_cache_shard(shard);
+			trace2_counter_add(TRACE2_COUNTER_ID_DELTA_BASE_CACHE_HIT, 1);
 			base_from_cache = 1;
 			break;
 		}
+		unlock_delta_base_cache_shard(shard);
 
 		if (do_check_packed_object_crc && p->index_version > 1) {
 			uint32_t pack_pos, index_pos;
@@ -1765,6 +1892,10 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 		curpos = obj_offset = base_offset;
 	}
 
+	/* one miss for the whole chain, however long it is */
+	if (!base_from_cache)
+		trace2_counter_add(TRACE2_COUNTER_ID_DELTA_BASE_CACHE_MISS, 1);
+
 	/* PHASE 2: handle the base */
 	switch (type) {
 	case OBJ_OFS_DELTA:
@@ -1846,8 +1977,14 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 			      (uintmax_t)curpos, p->pack_name);
 			data = NULL;
 		} else {
+			/*
+			 * Both buffers are private to us, so the delta can
+			 * be applied while other threads read objects.
+			 */
+			obj_read_unlock();
 			data = patch_delta(base, base_size, delta_data,
 					   delta_size, &size);
+			obj_read_lock();
 
 			/*
 			 * We could not apply the delta; warn the user, but
@@ -1864,11 +2001,11 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 
 		/*
 		 * We delay adding `base` to the cache until the end of the loop
-		 * because unpack_compressed_entry() momentarily releases the
-		 * obj_read_mutex, giving another thread the chance to access
-		 * the cache. Therefore, if `base` was already there, this other
-		 * thread could free() it (e.g. to make space for another entry)
-		 * before we are done using it.
+		 * because unpack_compressed_entry() and patch_delta() above
+		 * momentarily release the obj_read_mutex, giving another thread
+		 * the chance to access the cache. Therefore, if `base` was
+		 * already there, this other thread could free() it (e.g. to
+		 * make space for another entry) before we are done using it.
 		 */
 		if (!external_base)
 			add_delta_base_cache(p, base_obj_offset, base, base_size, type);
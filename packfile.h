@@ -113,6 +113,13 @@ void close_pack(struct packed_git *);
 void close_object_store(struct raw_object_store *o);
 void unuse_pack(struct pack_window **);
 void clear_delta_base_cache(void);
+
+/*
+ * Switch the delta base cache between a single unlocked cache and a
+ * sharded cache with a lock per shard, for use by concurrent readers.
+ * Either switch empties the cache.
+ */
+void set_delta_base_cache_threaded(int threaded);
 struct packed_git *add_packed_git(const char *path, size_t path_len, int local);
 
 /*
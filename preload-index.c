@@ -2,6 +2,7 @@
  * Copyright (C) 2008 Linus Torvalds
  */
 #include "git-compat-util.h"
+#include "compat/lstat-batch.h"
 #include "pathspec.h"
 #include "dir.h"
 #include "environment.h"
@@ -13,6 +14,7 @@
 #include "read-cache.h"
 #include "thread-utils.h"
 #include "repository.h"
+#include "string-list.h"
 #include "symlinks.h"
 #include "trace2.h"
 
@@ -25,6 +27,12 @@
 #define MAX_PARALLEL (20)
 #define THREAD_COST (500)
 
+/*
+ * Where the platform lets us, each thread hands this many lstat()
+ * calls to the kernel at once (see core.ioUring).
+ */
+#define LSTAT_BATCH (128)
+
 struct progress_data {
 	unsigned long n;
 	struct progress *progress;
@@ -38,8 +46,54 @@ struct thread_data {
 	struct progress_data *progress;
 	int offset, nr;
 	int t2_nr_lstat;
+	int t2_nr_lstat_batch;
 };
 
+struct lstat_queue {
+	struct lstat_batch *batch;
+	unsigned int nr;
+	struct cache_entry *ce[LSTAT_BATCH];
+	const char *path[LSTAT_BATCH];
+	struct stat st[LSTAT_BATCH];
+	int err[LSTAT_BATCH];
+};
+
+static void preload_one(struct index_state *index, struct cache_entry *ce,
+			struct stat *st)
+{
+	if (ie_match_stat(index, ce, st, CE_MATCH_RACY_IS_DIRTY|CE_MATCH_IGNORE_FSMONITOR))
+		return;
+	ce_mark_uptodate(ce);
+	mark_fsmonitor_valid(index, ce);
+}
+
+static void flush_lstat_queue(struct index_state *index, struct lstat_queue *q,
+			      struct thread_data *p)
+{
+	unsigned int i;
+
+	if (!q->nr)
+		return;
+
+	if (!lstat_batch_run(q->batch, q->path, q->st, q->err, q->nr)) {
+		p->t2_nr_lstat_batch++;
+		for (i = 0; i < q->nr; i++)
+			if (!q->err[i])
+				preload_one(index, q->ce[i], &q->st[i]);
+	} else {
+		/* give up on batching and do it one by one from now on */
+		lstat_batch_release(q->batch);
+		q->batch = NULL;
+		for (i = 0; i < q->nr; i++) {
+			struct stat st;
+
+			if (!lstat(q->path[i], &st))
+				preload_one(index, q->ce[i], &st);
+		}
+	}
+	q->nr = 0;
+}
+
 static void *preload_thread(void *_data)
 {
 	int nr, last_nr;
@@ -47,6 +101,16 @@ static void *preload_thread(void *_data)
 	struct index_state *index = p->index;
 	struct cache_entry **cep = index->cache + p->offset;
 	struct cache_def cache = CACHE_DEF_INIT;
+	struct lstat_queue *queue = NULL;
+
+	if (core_io_uring) {
+		struct lstat_batch *batch = lstat_batch_init(LSTAT_BATCH);
+
+		if (batch) {
+			CALLOC_ARRAY(queue, 1);
+			queue->batch = batch;
+		}
+	}
 
 	nr = p->nr;
 	if (nr + p->offset > index->cache_nr)
@@ -81,13 +145,22 @@ static void *preload_thread(void *_data)
 		if (threaded_has_symlink_leading_path(&cache, ce->name, ce_namelen(ce)))
 			continue;
 		p->t2_nr_lstat++;
-		if (lstat(ce->name, &st))
+		if (queue && queue->batch) {
+			queue->ce[queue->nr] = ce;
+			queue->path[queue->nr] = ce->name;
+			if (++queue->nr == LSTAT_BATCH)
+				flush_lstat_queue(index, queue, p);
 			continue;
-		if (ie_match_stat(index, ce, &st, CE_MATCH_RACY_IS_DIRTY|CE_MATCH_IGNORE_FSMONITOR))
+		}
+		if (lstat(ce->name, &st))
 			continue;
-		ce_mark_uptodate(ce);
-		mark_fsmonitor_valid(index, ce);
+		preload_one(index, ce, &st);
 	} while (--nr > 0);
+	if (queue) {
+		flush_lstat_queue(index, queue, p);
+		lstat_batch_release(queue->batch);
+		free(queue);
+	}
 	if (p->progress) {
 		struct progress_data *pd = p->progress;
 
@@ -107,6 +180,7 @@ void preload_index(struct index_state *index,
 	struct thread_data data[MAX_PARALLEL];
 	struct progress_data pd;
 	int t2_sum_lstat = 0;
+	int t2_sum_lstat_batch = 0;
 
 	if (!HAVE_THREADS || !core_preload_index)
 		return;
@@ -154,6 +228,7 @@ void preload_index(struct index_state *index,
 		if (pthread_join(p->pthread, NULL))
 			die("unable to join threaded lstat");
 		t2_sum_lstat += p->t2_nr_lstat;
+		t2_sum_lstat_batch += p->t2_nr_lstat_batch;
 	}
 	stop_progress(&pd.progress);
 
@@ -166,9 +241,169 @@ void preload_index(struct index_state *index,
 	trace_performance_leave("preload index");
 
 	trace2_data_intmax("index", NULL, "preload/sum_lstat", t2_sum_lstat);
+	if (t2_sum_lstat_batch)
+		trace2_data_intmax("index", NULL, "preload/sum_lstat_batch",
+				   t2_sum_lstat_batch);
 	trace2_region_leave("index", "preload", NULL);
 }
 
+/*
+ * Reading a directory costs more than an lstat, so we are happy with
+ * fewer of them per thread.
+ */
+#define DIR_THREAD_COST (100)
+
+struct dir_thread_data {
+	pthread_t pthread;
+	struct string_list *dirs;
+	int offset, nr;
+};
+
+struct preload_dirs {
+	struct string_list dirs;
+	struct dir_thread_data data[MAX_PARALLEL];
+	int threads;
+};
+
+static void *preload_dir_thread(void *_data)
+{
+	struct dir_thread_data *p = _data;
+	struct strbuf path = STRBUF_INIT;
+	int i;
+
+	for (i = p->offset; i < p->offset + p->nr && i < p->dirs->nr; i++) {
+		const char *name = p->dirs->items[i].string;
+		DIR *dir;
+		struct dirent *de;
+		struct stat st;
+		size_t len;
+
+		strbuf_reset(&path);
+		strbuf_addstr(&path, name);
+		len = path.len;
+
+		dir = opendir(*name ? name : ".");
+		if (!dir)
+			continue;
+		while ((de = readdir_skip_dot_and_dotdot(dir))) {
+			if (DTYPE(de) != DT_UNKNOWN)
+				continue;
+			strbuf_setlen(&path, len);
+			strbuf_addstr(&path, de->d_name);
+			lstat(path.buf, &st);
+		}
+		closedir(dir);
+
+		/* read_directory() will look for one in every directory */
+		strbuf_setlen(&path, len);
+		strbuf_addstr(&path, ".gitignore");
+		lstat(path.buf, &st);
+	}
+
+	strbuf_release(&path);
+	return NULL;
+}
+
+struct preload_dirs *start_preload_tracked_directories(struct index_state *index,
+						       const char *prefix,
+						       int prefix_len)
+{
+	struct preload_dirs *pd;
+	const char *prev = "";
+	int i, work, threads;
+
+	if (!HAVE_THREADS)
+		return NULL;
+	/* e.g. "git grep --no-index" outside of a repository */
+	if (!index->repo || !index->repo->gitdir)
+		return NULL;
+	prepare_repo_settings(index->repo);
+	if (!index->repo->settings.core_preload_tracked_directories)
+		return NULL;
+
+	CALLOC_ARRAY(pd, 1);
+	string_list_init_dup(&pd->dirs);
+
+	/*
+	 * Collect the directories with tracked files in them. The index
+	 * is sorted, so the entries of a directory are contiguous and the
+	 * directories we have not seen yet are those below the part of the
+	 * name an entry has in common with the previous one.
+	 */
+	string_list_append_nodup(&pd->dirs, xmemdupz(prefix, prefix_len));
+	for (i = 0; i < index->cache_nr; i++) {
+		const struct cache_entry *ce = index->cache[i];
+		const char *name = ce->name, *slash;
+		size_t common = 0;
+
+		if (ce_skip_worktree(ce) ||
+		    strncmp(name, prefix, prefix_len))
+			continue;
+
+		while (name[common] && name[common] == prev[common])
+			common++;
+		while (common > 0 && name[common - 1] != '/')
+			common--;
+		if (common < prefix_len)
+			common = prefix_len;
+
+		for (slash = strchr(name + common, '/'); slash;
+		     slash = strchr(slash + 1, '/'))
+			string_list_append_nodup(&pd->dirs,
+				xmemdupz(name, slash - name + 1));
+		prev = name;
+	}
+
+	threads = pd->dirs.nr / DIR_THREAD_COST;
+	if (pd->dirs.nr > 1 && threads < 2 &&
+	    git_env_bool("GIT_TEST_PRELOAD_INDEX", 0))
+		threads = 2;
+	if (threads < 2) {
+		finish_preload_tracked_directories(pd);
+		return NULL;
+	}
+	if (threads > MAX_PARALLEL)
+		threads = MAX_PARALLEL;
+
+	trace2_region_enter("index", "preload_tracked_directories", NULL);
+
+	work = DIV_ROUND_UP(pd->dirs.nr, threads);
+	for (i = 0; i < threads; i++) {
+		struct dir_thread_data *p = pd->data + i;
+		int err;
+
+		p->dirs = &pd->dirs;
+		p->offset = i * work;
+		p->nr = work;
+		err = pthread_create(&p->pthread, NULL, preload_dir_thread, p);
+		if (err)
+			die(_("unable to create threaded readdir: %s"), strerror(err));
+		pd->threads++;
+	}
+
+	return pd;
+}
+
+void finish_preload_tracked_directories(struct preload_dirs *pd)
+{
+	int i;
+
+	if (!pd)
+		return;
+
+	for (i = 0; i < pd->threads; i++)
+		if (pthread_join(pd->data[i].pthread, NULL))
+			die("unable to join threaded readdir");
+	if (pd->threads) {
+		trace2_data_intmax("index", NULL, "preload/tracked_directories",
+				   pd->dirs.nr);
+		trace2_region_leave("index", "preload_tracked_directories", NULL);
+	}
+
+	string_list_clear(&pd->dirs, 0);
+	free(pd);
+}
+
 int repo_read_index_preload(struct repository *repo,
 			    const struct pathspec *pathspec,
 			    unsigned int refresh_flags)
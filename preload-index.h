@@ -3,11 +3,28 @@
 
 struct index_state;
 struct pathspec;
+struct preload_dirs;
 struct repository;
 
 void preload_index(struct index_state *index,
 		   const struct pathspec *pathspec,
 		   unsigned int refresh_flags);
+
+/*
+ * Start reading the directories below "prefix" that contain tracked
+ * files in the background, so that read_directory() finds them in the
+ * operating system's caches as it walks the working tree. Untracked
+ * directories are not known before the walk gets to them, and are not
+ * read ahead. Returns NULL if core.preloadTrackedDirectories is not set
+ * or there is not enough to do; otherwise call
+ * finish_preload_tracked_directories() on the result once the walk is
+ * done.
+ */
+struct preload_dirs *start_preload_tracked_directories(struct index_state *index,
+						       const char *prefix,
+						       int prefix_len);
+void finish_preload_tracked_directories(struct preload_dirs *pd);
+
 int repo_read_index_preload(struct repository *,
 			    const struct pathspec *pathspec,
 			    unsigned refresh_flags);
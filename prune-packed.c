@@ -1,12 +1,16 @@
+#define USE_THE_REPOSITORY_VARIABLE
+
 #include "git-compat-util.h"
 #include "environment.h"
 #include "gettext.h"
+#include "loose-index.h"
 #include "object-store-ll.h"
 #include "packfile.h"
 #include "progress.h"
 #include "prune-packed.h"
 
 static struct progress *progress;
+static int removed;
 
 static int prune_subdir(unsigned int nr, const char *path, void *data)
 {
@@ -25,10 +29,13 @@ static int prune_object(const struct object_id *oid, const char *path,
 	if (!has_object_pack(oid))
 		return 0;
 
-	if (*opts & PRUNE_PACKED_DRY_RUN)
+	if (*opts & PRUNE_PACKED_DRY_RUN) {
 		printf("rm -f %s\n", path);
-	else
-		unlink_or_warn(path);
+		return 0;
+	}
+	if (!removed++)
+		loose_index_invalidate(the_repository->objects->odb);
+	unlink_or_warn(path);
 	return 0;
 }
 
@@ -43,4 +50,8 @@ void prune_packed_objects(int opts)
 	/* Ensure we show 100% before finishing progress */
 	display_progress(progress, 256);
 	stop_progress(&progress);
+
+	/* in case it was rewritten while we were removing objects */
+	if (removed)
+		loose_index_invalidate(the_repository->objects->odb);
 }
@@ -69,6 +69,7 @@
 #define CACHE_EXT_ENDOFINDEXENTRIES 0x454F4945	/* "EOIE" */
 #define CACHE_EXT_INDEXENTRYOFFSETTABLE 0x49454F54 /* "IEOT" */
 #define CACHE_EXT_SPARSE_DIRECTORIES 0x73646972 /* "sdir" */
+#define CACHE_EXT_BLOCKCRC 0x42435243	  /* "BCRC" */
 
 /* changes that can be kept in $GIT_DIR/index (basically all extensions) */
 #define EXTMASK (RESOLVE_UNDO_CHANGED | CACHE_TREE_CHANGED | \
@@ -534,14 +535,15 @@ static int index_name_stage_pos(struct index_state *istate,
 		/*
 		 * If we are in a sparse-index _and_ the entry before the
 		 * insertion position is a sparse-directory entry that is
-		 * an ancestor of 'name', then we need to expand the index
-		 * and search again. This will only trigger once, because
-		 * thereafter the index is fully expanded.
+		 * an ancestor of 'name', then we need to expand that
+		 * directory and search again. Each round expands a
+		 * directory closer to 'name', so this terminates.
 		 */
 		if (S_ISSPARSEDIR(ce->ce_mode) &&
 		    ce_namelen(ce) < namelen &&
 		    !strncmp(name, ce->name, ce_namelen(ce))) {
-			ensure_full_index(istate);
+			if (expand_sparse_directory(istate, first - 1))
+				ensure_full_index(istate);
 			return index_name_stage_pos(istate, name, namelen, stage, search_mode);
 		}
 	}
@@ -1767,6 +1769,9 @@ static int read_index_extension(struct index_state *istate,
 	case CACHE_EXT_INDEXENTRYOFFSETTABLE:
 		/* already handled in do_read_index() */
 		break;
+	case CACHE_EXT_BLOCKCRC:
+		/* only used by load_index_extensions() when verifying */
+		break;
 	case CACHE_EXT_SPARSE_DIRECTORIES:
 		/* no content, only an indicator */
 		istate->sparse_index = INDEX_COLLAPSED;
@@ -1945,8 +1950,14 @@ static void tweak_untracked_cache(struct index_state *istate)
 
 static void tweak_split_index(struct index_state *istate)
 {
+	int min_entries;
+
 	switch (repo_config_get_split_index(the_repository)) {
-	case -1: /* unset: do nothing */
+	case -1: /* unset: split large enough indexes, if configured */
+		min_entries = repo_config_get_split_index_min_entries(the_repository);
+		if (min_entries && istate->cache_nr >= min_entries &&
+		    !istate->sparse_index)
+			add_split_index(istate);
 		break;
 	case 0: /* false */
 		remove_split_index(istate);
@@ -2001,6 +2012,11 @@ static void write_ieot_extension(struct strbuf *sb, struct index_entry_offset_ta
 static size_t read_eoie_extension(const char *mmap, size_t mmap_size);
 static void write_eoie_extension(struct strbuf *sb, git_hash_ctx *eoie_context, size_t offset);
 
+static int verify_bcrc_extension(const char *mmap, size_t offset,
+				 const char *data, unsigned long sz);
+struct block_crc_table;
+static void write_bcrc_extension(struct strbuf *sb, struct block_crc_table *bcrc);
+
 struct load_index_extensions
 {
 	pthread_t pthread;
@@ -2023,6 +2039,13 @@ static void *load_index_extensions(void *_data)
 		 * in 4-byte network byte order.
 		 */
 		uint32_t extsize = get_be32(p->mmap + src_offset + 4);
+		if (verify_index_checksum &&
+		    CACHE_EXT((p->mmap + src_offset)) == CACHE_EXT_BLOCKCRC &&
+		    verify_bcrc_extension(p->mmap, src_offset,
+					  p->mmap + src_offset + 8, extsize) < 0) {
+			munmap((void *)p->mmap, p->mmap_size);
+			die(_("index file corrupt"));
+		}
 		if (read_index_extension(p->istate,
 					 p->mmap + src_offset,
 					 p->mmap + src_offset + 8,
@@ -2073,7 +2096,13 @@ static unsigned long load_all_cache_entries(struct index_state *istate,
 		mem_pool_init(istate->ce_mem_pool,
 				estimate_cache_size_from_compressed(istate->cache_nr));
 	} else {
-		mem_pool_init(istate->ce_mem_pool,
+		/*
+		 * The estimate is close (it only overshoots by the size
+		 * of the extensions), and we are about to write to every
+		 * page of it. With large indexes, taking a page fault on
+		 * each of them costs more than parsing the entries.
+		 */
+		mem_pool_init_prefault(istate->ce_mem_pool,
 				estimate_cache_size(mmap_size, istate->cache_nr));
 	}
 
@@ -2805,6 +2834,32 @@ static int record_ieot(void)
 	return !repo_config_get_index_threads(the_repository, &val) && val != 1;
 }
 
+/*
+ * Without a trailing hash (index.skipHash), we record a CRC32 of each
+ * block of the file in the BCRC extension instead, so that corruption
+ * can still be detected by "git fsck" at a fraction of the cost. The
+ * blocks follow the IEOT blocks of cache entries, plus one for the
+ * header and one for the extensions written before BCRC.
+ */
+struct block_crc_table {
+	int nr, alloc;
+	struct block_crc {
+		uint32_t offset, crc;
+	} *entries;
+};
+
+static void block_crc_start(struct hashfile *f, struct block_crc_table *t)
+{
+	ALLOC_GROW(t->entries, t->nr + 1, t->alloc);
+	t->entries[t->nr++].offset = hashfile_total(f);
+	crc32_begin(f);
+}
+
+static void block_crc_end(struct hashfile *f, struct block_crc_table *t)
+{
+	t->entries[t->nr - 1].crc = crc32_end(f);
+}
+
 enum write_extensions {
 	WRITE_NO_EXTENSION =              0,
 	WRITE_SPLIT_INDEX_EXTENSION =     1<<0,
@@ -2840,6 +2895,7 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	int csum_fsync_flag;
 	int ieot_entries = 1;
 	struct index_entry_offset_table *ieot = NULL;
+	struct block_crc_table *bcrc = NULL;
 	struct repository *r = istate->repo;
 	struct strbuf sb = STRBUF_INIT;
 	int nr, nr_threads, ret;
@@ -2848,6 +2904,10 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 
 	prepare_repo_settings(r);
 	f->skip_hash = r->settings.index_skip_hash;
+	if (f->skip_hash) {
+		CALLOC_ARRAY(bcrc, 1);
+		block_crc_start(f, bcrc);
+	}
 
 	for (i = removed = extended = 0; i < entries; i++) {
 		if (cache[i]->ce_flags & CE_REMOVE)
@@ -2947,6 +3007,10 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 			nr = 0;
 
 			offset = hashfile_total(f);
+			if (bcrc) {
+				block_crc_end(f, bcrc);
+				block_crc_start(f, bcrc);
+			}
 		}
 		if (ce_write_entry(f, ce, previous_name, (struct ondisk_cache_entry *)&ondisk) < 0)
 			err = -1;
@@ -2968,6 +3032,10 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 	}
 
 	offset = hashfile_total(f);
+	if (bcrc) {
+		block_crc_end(f, bcrc);
+		block_crc_start(f, bcrc);
+	}
 
 	/*
 	 * The extension headers must be hashed on their own for the
@@ -3070,6 +3138,19 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		}
 	}
 
+	if (bcrc) {
+		block_crc_end(f, bcrc);
+		strbuf_reset(&sb);
+
+		write_bcrc_extension(&sb, bcrc);
+		err = write_index_ext_header(f, eoie_c, CACHE_EXT_BLOCKCRC, sb.len) < 0;
+		hashwrite(f, sb.buf, sb.len);
+		if (err) {
+			ret = -1;
+			goto out;
+		}
+	}
+
 	/*
 	 * CACHE_EXT_ENDOFINDEXENTRIES must be written as the last entry before the SHA1
 	 * so that it can be found and processed before all the index entries are
@@ -3124,6 +3205,9 @@ static int do_write_index(struct index_state *istate, struct tempfile *tempfile,
 		free_hashfile(f);
 	strbuf_release(&sb);
 	free(ieot);
+	if (bcrc)
+		free(bcrc->entries);
+	free(bcrc);
 	return ret;
 }
 
@@ -3730,6 +3814,65 @@ static void write_ieot_extension(struct strbuf *sb, struct index_entry_offset_ta
 	}
 }
 
+#define BCRC_VERSION	(1)
+
+/*
+ * Check the CRCs recorded in the BCRC extension found at "offset", which
+ * cover everything in "mmap" before it.
+ */
+static int verify_bcrc_extension(const char *mmap, size_t offset,
+				 const char *data, unsigned long sz)
+{
+	uint32_t ext_version;
+	unsigned long i, nr;
+
+	if (sz < sizeof(uint32_t) + sizeof(uint32_t) + sizeof(uint32_t) ||
+	    (sz - sizeof(uint32_t)) % (sizeof(uint32_t) + sizeof(uint32_t)))
+		return error(_("invalid BCRC extension size %lu"), sz);
+
+	/* a later format we do not know how to check */
+	ext_version = get_be32(data);
+	if (ext_version != BCRC_VERSION)
+		return 0;
+	data += sizeof(uint32_t);
+
+	nr = (sz - sizeof(uint32_t)) / (sizeof(uint32_t) + sizeof(uint32_t));
+	for (i = 0; i < nr; i++) {
+		size_t start = get_be32(data + 8 * i);
+		size_t end = i + 1 < nr ? get_be32(data + 8 * (i + 1)) : offset;
+		uint32_t crc = get_be32(data + 8 * i + 4);
+
+		if ((!i && start) || end < start || offset < end)
+			return error(_("invalid BCRC extension"));
+		if (crc32(crc32(0, NULL, 0),
+			  (const unsigned char *)mmap + start, end - start) != crc)
+			return error(_("bad index file crc at offset %"PRIuMAX),
+				     (uintmax_t)start);
+	}
+
+	return 0;
+}
+
+static void write_bcrc_extension(struct strbuf *sb, struct block_crc_table *bcrc)
+{
+	uint32_t buffer;
+	int i;
+
+	/* version */
+	put_be32(&buffer, BCRC_VERSION);
+	strbuf_add(sb, &buffer, sizeof(uint32_t));
+
+	for (i = 0; i < bcrc->nr; i++) {
+		/* offset */
+		put_be32(&buffer, bcrc->entries[i].offset);
+		strbuf_add(sb, &buffer, sizeof(uint32_t));
+
+		/* crc */
+		put_be32(&buffer, bcrc->entries[i].crc);
+		strbuf_add(sb, &buffer, sizeof(uint32_t));
+	}
+}
+
 void prefetch_cache_entries(const struct index_state *istate,
 			    must_prefetch_predicate must_prefetch)
 {
@@ -65,6 +65,8 @@ struct repo_settings {
 	enum fetch_negotiation_setting fetch_negotiation_algorithm;
 
 	int core_multi_pack_index;
+	int core_loose_object_index;
+	int core_preload_tracked_directories;
 };
 
 struct repo_path_cache {
@@ -455,6 +455,97 @@ void ensure_full_index(struct index_state *istate)
 	expand_index(istate, NULL);
 }
 
+struct expand_dir_context {
+	struct index_state *istate;
+	struct cache_entry **entries;
+	size_t nr, alloc;
+};
+
+static int add_sparse_dir_child(const struct object_id *oid,
+				struct strbuf *base, const char *path,
+				unsigned int mode, void *context)
+{
+	struct expand_dir_context *ctx = context;
+	struct cache_entry *ce;
+	size_t len = base->len;
+
+	strbuf_addstr(base, path);
+	if (S_ISDIR(mode))
+		strbuf_addch(base, '/');
+
+	ce = make_cache_entry(ctx->istate, mode, oid, base->buf, 0, 0);
+	ce->ce_flags |= CE_SKIP_WORKTREE | CE_EXTENDED;
+	ALLOC_GROW(ctx->entries, ctx->nr + 1, ctx->alloc);
+	ctx->entries[ctx->nr++] = ce;
+
+	strbuf_setlen(base, len);
+
+	/* subdirectories stay sparse directories */
+	return 0;
+}
+
+int expand_sparse_directory(struct index_state *istate, int pos)
+{
+	struct cache_entry *ce = istate->cache[pos];
+	struct expand_dir_context ctx = { .istate = istate };
+	struct strbuf base = STRBUF_INIT;
+	struct pathspec ps;
+	struct tree *tree;
+	size_t i;
+
+	if (!S_ISSPARSEDIR(ce->ce_mode))
+		BUG("index entry '%s' is not a sparse directory", ce->name);
+
+	trace2_region_enter("index", "expand_sparse_directory", istate->repo);
+
+	memset(&ps, 0, sizeof(ps));
+	ps.recursive = 1;
+	ps.has_wildcard = 1;
+	ps.max_depth = -1;
+
+	tree = lookup_tree(istate->repo, &ce->oid);
+	strbuf_add(&base, ce->name, ce_namelen(ce));
+	if (!tree ||
+	    read_tree_at(istate->repo, tree, &base, 0, &ps,
+			 add_sparse_dir_child, &ctx) ||
+	    !ctx.nr) {
+		for (i = 0; i < ctx.nr; i++)
+			discard_cache_entry(ctx.entries[i]);
+		free(ctx.entries);
+		strbuf_release(&base);
+		trace2_region_leave("index", "expand_sparse_directory", istate->repo);
+		return -1;
+	}
+	strbuf_release(&base);
+
+	/* replace the sparse directory with the entries of its tree */
+	remove_name_hash(istate, ce);
+	ALLOC_GROW(istate->cache, istate->cache_nr + ctx.nr - 1, istate->cache_alloc);
+	MOVE_ARRAY(istate->cache + pos + ctx.nr, istate->cache + pos + 1,
+		   istate->cache_nr - pos - 1);
+	for (i = 0; i < ctx.nr; i++) {
+		istate->cache[pos + i] = ctx.entries[i];
+		add_name_hash(istate, ctx.entries[i]);
+	}
+	istate->cache_nr += ctx.nr - 1;
+	free(ctx.entries);
+
+	/*
+	 * The trees have not changed, but the cache tree counts index
+	 * entries; and as in expand_index(), the fsmonitor bits refer to
+	 * positions that have moved.
+	 */
+	cache_tree_invalidate_path(istate, ce->name);
+	discard_cache_entry(ce);
+	istate->sparse_index = INDEX_PARTIALLY_SPARSE;
+	istate->fsmonitor_has_run_once = 0;
+	FREE_AND_NULL(istate->fsmonitor_dirty);
+	FREE_AND_NULL(istate->fsmonitor_last_update);
+
+	trace2_region_leave("index", "expand_sparse_directory", istate->repo);
+	return 0;
+}
+
 void ensure_correct_sparsity(struct index_state *istate)
 {
 	/*
@@ -727,10 +818,17 @@ void expand_to_path(struct index_state *istate,
 			 * hashtable, because only sparse directory entries
 			 * have a trailing '/' character.  Since "path" wasn't
 			 * in the index, perhaps it exists within this
-			 * sparse-directory.  Expand accordingly.
+			 * sparse-directory.  Expand just this directory and
+			 * keep looking for sparse directories further down.
 			 */
-			ensure_full_index(istate);
-			break;
+			int pos = index_name_pos_sparse(istate, path_mutable.buf,
+							substr_len);
+
+			if (pos < 0 || expand_sparse_directory(istate, pos)) {
+				/* e.g. found with different case */
+				ensure_full_index(istate);
+				break;
+			}
 		}
 
 		*replace = temp;
@@ -39,4 +39,13 @@ void expand_index(struct index_state *istate, struct pattern_list *pl);
 
 void ensure_full_index(struct index_state *istate);
 
+/*
+ * Replace the sparse directory entry at position "pos" of the index with
+ * the entries of its tree, one level deep: files become skip-worktree file
+ * entries and subdirectories become sparse directory entries in turn. The
+ * rest of the index stays sparse. Returns -1 (leaving the index as it
+ * was) if the tree cannot be read.
+ */
+int expand_sparse_directory(struct index_state *istate, int pos);
+
 #endif
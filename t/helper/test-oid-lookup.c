@@ -0,0 +1,189 @@
+#define USE_THE_REPOSITORY_VARIABLE
+
+#include "test-tool.h"
+#include "hash-lookup.h"
+#include "environment.h"
+#include "hex.h"
+#include "midx.h"
+#include "object-store.h"
+#include "packfile.h"
+#include "setup.h"
+
+/*
+ * Check bsearch_hash() on the name table of a pack index or of the
+ * multi-pack-index of the repository against a plain bisection, and
+ * with --speed, time both for looking up names that are in the table
+ * and names that are not.
+ */
+
+static const char *oid_lookup_usage =
+	"test-tool oid-lookup [--speed] (--midx | <pack.idx>)";
+
+#define NUM_SECONDS 3
+
+struct name_table {
+	const uint32_t *fanout;
+	const unsigned char *lookup;
+	size_t stride;
+	uint32_t nr;
+};
+
+static int bisect_hash(const unsigned char *hash, const uint32_t *fanout_nbo,
+		       const unsigned char *table, size_t stride,
+		       uint32_t *result)
+{
+	uint32_t hi, lo;
+
+	hi = ntohl(fanout_nbo[*hash]);
+	lo = ((*hash == 0x0) ? 0 : ntohl(fanout_nbo[*hash - 1]));
+
+	while (lo < hi) {
+		unsigned mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(table + mi * stride, hash,
+				  the_repository->hash_algo);
+
+		if (!cmp) {
+			*result = mi;
+			return 1;
+		}
+		if (cmp > 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+
+	*result = lo;
+	return 0;
+}
+
+typedef int (*search_fn)(const unsigned char *, const uint32_t *,
+			 const unsigned char *, size_t, uint32_t *);
+
+/* a few names derived from each one in the table, most of them missing */
+static void neighbour(unsigned char *out, const unsigned char *in, int which)
+{
+	size_t rawsz = the_hash_algo->rawsz;
+
+	memcpy(out, in, rawsz);
+	switch (which) {
+	case 0:
+		break;
+	case 1:
+		out[rawsz - 1]++;
+		break;
+	case 2:
+		out[rawsz - 1]--;
+		break;
+	case 3:
+		out[1] ^= 0x80;
+		break;
+	}
+}
+
+static int check(const struct name_table *t)
+{
+	unsigned char hash[GIT_MAX_RAWSZ];
+	uint32_t i, expect_pos, actual_pos;
+	int which, ret = 0;
+
+	for (i = 0; i < t->nr; i++) {
+		for (which = 0; which < 4; which++) {
+			int expect, actual;
+
+			neighbour(hash, t->lookup + i * t->stride, which);
+			expect = bisect_hash(hash, t->fanout, t->lookup,
+					     t->stride, &expect_pos);
+			actual = bsearch_hash(hash, t->fanout, t->lookup,
+					      t->stride, &actual_pos);
+			if (which == 0 && (!actual || actual_pos != i))
+				ret = error("did not find %s at %"PRIu32,
+					    hash_to_hex(hash), i);
+			else if (expect != actual || expect_pos != actual_pos)
+				ret = error("%s: expected %d at %"PRIu32", got %d at %"PRIu32,
+					    hash_to_hex(hash), expect, expect_pos,
+					    actual, actual_pos);
+		}
+	}
+	return ret;
+}
+
+static void speed(const struct name_table *t, const char *name, search_fn fn,
+		  int missing)
+{
+	unsigned char hash[GIT_MAX_RAWSZ];
+	clock_t start, end;
+	unsigned long j;
+	uint32_t pos;
+
+	start = end = clock();
+	for (j = 0; (end - start) / CLOCKS_PER_SEC < NUM_SECONDS; j++) {
+		/* spread the lookups over the table */
+		uint32_t i = (j * 2654435761u) % t->nr;
+
+		neighbour(hash, t->lookup + i * t->stride, missing);
+		fn(hash, t->fanout, t->lookup, t->stride, &pos);
+
+		if (!(j & 1023))
+			end = clock();
+	}
+	printf("%s (%s): %0.0f lookups/s\n", name,
+	       missing ? "missing" : "present",
+	       j / (((double)end - start) / CLOCKS_PER_SEC));
+}
+
+int cmd__oid_lookup(int argc, const char **argv)
+{
+	struct name_table t;
+	struct packed_git *p = NULL;
+	struct multi_pack_index *m = NULL;
+	int do_speed = 0, ret;
+
+	setup_git_directory();
+
+	if (argc > 1 && !strcmp(argv[1], "--speed")) {
+		do_speed = 1;
+		argc--;
+		argv++;
+	}
+	if (argc != 2)
+		usage(oid_lookup_usage);
+
+	if (!strcmp(argv[1], "--midx")) {
+		m = load_multi_pack_index(get_object_directory(), 1);
+		if (!m)
+			die("could not load multi-pack-index");
+		t.fanout = m->chunk_oid_fanout;
+		t.lookup = m->chunk_oid_lookup;
+		t.stride = m->hash_len;
+		t.nr = m->num_objects;
+	} else {
+		p = add_packed_git(argv[1], strlen(argv[1]), 1);
+		if (!p || open_pack_index(p))
+			die("could not open pack index '%s'", argv[1]);
+		t.fanout = (const uint32_t *)((const unsigned char *)p->index_data +
+					      (p->index_version == 1 ? 0 : 8));
+		t.lookup = (const unsigned char *)t.fanout + 4 * 256;
+		t.stride = the_hash_algo->rawsz;
+		if (p->index_version == 1) {
+			t.lookup += 4;
+			t.stride += 4;
+		}
+		t.nr = p->num_objects;
+	}
+
+	ret = check(&t);
+	if (!ret && do_speed && t.nr) {
+		speed(&t, "bisect", bisect_hash, 0);
+		speed(&t, "bsearch_hash", bsearch_hash, 0);
+		speed(&t, "bisect", bisect_hash, 1);
+		speed(&t, "bsearch_hash", bsearch_hash, 1);
+	}
+
+	if (m)
+		close_midx(m);
+	if (p) {
+		close_pack(p);
+		free(p);
+	}
+	return !!ret;
+}
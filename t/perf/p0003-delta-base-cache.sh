@@ -28,4 +28,9 @@ test_perf 'log -S' '
 	git log --raw -Sfoo >/dev/null
 '
 
+# many threads reading blobs through the delta base cache at once
+test_perf 'grep --threads over recent history' '
+	git grep --threads=8 -e foo $(git rev-list -n 10 HEAD) >/dev/null || :
+'
+
 test_done
@@ -33,4 +33,11 @@ test_cache_tree_update_functions "invalidate 2" "--invalidate 2"
 test_cache_tree_update_functions "invalidate 50" "--invalidate 50"
 test_cache_tree_update_functions "empty" "--empty"
 
+test_expect_success 'disable index.threads' '
+	git config index.threads 1
+'
+
+test_cache_tree 'cache_tree_update' 'update' "empty, index.threads=1" "--empty"
+test_cache_tree 'cache_tree_update' 'update' "invalidate 50, index.threads=1" "--invalidate 50"
+
 test_done
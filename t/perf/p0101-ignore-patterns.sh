@@ -0,0 +1,34 @@
+#!/bin/sh
+
+test_description="Tests performance of matching against many ignore patterns"
+
+. ./perf-lib.sh
+
+test_perf_fresh_repo
+
+test_expect_success 'setup' '
+	for i in $(test_seq 1 1000)
+	do
+		echo "file-$i.tmp" &&
+		echo "*.ext$i" &&
+		echo "/dir/sub/path-$i" || return 1
+	done >.gitignore &&
+	mkdir -p dir/sub &&
+	for i in $(test_seq 1 2000)
+	do
+		: >dir/sub/path-$i &&
+		: >dir/file-$i.tmp &&
+		: >dir/untracked-$i.ext$i &&
+		: >untracked-$i.c || return 1
+	done
+'
+
+test_perf 'status --ignored' '
+	git status --ignored
+'
+
+test_perf 'ls-files -o -i --exclude-standard' '
+	git ls-files -o -i --exclude-standard
+'
+
+test_done
@@ -10,4 +10,23 @@ test_perf 'fsck' '
 	git fsck
 '
 
+# Count down from the number of CPUs, halving each time, so that the
+# last test uses all of them even if that is not a power of 2.
+test_expect_success 'set up thread-counting tests' '
+	t=$(test-tool online-cpus) &&
+	threads= &&
+	while test $t -gt 0
+	do
+		threads="$t $threads" &&
+		t=$((t / 2)) || return 1
+	done
+'
+
+for t in $threads
+do
+	test_perf "fsck --no-dangling --threads=$t" "
+		git fsck --no-dangling --threads=$t
+	"
+done
+
 test_done
@@ -26,4 +26,46 @@ test_perf 'log -p -3000 --patience' '
 	git log -p -3000 --patience >/dev/null
 '
 
+# Large generated files with a few changes, where most of the time goes
+# into preparing (hashing and classifying) the lines.
+generate_lockfile () {
+	awk -v n="$1" -v every="$2" 'BEGIN {
+		for (i = 0; i < n; i++) {
+			v = (every && i % every == 0) ? "2.0.0" : "1.0.0";
+			printf "pkg-%d@^%s:\n  version \"%s\"\n", i, v, v;
+			printf "  resolved \"https://example.com/pkg-%d-%s.tgz#%08x\"\n", i, v, i * 7919;
+		}
+	}'
+}
+
+generate_minified () {
+	awk -v n="$1" -v every="$2" 'BEGIN {
+		for (i = 0; i < n; i++) {
+			for (j = 0; j < 500; j++)
+				printf "{\"id\":%d,\"v\":%d},", i * 500 + j,
+					(every && i % every == 0 && j == 0) ? 1 : 0;
+			printf "\n";
+		}
+	}'
+}
+
+test_expect_success 'setup generated files' '
+	generate_lockfile 300000 0 >lock.old &&
+	generate_lockfile 300000 97 >lock.new &&
+	generate_minified 4000 0 >min.old &&
+	generate_minified 4000 97 >min.new
+'
+
+test_perf 'diff --no-index lockfile' '
+	test_expect_code 1 git diff --no-index lock.old lock.new >/dev/null
+'
+
+test_perf 'diff --no-index minified' '
+	test_expect_code 1 git diff --no-index min.old min.new >/dev/null
+'
+
+test_perf 'diff --no-index -b lockfile' '
+	test_expect_code 1 git diff --no-index -b lock.old lock.new >/dev/null
+'
+
 test_done
@@ -37,4 +37,25 @@ test_lookup_pack_bitmap () {
 test_lookup_pack_bitmap false
 test_lookup_pack_bitmap true
 
+# Count down from the number of CPUs, halving each time, so that the
+# last test uses all of them even if that is not a power of 2.
+test_expect_success 'set up thread-counting tests' '
+	t=$(test-tool online-cpus) &&
+	threads= &&
+	while test $t -gt 0
+	do
+		threads="$t $threads" &&
+		t=$((t / 2)) || return 1
+	done
+'
+
+# Without a delta window, the existing deltas are reused and the time
+# goes into writing the pack and building the bitmaps.
+for t in $threads
+do
+	test_perf "repack with bitmaps (--threads=$t)" "
+		git -c pack.window=0 repack -adb --threads=$t
+	"
+done
+
 test_done
@@ -322,6 +322,35 @@ EOF
 	test_must_be_empty err
 '
 
+test_expect_success 'patterns with slashes across directories from stdin' '
+	test_when_finished "rm -rf slashes" &&
+	git init slashes &&
+	mkdir -p slashes/a/b &&
+	cat >slashes/.gitattributes <<-\EOF &&
+	a/*.c foo=top
+	/a/b/x foo=anchored
+	a/b/**/y foo=deep
+	*.h foo=header
+	EOF
+	echo "b/*.h foo=sub" >slashes/a/.gitattributes &&
+	cat >expect <<-\EOF &&
+	x.c: foo: unspecified
+	a/x.c: foo: top
+	a/b/x.c: foo: unspecified
+	a/b/x: foo: anchored
+	a/x: foo: unspecified
+	a/b/c/y: foo: deep
+	a/b/y: foo: deep
+	a/x.h: foo: header
+	a/b/x.h: foo: sub
+	x.h: foo: header
+	a/b/x.h: foo: sub
+	EOF
+	sed -e "s/:.*//" expect >stdin &&
+	git -C slashes check-attr --stdin foo <stdin >actual &&
+	test_cmp expect actual
+'
+
 test_expect_success 'using --git-dir and --work-tree' '
 	mkdir unreal real &&
 	git init real &&
@@ -901,6 +901,86 @@ test_expect_success !MINGW,!CYGWIN 'correct handling of backslashes' '
 	test_must_be_empty err
 '
 
+############################################################################
+#
+# test long pattern lists, which are looked up in hash tables
+
+test_expect_success 'setup long pattern list' '
+	git init long-list &&
+	test_seq 1 40 | sed "s/^/filler-/" >long-list/.gitignore &&
+	cat >>long-list/.gitignore <<-\EOF &&
+	/a/one.x
+	one.x
+	*.x
+	*.y
+	/b/two.y
+	two.y
+	three.z
+	*.z
+	/c/three.z
+	*.log
+	!keep.log
+	*.tmp
+	!build-?.tmp
+	out/
+	Mixed.CASE
+	*.UPPER
+	EOF
+	mkdir long-list/out long-list/sub &&
+	>long-list/sub/out
+'
+
+test_expect_success 'long pattern list: last match wins' '
+	cat >long-paths <<-\EOF &&
+	a/one.x
+	b/two.y
+	c/three.z
+	d/three.z
+	keep.log
+	other.log
+	build-1.tmp
+	build-12.tmp
+	EOF
+	cat >expect <<-\EOF &&
+	.gitignore:43:*.x	a/one.x
+	.gitignore:46:two.y	b/two.y
+	.gitignore:49:/c/three.z	c/three.z
+	.gitignore:48:*.z	d/three.z
+	.gitignore:51:!keep.log	keep.log
+	.gitignore:50:*.log	other.log
+	.gitignore:53:!build-?.tmp	build-1.tmp
+	.gitignore:52:*.tmp	build-12.tmp
+	EOF
+	git -C long-list check-ignore -v -n --stdin <long-paths >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'long pattern list: trailing slash matches only directories' '
+	cat >expect <<-\EOF &&
+	.gitignore:54:out/	out
+	::	sub/out
+	EOF
+	git -C long-list check-ignore -v -n out sub/out >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'long pattern list: core.ignoreCase' '
+	cat >expect <<-\EOF &&
+	.gitignore:55:Mixed.CASE	mixed.case
+	.gitignore:56:*.UPPER	file.upper
+	EOF
+	git -C long-list -c core.ignoreCase=true \
+		check-ignore -v -n mixed.case file.upper >actual &&
+	test_cmp expect actual &&
+	cat >expect <<-\EOF &&
+	::	mixed.case
+	::	file.upper
+	EOF
+	test_expect_code 1 git -C long-list -c core.ignoreCase=false \
+		check-ignore -v -n mixed.case file.upper >actual &&
+	test_cmp expect actual
+'
+
 test_expect_success 'info/exclude trumps core.excludesfile' '
 	echo >>global-excludes usually-ignored &&
 	echo >>.git/info/exclude "!usually-ignored" &&
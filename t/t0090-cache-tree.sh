@@ -279,4 +279,47 @@ test_expect_success 'switching trees does not invalidate shared index' '
 	)
 '
 
+test_expect_success 'write-tree with threads matches write-tree without' '
+	test_when_finished "rm -rf threads" &&
+	git init threads &&
+	(
+		cd threads &&
+		for d in a b c/d c/e f/g/h
+		do
+			mkdir -p $d &&
+			echo $d >$d/file &&
+			echo $d >$d/other || return 1
+		done &&
+		echo top >top &&
+		git add . &&
+		GIT_TEST_INDEX_THREADS=1 git write-tree >../expect &&
+		git ls-files -s >ls-files &&
+		rm .git/index &&
+		git update-index --index-info <ls-files &&
+		GIT_TEST_INDEX_THREADS=4 git write-tree >../actual &&
+		test-tool dump-cache-tree >dump &&
+		! grep invalid dump
+	) &&
+	test_cmp expect actual
+'
+
+test_expect_success 'write-tree with threads reports a missing object once' '
+	test_when_finished "rm -rf threads" &&
+	git init threads &&
+	(
+		cd threads &&
+		mkdir a b &&
+		>a/file &&
+		>b/file &&
+		git add . &&
+		git ls-files -s >ls-files &&
+		sed -e "s/$EMPTY_BLOB/$(test_oid deadbeef)/" ls-files >broken &&
+		rm .git/index &&
+		git update-index --index-info <broken &&
+		test_must_fail env GIT_TEST_INDEX_THREADS=1 git write-tree 2>../expect &&
+		test_must_fail env GIT_TEST_INDEX_THREADS=4 git write-tree 2>../actual
+	) &&
+	test_cmp expect actual
+'
+
 test_done
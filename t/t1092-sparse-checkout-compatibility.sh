@@ -1633,6 +1633,26 @@ test_expect_success 'sparse index is not expanded: update-index' '
 	ensure_not_expanded update-index --add --remove --again
 '
 
+test_expect_success 'sparse index is only expanded where needed: update-index' '
+	init_repos &&
+
+	folder1_a_oid=$(git -C full-checkout rev-parse update-folder1:folder1/a) &&
+	git -C sparse-checkout update-index --add --cacheinfo 100644 $folder1_a_oid folder1/a &&
+	ensure_not_expanded update-index --add --cacheinfo 100644 $folder1_a_oid folder1/a &&
+	test_region index expand_sparse_directory trace2.txt &&
+	rm sparse-index/untracked.txt &&
+
+	# Only folder1/ was expanded; its subdirectory and folder2/ stay sparse.
+	git -C sparse-index ls-files --sparse >actual &&
+	grep "^folder1/0/$" actual &&
+	grep "^folder2/$" actual &&
+	! grep "^folder1/$" actual &&
+
+	test_sparse_match git update-index --skip-worktree folder1/a &&
+	test_sparse_match git ls-files -t -- folder1/a &&
+	test_sparse_match git status --porcelain=v2
+'
+
 test_expect_success 'sparse index is not expanded: blame' '
 	init_repos &&
 
@@ -1061,4 +1061,53 @@ test_expect_success 'fsck reports problems in current worktree index without fil
 	test_cmp expect actual
 '
 
+test_expect_success 'fsck reports the same with and without threads' '
+	test_when_finished "rm -rf threaded" &&
+	git init threaded &&
+	(
+		cd threaded &&
+		for i in $(test_seq 1 200)
+		do
+			blob=$(echo $i | git hash-object -w --stdin) &&
+			printf "100644 blob $blob\t.git" | git mktree || return 1
+		done &&
+		git cat-file --batch-all-objects --batch-check="%(objectname)" |
+		git pack-objects .git/objects/pack/pack &&
+		git prune-packed &&
+		for i in $(test_seq 1 50)
+		do
+			blob=$(echo loose $i | git hash-object -w --stdin) &&
+			printf "100644 blob $blob\t.git" | git mktree || return 1
+		done &&
+
+		# a loose object stored under the wrong name
+		oid=$(echo right | git hash-object -w --stdin) &&
+		other=$(echo wrong | git hash-object -w --stdin) &&
+		mv "$(git rev-parse --git-path objects/$(test_oid_to_path $oid))" \
+		   "$(git rev-parse --git-path objects/$(test_oid_to_path $other))" &&
+
+		# and a damaged object in the middle of the pack
+		idx=$(echo .git/objects/pack/pack-*.idx) &&
+		offset=$(git show-index <$idx | cut -d" " -f1 | sort -n | sed -n 100p) &&
+		printf "\377\377\377\377" |
+		dd of=${idx%.idx}.pack bs=1 seek=$((offset + 4)) conv=notrunc &&
+
+		test_must_fail git fsck --threads=1 >expect 2>&1 &&
+		test_must_fail git fsck --threads=4 >actual 2>&1 &&
+		test_cmp expect actual &&
+		test_must_fail git -c fsck.threads=4 fsck >actual 2>&1 &&
+		test_cmp expect actual &&
+		test_grep "hasDotgit" actual &&
+		test_grep "hash-path mismatch" actual &&
+		test_grep "index CRC mismatch" actual
+	)
+'
+
+test_expect_success 'fsck rejects a negative number of threads' '
+	test_must_fail git fsck --threads=-1 2>err &&
+	test_grep "invalid number of threads" err &&
+	test_must_fail git -c fsck.threads=-1 fsck 2>err &&
+	test_grep "invalid number of threads" err
+'
+
 test_done
@@ -96,6 +96,21 @@ test_expect_success 'index.skipHash config option' '
 	git -C sub fsck
 '
 
+test_expect_success 'index.skipHash records block checksums checked by fsck' '
+	test_when_finished "rm -f .git/index && git add a" &&
+	rm -f .git/index &&
+	git -c index.skipHash=true add a &&
+	git fsck &&
+
+	# clobber the ctime of the first entry
+	printf "\377\377\377\377" |
+	dd of=.git/index bs=1 seek=12 conv=notrunc &&
+	git ls-files >out &&
+	test_grep "^a\$" out &&
+	test_must_fail git fsck 2>err &&
+	test_grep "bad index file crc at offset 0" err
+'
+
 test_index_version () {
 	INDEX_VERSION_CONFIG=$1 &&
 	FEATURE_MANY_FILES=$2 &&
@@ -533,6 +533,34 @@ test_expect_success 'reading split index at alternate location' '
 	test_cmp expect actual
 '
 
+test_expect_success 'splitIndex.minEntries splits large indexes only' '
+	git init split-index-min-entries &&
+	(
+		cd split-index-min-entries &&
+		git config splitIndex.minEntries 3 &&
+		>one &&
+		>two &&
+		git update-index --add one two &&
+		test_path_is_missing .git/sharedindex.* &&
+
+		>three &&
+		git update-index --add three &&
+		test_path_is_missing .git/sharedindex.* &&
+
+		>four &&
+		git update-index --add four &&
+		ls .git/sharedindex.* >actual &&
+		test_line_count = 1 actual &&
+		test-tool dump-split-index .git/index >actual &&
+		grep "^base " actual &&
+
+		>five &&
+		git -c core.splitIndex=false update-index --add five &&
+		test-tool dump-split-index .git/index >actual &&
+		! grep "^base " actual
+	)
+'
+
 test_expect_success 'GIT_TEST_SPLIT_INDEX works' '
 	git init git-test-split-index &&
 	(
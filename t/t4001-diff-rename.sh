@@ -310,4 +310,98 @@ test_expect_success 'last line matters too' '
 	test_cmp expected actual.munged
 '
 
+test_expect_success 'inexact renames with threads match those without' '
+	test_when_finished "rm -rf threads" &&
+	git init threads &&
+	(
+		cd threads &&
+		for i in 1 2 3 4 5 6 7 8 9 10 11 12
+		do
+			test_write_lines $i a b c d e f g h >old-$i &&
+			test_write_lines $i x y z >>common-$i || return 1
+		done &&
+		printf "\0binary\0%s\n" 1 2 3 4 5 >old-bin &&
+		git add . &&
+		git commit -m old &&
+		for i in 1 2 3 4 5 6 7 8 9 10 11 12
+		do
+			git mv old-$i new-$(($i % 5))-$i &&
+			echo changed >>new-$(($i % 5))-$i &&
+			echo changed >>common-$i || return 1
+		done &&
+		git mv old-bin new-bin &&
+		printf "\0binary\0%s\n" 1 2 3 4 >new-bin &&
+		test_seq 1000 >new-large &&
+		git add . &&
+		git commit -m new &&
+		for opts in -M "-C -C" "-M -B" "-M30%"
+		do
+			git -c diff.renameThreads=1 diff-tree -r $opts \
+				--name-status HEAD^ HEAD >expect &&
+			git -c diff.renameThreads=4 diff-tree -r $opts \
+				--name-status HEAD^ HEAD >actual &&
+			test_cmp expect actual || return 1
+		done &&
+		grep "^R" actual &&
+		git -c diff.renameThreads=4 -c core.bigFileThreshold=10 \
+			diff-tree -r -M --name-status HEAD^ HEAD >actual &&
+		! grep "^R" actual &&
+		echo new >new-3-3 &&
+		git -c diff.renameThreads=1 diff -M HEAD^ >expect &&
+		git -c diff.renameThreads=4 diff -M HEAD^ >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'inexact renames can be cached' '
+	test_when_finished "rm -rf cache" &&
+	git init cache &&
+	(
+		cd cache &&
+		for i in 1 2 3 4 5
+		do
+			test_write_lines $i a b c d e f g h >old-$i || return 1
+		done &&
+		git add . &&
+		git commit -m old &&
+		for i in 1 2 3 4 5
+		do
+			git mv old-$i new-$i &&
+			echo changed >>new-$i || return 1
+		done &&
+		git commit -a -m new &&
+		git diff-tree -r -M --name-status HEAD^ HEAD >expect &&
+
+		GIT_TRACE2_EVENT="$(pwd)/first" git -c diff.renameCache=true \
+			diff-tree -r -M --name-status HEAD^ HEAD >actual &&
+		test_cmp expect actual &&
+		! test_trace2_data diff "inexact renames/cached" 5 <first &&
+		git rev-parse --verify refs/notes/renames &&
+
+		GIT_TRACE2_EVENT="$(pwd)/second" git -c diff.renameCache=true \
+			diff-tree -r -M --name-status HEAD^ HEAD >actual &&
+		test_cmp expect actual &&
+		test_trace2_data diff "inexact renames/cached" 5 <second &&
+
+		# the cache depends on the score threshold and the attributes
+		git diff-tree -r -M90% --name-status HEAD^ HEAD >expect &&
+		GIT_TRACE2_EVENT="$(pwd)/third" git -c diff.renameCache=true \
+			diff-tree -r -M90% --name-status HEAD^ HEAD >actual &&
+		test_cmp expect actual &&
+		! test_trace2_data diff "inexact renames/cached" 5 <third &&
+		echo "new-1 binary" >.gitattributes &&
+		GIT_TRACE2_EVENT="$(pwd)/fourth" git -c diff.renameCache=true \
+			diff-tree -r -M --name-status HEAD^ HEAD >actual &&
+		! test_trace2_data diff "inexact renames/cached" 5 <fourth &&
+
+		# changes in the working tree are not cached
+		echo more >>new-2 &&
+		git diff -M --name-status HEAD^ >expect &&
+		GIT_TRACE2_EVENT="$(pwd)/fifth" git -c diff.renameCache=true \
+			diff -M --name-status HEAD^ >actual &&
+		test_cmp expect actual &&
+		! test_trace2_data diff "inexact renames/cached" 5 <fifth
+	)
+'
+
 test_done
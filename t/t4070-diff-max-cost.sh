@@ -0,0 +1,73 @@
+#!/bin/sh
+
+test_description='diff --max-diff-cost'
+
+TEST_PASSES_SANITIZE_LEAK=true
+. ./test-lib.sh
+
+test_expect_success setup '
+	test_write_lines 1 2 3 4 5 6 7 8 9 >small &&
+	awk "BEGIN { for (i = 0; i < 2000; i++) print i % 7 }" >big &&
+	git add small big &&
+	git commit -m initial &&
+	test_write_lines 1 2 3 x 5 6 7 8 9 >small &&
+	awk "BEGIN { for (i = 0; i < 2000; i++) print (i * i) % 11 }" >big.new &&
+	cp big.new big
+'
+
+test_expect_success 'generous limit does not change the diff' '
+	git diff >expect 2>err &&
+	test_must_be_empty err &&
+	git diff --max-diff-cost=1000 >actual 2>err &&
+	test_must_be_empty err &&
+	test_cmp expect actual
+'
+
+test_expect_success 'low limit gives a larger diff that still applies' '
+	git diff --stat >stat.expect &&
+	git diff --max-diff-cost=1 >patch 2>err &&
+	test_grep "big.*max-diff-cost" err &&
+	test_grep ! small err &&
+	git diff --max-diff-cost=1 --stat >stat.actual 2>err &&
+	test_grep "big.*max-diff-cost" err &&
+	! test_cmp stat.expect stat.actual &&
+	git checkout big small &&
+	git apply patch &&
+	test_cmp big.new big &&
+	git diff --max-diff-cost=1 --minimal >patch 2>err &&
+	test_grep "big.*max-diff-cost" err &&
+	git checkout big small &&
+	git apply patch &&
+	test_cmp big.new big
+'
+
+test_expect_success 'diff.maxCost and overriding it' '
+	git -c diff.maxCost=1 diff >/dev/null 2>err &&
+	test_grep "big.*max-diff-cost" err &&
+	git -c diff.maxCost=1 diff --max-diff-cost=0 >/dev/null 2>err &&
+	test_must_be_empty err &&
+	test_must_fail git -c diff.maxCost=-1 diff 2>err &&
+	test_grep "diff.maxcost" err
+'
+
+test_expect_success 'negative --max-diff-cost is rejected' '
+	test_must_fail git diff --max-diff-cost=-1 2>err &&
+	test_grep "max-diff-cost" err
+'
+
+test_expect_success 'combined diff of a merge' '
+	git commit -a -m second &&
+	git checkout -b side HEAD^ &&
+	awk "BEGIN { for (i = 0; i < 2000; i++) print (i * 3) % 13 }" >big &&
+	git commit -a -m side &&
+	git checkout - &&
+	test_must_fail git merge side &&
+	awk "BEGIN { for (i = 0; i < 2000; i++) print (i * 5) % 17 }" >big &&
+	git commit -a -m merge &&
+	git show --cc >/dev/null 2>err &&
+	test_must_be_empty err &&
+	git show --cc --max-diff-cost=1 >/dev/null 2>err &&
+	test_grep "big.*max-diff-cost" err
+'
+
+test_done
@@ -2390,4 +2390,53 @@ test_expect_success 'log --invert-grep --grep --author' '
 	test_cmp expect actual
 '
 
+test_expect_success 'log.diffThreads does not change the output' '
+	git init diff-threads &&
+	(
+		cd diff-threads &&
+		for i in 1 2 3 4 5 6 7 8 9 10 11 12
+		do
+			test_seq $i 40 >text-$((i % 3)) &&
+			printf "bin\0ary $i" >binary &&
+			if test $i = 6
+			then
+				git rm -q text-2 &&
+				test_seq 20 >new
+			fi &&
+			if test $i = 9
+			then
+				git mv text-1 moved
+			fi &&
+			git add . &&
+			test_tick &&
+			git commit -q -m "commit $i" || return 1
+		done &&
+		for args in "-p --stat" "--numstat -M" "-p --shortstat -n 4" \
+			    "-p --stat -w -- text-0 binary" "-p -S 12 --root"
+		do
+			git log $args >expect &&
+			GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+				git -c log.diffThreads=3 log $args >actual &&
+			test_cmp expect actual &&
+			test_trace2_data diff prefetch/threads 3 <trace.event &&
+			rm trace.event || return 1
+		done &&
+		git checkout -q -b side HEAD~6 &&
+		test_commit on-side &&
+		git checkout -q - &&
+		for args in "-p --graph" "-p --show-linear-break side HEAD" \
+			    "-p --full-diff --parents -- text-0"
+		do
+			git log $args >expect &&
+			GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+				git -c log.diffThreads=3 log $args >actual &&
+			test_cmp expect actual &&
+			! test_trace2_data diff prefetch/threads 3 <trace.event &&
+			rm trace.event || return 1
+		done &&
+		git log -p --show-linear-break side HEAD >actual &&
+		test_grep "^ *\.\.\.\.\.\.\.\.\.\.$" actual
+	)
+'
+
 test_done
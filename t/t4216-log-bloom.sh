@@ -425,6 +425,61 @@ test_expect_success 'Bloom generation backfills empty commits' '
 	)
 '
 
+test_expect_success PTHREADS 'threaded Bloom filter computation' '
+	git init threaded &&
+	test_when_finished "rm -fr threaded" &&
+	(
+		cd threaded &&
+		for i in $(test_seq 1 300)
+		do
+			echo "commit refs/heads/main" &&
+			echo "committer C <c@example.com> $((1112912053 + $i)) -0700" &&
+			echo "data <<EOF" &&
+			echo "commit $i" &&
+			echo "EOF" &&
+			echo "M 100644 inline dir$(($i % 7))/sub$(($i % 3))/file$i" &&
+			echo "data <<EOF" &&
+			echo "$i" &&
+			echo "EOF" || return 1
+		done >input &&
+		git fast-import <input &&
+		git checkout main &&
+
+		for args in "" "--max-new-filters=200"
+		do
+			rm -f trace.event &&
+			git commit-graph write --reachable --changed-paths \
+				--threads=1 $args &&
+			mv .git/objects/info/commit-graph expect &&
+			GIT_TEST_BLOOM_SETTINGS_MAX_CHANGED_PATHS=3 \
+				git commit-graph write --reachable --changed-paths \
+				--threads=1 $args &&
+			mv .git/objects/info/commit-graph expect-truncated &&
+
+			GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+				git commit-graph write --reachable --changed-paths \
+				--threads=4 $args &&
+			grep "\"key\":\"bloom/threads\",\"value\":\"4\"" trace.event &&
+			test_cmp_bin expect .git/objects/info/commit-graph &&
+			rm .git/objects/info/commit-graph &&
+			GIT_TEST_BLOOM_SETTINGS_MAX_CHANGED_PATHS=3 \
+				git commit-graph write --reachable --changed-paths \
+				--threads=4 $args &&
+			test_cmp_bin expect-truncated .git/objects/info/commit-graph &&
+			rm .git/objects/info/commit-graph || return 1
+		done &&
+
+		git commit-graph write --reachable --changed-paths --threads=4 &&
+		for path in dir1 dir2/sub0 dir3/sub1/file31
+		do
+			git -c commitGraph.readChangedPaths=false log \
+				-- $path >expect &&
+			git log -- $path >actual &&
+			test_cmp expect actual || return 1
+		done
+	)
+'
+
 graph=.git/objects/info/commit-graph
 graphdir=.git/objects/info/commit-graphs
 chain=$graphdir/commit-graph-chain
@@ -635,4 +635,70 @@ test_expect_success 'negative window clamps to 0' '
 	check_deltas stderr = 0
 '
 
+test_expect_success PTHREADS 'setup for threaded object writing' '
+	git init threaded-write &&
+	(
+		cd threaded-write &&
+		for i in $(test_seq 300)
+		do
+			test_seq $i >file-$i || return 1
+		done &&
+		git add . &&
+		git commit -m many &&
+		echo change >>file-300 &&
+		git commit -am change
+	)
+'
+
+test_expect_success PTHREADS 'threaded object writing produces identical packs' '
+	(
+		cd threaded-write &&
+		git pack-objects --revs --all --stdout --window=0 \
+			--no-reuse-object --threads=1 </dev/null >single.pack &&
+		GIT_TRACE2_EVENT="$(pwd)/trace2.txt" \
+		git pack-objects --revs --all --stdout --window=0 \
+			--no-reuse-object --threads=4 </dev/null >threaded.pack &&
+		test_cmp_bin single.pack threaded.pack &&
+		grep "write_pack_file/deflate_threads" trace2.txt
+	)
+'
+
+test_expect_success PTHREADS 'threaded object writing with fresh deltas' '
+	(
+		cd threaded-write &&
+		pack=$(git pack-objects --revs --all --no-reuse-delta \
+			--no-reuse-object --threads=4 deltas </dev/null) &&
+		git verify-pack -v deltas-$pack.idx >out &&
+		grep -E "^[0-9a-f]{40,} blob +[0-9]+ [0-9]+ [0-9]+ [0-9]+ " out
+	)
+'
+
+for delta in ofs ref
+do
+	test_expect_success PTHREADS "threaded unpack-objects with $delta deltas" '
+		test_when_finished "rm -rf threaded-unpack" &&
+		(
+			cd threaded-write &&
+			if test $delta = ofs
+			then
+				delta_opt=--delta-base-offset
+			else
+				delta_opt=
+			fi &&
+			git pack-objects --revs --all --stdout $delta_opt \
+				</dev/null >$delta.pack &&
+			git rev-list --objects --all | cut -d" " -f1 | sort >expect
+		) &&
+		git init --bare threaded-unpack &&
+		GIT_TRACE2_EVENT="$(pwd)/trace2.txt" \
+		git -C threaded-unpack $BATCH_CONFIGURATION \
+			unpack-objects --threads=4 <threaded-write/$delta.pack &&
+		grep "\"key\":\"write_threads\",\"value\":\"4\"" trace2.txt &&
+		git -C threaded-unpack cat-file --batch-all-objects \
+			--batch-check="%(objectname)" >actual &&
+		test_cmp threaded-write/expect actual &&
+		git -C threaded-unpack fsck --no-dangling
+	'
+done
+
 test_done
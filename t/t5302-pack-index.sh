@@ -68,6 +68,11 @@ test_expect_success 'index-pack results should match pack-objects ones' '
 	cmp "test-2-${pack2}.idx" "2.idx"
 '
 
+test_expect_success 'name lookup agrees with bisection' '
+	test-tool oid-lookup "test-1-${pack1}.idx" &&
+	test-tool oid-lookup "test-2-${pack2}.idx"
+'
+
 test_expect_success 'index-pack --verify on index version 1' '
 	git index-pack --verify "test-1-${pack1}.pack"
 '
@@ -55,6 +55,16 @@ test_bitmap_cases () {
 		grep "\"key\":\"num_maximal_commits\",\"value\":\"107\"" trace
 	'
 
+	test_expect_success PTHREADS 'threaded bitmap build writes the same bitmaps' '
+		git repack -adf --window=0 --threads=1 &&
+		cp .git/objects/pack/pack-*.bitmap expect.bitmap &&
+		GIT_TRACE2_EVENT="$(pwd)/trace" \
+			git repack -adf --window=0 --threads=4 &&
+		grep "\"key\":\"building_bitmaps_threads\",\"value\":\"4\"" trace &&
+		test_cmp_bin expect.bitmap .git/objects/pack/pack-*.bitmap &&
+		rm -f expect.bitmap trace
+	'
+
 	basic_bitmap_tests
 
 	test_expect_success 'pack-objects respects --local (non-local loose)' '
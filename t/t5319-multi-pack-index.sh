@@ -208,6 +208,10 @@ test_expect_success 'write midx with twelve packs' '
 
 compare_results_with_midx "twelve packs"
 
+test_expect_success 'midx name lookup agrees with bisection' '
+	test-tool oid-lookup --midx
+'
+
 test_expect_success 'multi-pack-index *.rev cleanup with --object-dir' '
 	git init repo &&
 	git clone -s repo alternate &&
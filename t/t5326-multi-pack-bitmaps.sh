@@ -581,4 +581,36 @@ test_expect_success 'remove one packfile between MIDX bitmap writes' '
 	)
 '
 
+test_expect_success PTHREADS 'threaded MIDX write matches single-threaded' '
+	git init threaded-midx &&
+	test_when_finished "rm -fr threaded-midx" &&
+	(
+		cd threaded-midx &&
+		packdir=.git/objects/pack &&
+
+		for i in $(test_seq 1 10)
+		do
+			test_commit --no-tag $i &&
+			git repack -d || return 1
+		done &&
+		# an overlapping pack, so that duplicates are resolved
+		git rev-parse HEAD~5 | git pack-objects --revs $packdir/pack &&
+
+		git -c pack.threads=1 multi-pack-index write --bitmap &&
+		for f in $packdir/multi-pack-index*
+		do
+			mv $f $f.expect || return 1
+		done &&
+
+		GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+			git -c pack.threads=4 multi-pack-index write --bitmap &&
+		grep "\"key\":\"threads\",\"value\":\"4\"" trace.event &&
+		for f in $packdir/multi-pack-index*.expect
+		do
+			test_cmp_bin $f ${f%.expect} || return 1
+		done &&
+		git rev-list --test-bitmap HEAD
+	)
+'
+
 test_done
@@ -0,0 +1,108 @@
+#!/bin/sh
+
+test_description='loose object index'
+
+TEST_PASSES_SANITIZE_LEAK=true
+. ./test-lib.sh
+
+index=.git/objects/info/loose-index
+
+loose_objects () {
+	find .git/objects/?? -type f 2>/dev/null | wc -l
+}
+
+# The index holds a 16-byte header, a 1024-byte fan-out table and one
+# name per loose object.
+test_index_entries () {
+	echo $((16 + 1024 + $1 * $(test_oid rawsz))) >expect &&
+	wc -c <"$index" >actual.raw &&
+	tr -d " " <actual.raw >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two
+'
+
+test_expect_success 'no index without core.looseObjectIndex' '
+	git rev-parse --short HEAD &&
+	test_path_is_missing $index
+'
+
+test_expect_success 'index is written when first needed' '
+	git config core.looseObjectIndex true &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" git rev-parse --short HEAD &&
+	grep "\"category\":\"loose-index\",\"label\":\"write\"" trace.txt &&
+	test_index_entries $(loose_objects)
+'
+
+test_expect_success 'objects written later are appended' '
+	before=$(loose_objects) &&
+	blob=$(echo new | git hash-object -w --stdin) &&
+	test_index_entries $(($before + 1)) &&
+	short=$(git rev-parse --short=8 $blob) &&
+	test "$(git rev-parse $short)" = "$blob"
+'
+
+test_expect_success 'abbreviated names are resolved from the index' '
+	for oid in $(find .git/objects/?? -type f |
+		     sed "s,.git/objects/\(..\)/,\1,")
+	do
+		git rev-parse --disambiguate=$(echo $oid | cut -c1-6) >out &&
+		grep $oid out || return 1
+	done
+'
+
+test_expect_success 'objects pushed through a quarantine are appended' '
+	git init --bare dst.git &&
+	git -C dst.git config core.looseObjectIndex true &&
+	git push dst.git HEAD~1:refs/heads/one &&
+	git -C dst.git rev-parse --short one &&
+	test_path_is_file dst.git/objects/info/loose-index &&
+	test_commit three &&
+	git push dst.git HEAD:refs/heads/three &&
+	(
+		cd dst.git &&
+		index=objects/info/loose-index &&
+		test_index_entries $(find objects/?? -type f | wc -l) &&
+		test "$(git rev-parse $(git rev-parse --short=8 three))" = \
+			"$(git rev-parse three)"
+	)
+'
+
+test_expect_success 'index hard-linked by a local clone is not shared' '
+	git rev-parse --short HEAD &&
+	test_when_finished "rm -rf clone" &&
+	git clone . clone &&
+	cp $index index.before &&
+	test_commit -C clone four &&
+	test_cmp index.before $index &&
+	git -C clone rev-parse --short=8 four
+'
+
+test_expect_success 'pruning loose objects removes the index' '
+	git repack -ad &&
+	test_path_is_missing $index &&
+	git rev-parse --short HEAD &&
+	test_index_entries $(loose_objects)
+'
+
+test_expect_success 'invalid index is ignored and rewritten' '
+	blob=$(echo another | git hash-object -w --stdin) &&
+	echo garbage >$index &&
+	git rev-parse --short=8 $blob 2>err &&
+	test_grep "ignoring invalid loose object index" err &&
+	test_index_entries $(loose_objects)
+'
+
+test_expect_success 'writing objects without core.looseObjectIndex removes the index' '
+	git rev-parse --short HEAD &&
+	test_path_is_file $index &&
+	echo unindexed | git -c core.looseObjectIndex=false hash-object -w --stdin &&
+	test_path_is_missing $index &&
+	git rev-parse --short HEAD &&
+	test_index_entries $(loose_objects)
+'
+
+test_done
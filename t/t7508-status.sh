@@ -1759,6 +1759,75 @@ test_expect_success 'slow status advice when core.untrackedCache true, and fsmon
 	)
 '
 
+test_expect_success 'core.preloadTrackedDirectories does not change the results' '
+	test_when_finished "rm -rf preload-dirs trace" &&
+	git init preload-dirs &&
+	(
+		cd preload-dirs &&
+		mkdir -p a/b c d/e &&
+		echo ignored >.gitignore &&
+		for f in a/one a/b/two c/three d/e/four
+		do
+			echo $f >$f || return 1
+		done &&
+		git add . &&
+		>a/b/untracked &&
+		mkdir d/e/new &&
+		>d/e/new/file &&
+		>c/ignored &&
+		git status --porcelain -uall --ignored >../expect &&
+		GIT_TEST_PRELOAD_INDEX=1 GIT_TRACE2_EVENT="$(pwd)/../trace" \
+		git -c core.preloadTrackedDirectories=true \
+			status --porcelain -uall --ignored >../actual
+	) &&
+	test_cmp expect actual &&
+	grep "\"key\":\"preload/tracked_directories\",\"value\":\"6\"" trace
+'
+
+test_expect_success 'read_directory() outside of a repository' '
+	test_when_finished "rm -rf non-repo" &&
+	mkdir -p non-repo/sub &&
+	echo needle >non-repo/sub/file &&
+	echo "sub/file:needle" >expect &&
+	nongit git grep --no-index needle >actual &&
+	test_cmp expect actual
+'
+
+test_lazy_prereq IO_URING '
+	test -n "$HAVE_IO_URING" &&
+	# Linux 6.6 and later can turn io_uring off with a sysctl
+	test "$(cat /proc/sys/kernel/io_uring_disabled 2>/dev/null || echo 0)" = 0
+'
+
+test_expect_success 'status with core.ioUring' '
+	test_when_finished "rm -rf io-uring trace.txt" &&
+	git init io-uring &&
+	(
+		cd io-uring &&
+		mkdir a b &&
+		for i in 1 2 3 4 5 6 7 8 9 10
+		do
+			echo $i >a/$i && echo $i >b/$i || return 1
+		done &&
+		git add . &&
+		git commit -m initial &&
+		echo changed >a/3 &&
+		rm b/5 &&
+		test_ln_s_add a/1 link &&
+		git status --porcelain >../expect &&
+		GIT_TRACE2_EVENT="$(pwd)/../trace.txt" GIT_TEST_PRELOAD_INDEX=1 \
+			git -c core.ioUring=true status --porcelain >../actual
+	) &&
+	test_cmp expect actual &&
+	# two preload threads, each stat-ing its share in a single batch
+	if test_have_prereq IO_URING
+	then
+		test_trace2_data index preload/sum_lstat_batch 2 <trace.txt
+	else
+		! grep preload/sum_lstat_batch trace.txt
+	fi
+'
+
 test_expect_success EXPENSIVE 'status does not re-read unchanged 4 or 8 GiB file' '
 	(
 		mkdir large-file &&
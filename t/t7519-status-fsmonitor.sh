@@ -429,7 +429,8 @@ check_sparse_index_behavior () {
 	git -C full status --porcelain=v2 >expect &&
 	GIT_TRACE2_EVENT="$(pwd)/trace2.txt" \
 		git -C sparse status --porcelain=v2 >actual &&
-	test_region $1 index ensure_full_index trace2.txt &&
+	test_region ! index ensure_full_index trace2.txt &&
+	test_region $1 index expand_sparse_directory trace2.txt &&
 	test_region fsm_hook query trace2.txt &&
 	test_cmp expect actual &&
 	rm trace2.txt
@@ -468,7 +469,8 @@ test_expect_success 'status succeeds with sparse index' '
 		git -C sparse sparse-checkout set dir1 dir2 &&
 
 		# This one modifies outside the sparse-checkout definition
-		# and hence we expect to expand the sparse-index.
+		# and hence we expect to expand the sparse directory it is
+		# in, but not the whole sparse-index.
 		test_hook --clobber fsmonitor-test <<-\EOF &&
 			printf "last_update_token\0"
 			printf "dir1a/modified\0"
@@ -571,6 +571,82 @@ test_expect_success 'flush cached data' '
 	grep "file_3" actual_q3
 '
 
+# When the kernel drops events because its queue overflowed, we may
+# also have missed directories being created, which then need to be
+# watched before we hear about anything that happens in them.  Make
+# the queue of the daemon small, and overflow it on purpose.
+
+test_lazy_prereq INOTIFY_QUEUE_LIMIT '
+	test -w /proc/sys/fs/inotify/max_queued_events
+'
+
+# Print the current token of the daemon in repository $1 once it has
+# caught up with the events that overflowed its queue, i.e. once two
+# queries in a row are answered without a resync in between.
+settled_token () {
+	test-tool -C "$1" fsmonitor-client query --token 0 >settle &&
+	token=$(tr "\000" "\n" <settle | head -n 1) &&
+	for i in $(test_seq 10)
+	do
+		test-tool -C "$1" fsmonitor-client query --token "$token" >settle &&
+		next=$(tr "\000" "\n" <settle | head -n 1) &&
+		if test "${next%:*}" = "${token%:*}"
+		then
+			echo "$token" &&
+			return 0
+		fi &&
+		token=$next || return 1
+	done &&
+	return 1
+}
+
+test_expect_success INOTIFY_QUEUE_LIMIT 'directories created while the event queue overflows are watched' '
+	test_when_finished "stop_daemon_delete_repo test_overflow" &&
+
+	git init test_overflow &&
+
+	limit=$(cat /proc/sys/fs/inotify/max_queued_events) &&
+	test_when_finished "echo $limit >/proc/sys/fs/inotify/max_queued_events" &&
+	echo 16 >/proc/sys/fs/inotify/max_queued_events &&
+	start_daemon -C test_overflow --tf "$PWD/.git/trace_overflow" &&
+	echo $limit >/proc/sys/fs/inotify/max_queued_events &&
+
+	# The daemon names its cookie files after its pid.
+	test-tool -C test_overflow fsmonitor-client query --token 0 &&
+	pid=$(sed -n "s/^cookie-wait: .\([0-9]*\)-.*/\1/p" \
+		.git/trace_overflow | head -n 1) &&
+	test -n "$pid" &&
+
+	# Keep the daemon from reading its queue while we create more
+	# directories than fit in it, so that it misses most of them.
+	kill -STOP $pid &&
+	test_when_finished "kill -CONT $pid" &&
+	mkdir $(printf "test_overflow/dir_%d " $(test_seq 100)) &&
+	checked="1 10 20 30 40 50 60 70 80 90 100" &&
+	for i in $checked
+	do
+		>test_overflow/dir_$i/file || return 1
+	done &&
+	kill -CONT $pid &&
+
+	token=$(settled_token test_overflow) &&
+	grep "inotify: queue overflow" .git/trace_overflow &&
+
+	# Change one file at a time, so that the queue does not overflow
+	# again and throw away what we are looking for.
+	for i in $checked
+	do
+		echo changed >test_overflow/dir_$i/file &&
+		test-tool -C test_overflow fsmonitor-client query \
+			--token "$token" >actual_1 || return 1
+	done &&
+	nul_to_q <actual_1 >actual_q1 &&
+	for i in $checked
+	do
+		grep "Qdir_$i/fileQ" actual_q1 || return 1
+	done
+'
+
 # The next few test cases create repos where the .git directory is NOT
 # inside the one of the working directory.  That is, where .git is a file
 # that points to a directory elsewhere.  This happens for submodules and
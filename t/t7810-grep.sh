@@ -1122,6 +1122,26 @@ do
 	"
 done
 
+test_expect_success PTHREADS 'threaded grep over packed revisions' '
+	test_when_finished "rm -rf packed-history" &&
+	git init packed-history &&
+	(
+		cd packed-history &&
+		for i in $(test_seq 30)
+		do
+			test_seq $i >file &&
+			git add file &&
+			git commit -q -m $i || return 1
+		done &&
+		git repack -adf &&
+		git grep --threads=1 -e 1 $(git rev-list HEAD) >expect &&
+		GIT_TRACE2_EVENT="$(pwd)/trace2.txt" \
+		git grep --threads=4 -e 1 $(git rev-list HEAD) >actual &&
+		test_cmp expect actual &&
+		grep "\"category\":\"delta-base-cache\"" trace2.txt
+	)
+'
+
 test_expect_success !PTHREADS,!FAIL_PREREQS \
 	'grep --threads=N or pack.threads=N warns when no pthreads' '
 	git grep --threads=2 Hello hello_world 2>err &&
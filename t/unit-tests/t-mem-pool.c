@@ -20,6 +20,21 @@ static void t_calloc_100(struct mem_pool *pool)
 	check(pool->mp_block->end != NULL);
 }
 
+static void t_prefault(void)
+{
+	struct mem_pool pool;
+	size_t size = 4 * 1024 * 1024;
+	char *buffer;
+
+	mem_pool_init_prefault(&pool, size);
+	if (check(pool.mp_block != NULL))
+		check_uint(pool.mp_block->end - pool.mp_block->next_free, ==, size);
+	buffer = mem_pool_alloc(&pool, size);
+	memset(buffer, 1, size);
+	check(pool.mp_block->next_free == pool.mp_block->end);
+	mem_pool_discard(&pool, 0);
+}
+
 int cmd_main(int argc UNUSED, const char **argv UNUSED)
 {
 	TEST(setup_static(t_calloc_100, 1024 * 1024),
@@ -27,5 +42,8 @@ int cmd_main(int argc UNUSED, const char **argv UNUSED)
 	TEST(setup_static(t_calloc_100, 1),
 	     "mem_pool_calloc returns 100 zeroed bytes with tiny block");
 
+	TEST(t_prefault(),
+	     "mem_pool_init_prefault allocates the whole initial block");
+
 	return test_done();
 }
@@ -1,5 +1,7 @@
 #include "git-compat-util.h"
 #include "thread-utils.h"
+#include "gettext.h"
+#include "strbuf.h"
 
 #if defined(hpux) || defined(__hpux) || defined(_hpux)
 #  include <sys/pstat.h>
@@ -84,6 +86,59 @@ int init_recursive_mutex(pthread_mutex_t *m)
 #endif
 }
 
+static pthread_key_t deferred_reports_key;
+static report_fn deferred_error_orig, deferred_warn_orig;
+
+static void deferred_vreport(const char *prefix, report_fn orig,
+			     const char *msg, va_list params)
+{
+	struct strbuf *buf = pthread_getspecific(deferred_reports_key);
+
+	if (!buf) {
+		orig(msg, params);
+		return;
+	}
+	strbuf_addstr(buf, prefix);
+	strbuf_vaddf(buf, msg, params);
+	strbuf_addch(buf, '\n');
+}
+
+static void deferred_error(const char *msg, va_list params)
+{
+	deferred_vreport(_("error: "), deferred_error_orig, msg, params);
+}
+
+static void deferred_warn(const char *msg, va_list params)
+{
+	deferred_vreport(_("warning: "), deferred_warn_orig, msg, params);
+}
+
+void start_deferred_reports(void)
+{
+	if (deferred_error_orig)
+		BUG("deferred reports already started");
+	pthread_key_create(&deferred_reports_key, NULL);
+	deferred_error_orig = get_error_routine();
+	deferred_warn_orig = get_warn_routine();
+	set_error_routine(deferred_error);
+	set_warn_routine(deferred_warn);
+}
+
+void defer_thread_reports(struct strbuf *buf)
+{
+	pthread_setspecific(deferred_reports_key, buf);
+}
+
+void stop_deferred_reports(void)
+{
+	if (!deferred_error_orig)
+		return;
+	set_error_routine(deferred_error_orig);
+	set_warn_routine(deferred_warn_orig);
+	deferred_error_orig = deferred_warn_orig = NULL;
+	pthread_key_delete(deferred_reports_key);
+}
+
 #ifdef NO_PTHREADS
 int dummy_pthread_create(pthread_t *pthread, const void *attr,
 			 void *(*fn)(void *), void *data)
@@ -53,5 +53,21 @@ int dummy_pthread_init(void *);
 int online_cpus(void);
 int init_recursive_mutex(pthread_mutex_t*);
 
+struct strbuf;
+
+/*
+ * Deferred reports for worker threads.
+ *
+ * Between start_deferred_reports() and stop_deferred_reports(), error()
+ * and warning() messages from a thread that has called
+ * defer_thread_reports() with a buffer are appended to that buffer
+ * (prefix and trailing newline included) instead of being printed, so
+ * that the caller can emit them in a deterministic order. Other threads,
+ * and threads that passed NULL, report as usual. Only one user at a time.
+ */
+void start_deferred_reports(void);
+void defer_thread_reports(struct strbuf *buf);
+void stop_deferred_reports(void);
+
 
 #endif /* THREAD_COMPAT_H */
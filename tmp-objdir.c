@@ -6,6 +6,8 @@
 #include "chdir-notify.h"
 #include "dir.h"
 #include "environment.h"
+#include "loose-index.h"
+#include "oid-array.h"
 #include "object-file.h"
 #include "path.h"
 #include "string-list.h"
@@ -251,9 +253,18 @@ static int migrate_paths(struct strbuf *src, struct strbuf *dst)
 	return ret;
 }
 
+static int collect_loose_object(const struct object_id *oid,
+				const char *path UNUSED,
+				void *data)
+{
+	oid_array_append(data, oid);
+	return 0;
+}
+
 int tmp_objdir_migrate(struct tmp_objdir *t)
 {
 	struct strbuf src = STRBUF_INIT, dst = STRBUF_INIT;
+	struct oid_array loose = OID_ARRAY_INIT;
 	int ret;
 
 	if (!t)
@@ -269,8 +280,25 @@ int tmp_objdir_migrate(struct tmp_objdir *t)
 	strbuf_addbuf(&src, &t->path);
 	strbuf_addstr(&dst, get_object_directory());
 
+	/*
+	 * Loose objects migrated by renaming them are not seen by the loose
+	 * object index of the destination, so record them there ourselves.
+	 */
+	if (loose_index_maintained(the_repository->objects->odb))
+		for_each_loose_file_in_objdir(src.buf, collect_loose_object,
+					      NULL, NULL, &loose);
+
 	ret = migrate_paths(&src, &dst);
 
+	if (!ret) {
+		size_t i;
+
+		for (i = 0; i < loose.nr; i++)
+			loose_index_append(the_repository->objects->odb,
+					   &loose.oid[i]);
+	}
+
+	oid_array_clear(&loose);
 	strbuf_release(&src);
 	strbuf_release(&dst);
 
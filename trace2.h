@@ -559,6 +559,11 @@ enum trace2_counter_id {
 	TRACE2_COUNTER_ID_FSYNC_WRITEOUT_ONLY,
 	TRACE2_COUNTER_ID_FSYNC_HARDWARE_FLUSH,
 
+	/* delta base cache lookups and evictions */
+	TRACE2_COUNTER_ID_DELTA_BASE_CACHE_HIT,
+	TRACE2_COUNTER_ID_DELTA_BASE_CACHE_MISS,
+	TRACE2_COUNTER_ID_DELTA_BASE_CACHE_EVICT,
+
 	/* Add additional counter definitions before here. */
 	TRACE2_NUMBER_OF_COUNTERS
 };
@@ -41,6 +41,21 @@ static struct tr2_counter_metadata tr2_counter_metadata[TRACE2_NUMBER_OF_COUNTER
 		.name = "hardware-flush",
 		.want_per_thread_events = 0,
 	},
+	[TRACE2_COUNTER_ID_DELTA_BASE_CACHE_HIT] = {
+		.category = "delta-base-cache",
+		.name = "hit",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_DELTA_BASE_CACHE_MISS] = {
+		.category = "delta-base-cache",
+		.name = "miss",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_DELTA_BASE_CACHE_EVICT] = {
+		.category = "delta-base-cache",
+		.name = "evict",
+		.want_per_thread_events = 0,
+	},
 
 	/* Add additional metadata before here. */
 };
@@ -88,6 +88,15 @@ typedef struct s_xpparam {
 	/* See Documentation/diff-options.txt. */
 	char **anchors;
 	size_t anchors_nr;
+
+	/*
+	 * If positive, give up looking for a short diff of a region once
+	 * about this much work per line has been spent, and show the
+	 * whole region as changed instead; max_cost_reached (if set) is
+	 * then set to 1.
+	 */
+	long max_cost;
+	int *max_cost_reached;
 } xpparam_t;
 
 typedef struct s_xdemitcb {
@@ -41,6 +41,8 @@ typedef struct s_xdpsplit {
  * returns the furthest point of reach. We might encounter expensive edge cases
  * using this algorithm, so a little bit of heuristic is needed to cut the
  * search and to return a suboptimal point.
+ *
+ * Returns 0 without a split point if we ran over xenv->max_cost.
  */
 static long xdl_split(unsigned long const *ha1, long off1, long lim1,
 		      unsigned long const *ha2, long off2, long lim2,
@@ -52,6 +54,7 @@ static long xdl_split(unsigned long const *ha1, long off1, long lim1,
 	long fmin = fmid, fmax = fmid;
 	long bmin = bmid, bmax = bmid;
 	long ec, d, i1, i2, prev1, best, dd, v, k;
+	long snakes = 0;
 
 	/*
 	 * Set initial diagonal values for both forward and backward path.
@@ -88,6 +91,7 @@ static long xdl_split(unsigned long const *ha1, long off1, long lim1,
 			prev1 = i1;
 			i2 = i1 - d;
 			for (; i1 < lim1 && i2 < lim2 && ha1[i1] == ha2[i2]; i1++, i2++);
+			snakes += i1 - prev1;
 			if (i1 - prev1 > xenv->snake_cnt)
 				got_snake = 1;
 			kvdf[d] = i1;
@@ -125,6 +129,7 @@ static long xdl_split(unsigned long const *ha1, long off1, long lim1,
 			prev1 = i1;
 			i2 = i1 - d;
 			for (; i1 > off1 && i2 > off2 && ha1[i1 - 1] == ha2[i2 - 1]; i1--, i2--);
+			snakes += prev1 - i1;
 			if (prev1 - i1 > xenv->snake_cnt)
 				got_snake = 1;
 			kvdb[d] = i1;
@@ -136,6 +141,17 @@ static long xdl_split(unsigned long const *ha1, long off1, long lim1,
 			}
 		}
 
+		/*
+		 * Count the diagonals we have looked at and the snakes we
+		 * followed, and give up once the caller's budget is spent.
+		 */
+		if (xenv->max_cost) {
+			xenv->cost += (fmax - fmin) / 2 + (bmax - bmin) / 2 + 2 + snakes;
+			snakes = 0;
+			if (xenv->cost > xenv->max_cost)
+				return 0;
+		}
+
 		if (need_min)
 			continue;
 
@@ -282,17 +298,35 @@ int xdl_recs_cmp(diffdata_t *dd1, long off1, long lim1,
 			rchg1[rindex1[off1]] = 1;
 	} else {
 		xdpsplit_t spl;
+		long ec = 0;
 		spl.i1 = spl.i2 = 0;
 
 		/*
 		 * Divide ...
 		 */
-		if (xdl_split(ha1, off1, lim1, ha2, off2, lim2, kvdf, kvdb,
-			      need_min, &spl, xenv) < 0) {
+		if ((!xenv->max_cost || xenv->cost <= xenv->max_cost) &&
+		    (ec = xdl_split(ha1, off1, lim1, ha2, off2, lim2, kvdf, kvdb,
+				    need_min, &spl, xenv)) < 0) {
 
 			return -1;
 		}
 
+		/*
+		 * ... or, if that is too expensive, give up on this box and
+		 * show all of it as changed.
+		 */
+		if (!ec) {
+			char *rchg1 = dd1->rchg, *rchg2 = dd2->rchg;
+			long *rindex1 = dd1->rindex, *rindex2 = dd2->rindex;
+
+			for (; off1 < lim1; off1++)
+				rchg1[rindex1[off1]] = 1;
+			for (; off2 < lim2; off2++)
+				rchg2[rindex2[off2]] = 1;
+			xenv->gave_up++;
+			return 0;
+		}
+
 		/*
 		 * ... et Impera.
 		 */
@@ -352,6 +386,12 @@ int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 		xenv.mxcost = XDL_MAX_COST_MIN;
 	xenv.snake_cnt = XDL_SNAKE_CNT;
 	xenv.heur_min = XDL_HEUR_MIN_COST;
+	xenv.max_cost = 0;
+	if (xpp->max_cost > 0)
+		xenv.max_cost = xpp->max_cost < XDL_LINE_MAX / ndiags ?
+			xpp->max_cost * ndiags : XDL_LINE_MAX;
+	xenv.cost = 0;
+	xenv.gave_up = 0;
 
 	dd1.nrec = xe->xdf1.nreff;
 	dd1.ha = xe->xdf1.ha;
@@ -366,6 +406,8 @@ int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 			   kvdf, kvdb, (xpp->flags & XDF_NEED_MINIMAL) != 0,
 			   &xenv);
 	xdl_free(kvd);
+	if (xenv.gave_up && xpp->max_cost_reached)
+		*xpp->max_cost_reached = 1;
  out:
 	if (res < 0)
 		xdl_free_env(xe);
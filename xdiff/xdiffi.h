@@ -35,6 +35,8 @@ typedef struct s_xdalgoenv {
 	long mxcost;
 	long snake_cnt;
 	long heur_min;
+	long max_cost, cost;
+	long gave_up;
 } xdalgoenv_t;
 
 typedef struct s_xdchange {
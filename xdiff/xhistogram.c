@@ -233,6 +233,8 @@ static int fall_back_to_classic_diff(xpparam_t const *xpp, xdfenv_t *env,
 
 	memset(&xpparam, 0, sizeof(xpparam));
 	xpparam.flags = xpp->flags & ~XDF_DIFF_ALGORITHM_MASK;
+	xpparam.max_cost = xpp->max_cost;
+	xpparam.max_cost_reached = xpp->max_cost_reached;
 
 	return xdl_fall_back_diff(env, &xpparam,
 				  line1, count1, line2, count2);
@@ -309,6 +309,8 @@ static int fall_back_to_classic_diff(struct hashmap *map,
 
 	memset(&xpp, 0, sizeof(xpp));
 	xpp.flags = map->xpp->flags & ~XDF_DIFF_ALGORITHM_MASK;
+	xpp.max_cost = map->xpp->max_cost;
+	xpp.max_cost_reached = map->xpp->max_cost_reached;
 
 	return xdl_fall_back_diff(map->env, &xpp,
 				  line1, count1, line2, count2);